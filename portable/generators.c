@@ -60,7 +60,11 @@ its carefully designed limitations.
 #include "rangefrac-gen.h"
 #include "flatwave-gen.h"
 #include "bubble-gen.h"
-//#include "branchfrac-gen.h"
+#include "branchfrac-gen.h"
+#include "galaxy-gen.h"
+#include "perlin-gen.h"
+#include "worley-gen.h"
+#include "spectral-gen.h"
 
 #ifndef true
 #define true 1 
@@ -77,8 +81,15 @@ The value the init function returns will be saved and passed back to
 the generator on every call from now on as the "refcon" value.
 This is designed to make it easier for generators to support multiple
 threads working on different output layers. 
+Every random number the generator needs must come from the rng it is
+given, never from rand(). That way two layers can be set up on different
+threads at once, and the same seed always rebuilds the same layer.
+Width and height are the size of the layer in pixels. Most generators
+don't care, but one which builds its image ahead of time can use them to
+decide how much detail is worth building. The options are never NULL;
+most generators ignore them, and none may keep the pointer.
 */
-typedef void* (*GenInitProc)(void);
+typedef void* (*GenInitProc)(int width, int height, RandRef rng, GenOptionsRef options);
 /*
 Function to clean up all the mess created by the InitProc. After the
 exit proc has been called, the refcon value will be discarded, so
@@ -99,6 +110,29 @@ and sends you something outside that range, this module will
 simply cap it off at 0 or 1, as appropriate.
 */
 typedef float (*GenPointProc)(float h, float v, void* refcon);
+/*
+This is optional. It reports the least and greatest values the generator
+could return for any point in the rectangle from left, top to right,
+bottom, in the same 0..1 space the point function uses. The bounds have to
+be conservative - every real value must fall within them - but they don't
+have to be tight; interval arithmetic over the generator's parameters is
+usually good enough. The engine uses them to prove that whole tiles of a
+layer are hidden, or flat, without calculating a single pixel. Generators
+which can't say anything useful leave this NULL.
+*/
+typedef void (*GenBoundsProc)(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
+/*
+This is optional too. It fills in out[0] through out[count - 1] with the
+values of the points at h[0] through h[count - 1], all at the vertical
+position v. The results must be exactly what the point function would
+return for each point; the span function just gets to do everything that
+is the same along a row, like picking which formula to use, once instead
+of once per point. The manager calls the point function for generators
+which leave this NULL. With fast math on, a span may take shortcuts of its
+own and differ from the point function by about as much as the fast math
+functions do.
+*/
+typedef void (*GenSpanProc)(const float* h, float v, int count, void* refcon, float* out);
 
 //Description of one generator - everything we know about it.
 typedef struct GeneratorRec
@@ -108,6 +142,8 @@ typedef struct GeneratorRec
 	GenInitProc init;	//function to start up the generator
 	GenExitProc exit;	//function to close the generator down
 	GenPointProc process;		//processor function that does all the real work	
+	GenBoundsProc bounds;		//optional: range of values over a rectangle
+	GenSpanProc span;			//optional: values along a row of points
 	}
 GeneratorRec;
 
@@ -115,104 +151,160 @@ GeneratorRec;
 struct GeneratorList
 	{
 	int generatorCount;
-	GeneratorRec* gen;
+	const GeneratorRec* gen;
 	};
 
 //Structure keeping track of a single generator layer.
 typedef struct LayerRec
 	{
-	GeneratorRec* gencode;
+	const GeneratorRec* gencode;
 	void* refcon;
 	int hmax, vmax;
 	int rollh, rollv;
+	float aacontrast;	//0 means always supersample; see SetLayerAntiAliasing
+	float seamwidth;	//share of the tile the seam blend covers; see SetLayerSeamWidth
+	uint64_t serial;	//tells this layer apart from every other, for the sample cache
+	int fastmath;		//switched on for the generator while it works; see SwapFastMath
 	}
 LayerRec;
 
 #define CHANNELVAL_FMAX 255.0
+/*
+Generators calculate in single precision, so their values and positions
+can be a hair off from what exact arithmetic says. Layer bounds are padded
+by this much, in 0..1 space, to keep them honest.
+*/
+#define BOUNDS_POSITION_SLOP 1e-5
+#define BOUNDS_VALUE_SLOP 1e-3
+/*
+GetLayerSpan works through a row in pieces of at most this many pixels,
+so that the samples for a piece can live on the stack.
+*/
+#define LAYER_ROW_CHUNK 64
+/*
+Adaptive anti-aliasing checks each pixel against the one below it, whose
+sample is the next row's own. Rows of a tile are done in order, so each
+thread keeps the last SAMPLE_CACHE_ROWS rows of samples it worked out, and
+the next row picks its samples up from there rather than working them
+out twice. A row is only reused for exactly the same layer, row and run of
+pixels, so the values are the same either way.
+*/
+#define SAMPLE_CACHE_ROWS 8
+
+typedef struct SampleRow
+	{
+	uint64_t layer;		//serial number of the layer; 0 for an empty slot
+	float vpos;
+	float hstart;
+	int count;
+	float sample[LAYER_ROW_CHUNK];
+	}
+SampleRow;
+
+#ifndef STARFISH_THREADS
+#define STARFISH_THREADS 0
+#endif
+#if STARFISH_THREADS
+static __thread SampleRow samplecache[SAMPLE_CACHE_ROWS];
+static __thread int samplecachenext;
+#else
+static SampleRow samplecache[SAMPLE_CACHE_ROWS];
+static int samplecachenext;
+#endif
+static uint64_t layerserial = 0;
 
 static greybuf GeneratePointFunction(int h, int v, LayerRef gen);
-static float GetWrappedPoint(float hpos, float vpos, void* refcon, GeneratorRec* gen);
-static float GetAntiAliasedPoint(float hpos, float vpos, float fudge, void* refcon, GeneratorRec* gen);
+static float GetWrappedPoint(float hpos, float vpos, LayerRef it);
+static void GetWrappedRow(const float* hpos, float vpos, int count, LayerRef it, float* out);
+static void EvaluateRow(const float* hpos, float vpos, int count, LayerRef it, float* out);
+static void GetCachedRow(const float* hpos, float vpos, int count, LayerRef it, float* out);
+static float BlendSeamFull(float hpos, float vpos, float here, float farval1, float farval2, float farval3);
+static float BlendSeamBand(float hpos, float vpos, float here, LayerRef it);
+static float CombineSeamBand(float here, float farv, float farh, float farhv, float hweight, float vweight);
+static float SeamWeight(float pos, float width);
+static float ClipPoint(float pixelval);
+static float GetAntiAliasedPoint(float hpos, float vpos, float fudge, LayerRef it);
+static void GetAntiAliasedRow
+		(
+		const float* hpos,
+		float vpos,
+		float fudge,
+		float nextpos,
+		float belowpos,
+		int count,
+		LayerRef it,
+		channelval* out
+		);
+static float GetAdaptivePoint
+		(
+		float hpos,
+		float vpos,
+		float fudge,
+		float here,
+		float next,
+		float below,
+		LayerRef it
+		);
+static void GetWrappedBounds
+		(
+		float left, float top, float right, float bottom,
+		void* refcon,
+		const GeneratorRec* gen,
+		float* lo,
+		float* hi
+		);
 
-GenListRef LoadGenerators(void)
+/*
+The generator registry.
+Someday, this might be a really neat, fancy table built by scanning a
+directory for shared libraries, loading them and interrogating them.
+But, for now, we create the table by hand, using compiled-in code.
+Since the table never changes, it is a constant, and every texture in
+the process shares it. Nobody ever has to build it or throw it away.
+Each record is: isAntiAliased, isSeamless, init, exit, process, bounds, span.
+*/
+static const GeneratorRec generatorTable[] =
 	{
+	//Our first one is the workhorse Coswave. It can do anything. 
+	{false, false, &CoswaveInit, &CoswaveExit, &Coswave, &CoswaveBounds, &CoswaveSpan},
+	//Next is the spinflake generator, for more shapely patterns.
+	{false, true, &SpinflakeInit, &SpinflakeExit, &Spinflake, &SpinflakeBounds, &SpinflakeSpan},
+	//The range fractal, which creates mountainous organic rough textures.
+	{true, true, &RangefracInit, &RangefracExit, &Rangefrac, &RangefracBounds, &RangefracSpan},
+	//The flatwave generator, which creates interfering linear waves.
+	{false, false, &FlatwaveInit, &FlatwaveExit, &Flatwave, &FlatwaveBounds, &FlatwaveSpan},
+	//Bubble generator, which creates lumpy, curved turbulences.
+	{true, true, &BubbleInit, &BubbleExit, &Bubble, &BubbleBounds, &BubbleSpan},
 	/*
-	Seek out and load up all available generators.
-	Someday, this will be a really neat, fancy routine that scans a directory
-	looking for shared libraries. It'll load those libraries, interrogate them,
-	and build a generator list from that.
-	But, for now, this is a quick hack: we create the table by hand, using
-	compiled-in code.
+	The branch fractal, which creates vegetable structures. It goes last
+	so that recipes saved before it came back still name the same
+	generators.
 	*/
-	int gencount;
-	GenListRef out;
-	size_t genlistsize;
-	//Count the number of shared libraries in the directory.
-	gencount = 5;
-	//Create a genlist big enough to hold that many generators.
-	out = malloc(sizeof(struct GeneratorList));
-	genlistsize = gencount * sizeof(GeneratorRec);
-	if(out) out->gen = (GenListRef)malloc(genlistsize);
-	if(out && out->gen)
-		{
-		//Poke in the generator count so we can get at it later.
-		out->generatorCount = gencount;
-		//Loop through the generators, filling out each record one by one.
-		//Our first one is the workhorse Coswave. It can do anything. 
-		out->gen[0].isAntiAliased = false;
-		out->gen[0].isSeamless = false;
-		out->gen[0].init = &CoswaveInit;
-		out->gen[0].exit = &CoswaveExit;
-		out->gen[0].process = &Coswave;
-		//Next is the spinflake generator, for more shapely patterns.
-		out->gen[1].isAntiAliased = false;
-		out->gen[1].isSeamless = true;
-		out->gen[1].init = &SpinflakeInit;
-		out->gen[1].exit = &SpinflakeExit;
-		out->gen[1].process = &Spinflake;
-		//The range fractal, which creates mountainous organic rough textures.
-		out->gen[2].isAntiAliased = true;
-		out->gen[2].isSeamless = true;
-		out->gen[2].init = &RangefracInit;
-		out->gen[2].exit = &RangefracExit;
-		out->gen[2].process = &Rangefrac;
-		//The flatwave generator, which creates interfering linear waves.
-		out->gen[3].isAntiAliased = false;
-		out->gen[3].isSeamless = false;
-		out->gen[3].init = &FlatwaveInit;
-		out->gen[3].exit = &FlatwaveExit;
-		out->gen[3].process = &Flatwave;
-		/*
-		//The branch fractal, which creates vegetable structures
-		out->gen[4].isAntiAliased = true;
-		out->gen[4].isSeamless = true;
-		out->gen[4].init = &BranchfracInit;
-		out->gen[4].exit = &BranchfracExit;
-		out->gen[4].process = &Branchfrac;
-		*/
-		//Bubble generator, which creates lumpy, curved turbulences.
-		out->gen[4].isAntiAliased = true;
-		out->gen[4].isSeamless = true;
-		out->gen[4].init = &BubbleInit;
-		out->gen[4].exit = &BubbleExit;
-		out->gen[4].process = &Bubble;
-		}
-	return out;
-	}
-
-void UnloadGenerators(GenListRef list)
-	{
+	{true, true, &BranchfracInit, &BranchfracExit, &Branchfrac, &BranchfracBounds, NULL},
 	/*
-	Unload all generators and release the memory they occupied.
-	For the moment, there is nothing we need to do to release the generators.
-	All we have to do is throw away the memory occupied by the generator list.
+	The galaxy generator, a sparkling cluster of stars. The sparkle is fresh
+	noise at every point, finer than any pixel, so it gets supersampled
+	like the rest.
 	*/
-	if(list)
-		{
-		if(list->gen) free(list->gen);
-		free(list);
-		list = NULL;
-		}
+	{false, true, &GalaxyInit, &GalaxyExit, &Galaxy, &GalaxyBounds, &GalaxySpan},
+	//Perlin noise, summed over octaves into clouds, billows or ridges. It tiles by itself.
+	{true, true, &PerlinInit, &PerlinExit, &Perlin, NULL, &PerlinSpan},
+	//Worley's cellular noise: cells, and the cracks between them. It keeps its cracks wide enough not to alias.
+	{true, true, &WorleyInit, &WorleyExit, &Worley, NULL, &WorleySpan},
+	//Spectral synthesis: smooth random waves of every size, added up by one Fourier transform.
+	{true, true, &SpectralInit, &SpectralExit, &Spectral, NULL, &SpectralSpan}
+	};
+
+static const struct GeneratorList generatorRegistry =
+	{
+	sizeof(generatorTable) / sizeof(generatorTable[0]),
+	generatorTable
+	};
+
+GenListRef SharedGenerators(void)
+	{
+	//Get the list of all available generators.
+	return &generatorRegistry;
 	}
 
 int CountGenerators(GenListRef list)
@@ -229,7 +321,7 @@ int CountGenerators(GenListRef list)
 	return out;
 	}
 
-greybuf Generate(int ctr, int h, int v, GenListRef list)
+greybuf Generate(int ctr, int h, int v, GenListRef list, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	Create a texture of appropriate dimensions from this generator.
@@ -246,7 +338,7 @@ greybuf Generate(int ctr, int h, int v, GenListRef list)
 	if(list)
 		{
 		//Create a new layer with the settings we were given.
-		layer = MakeLayer(ctr, h, v, list);
+		layer = MakeLayer(ctr, h, v, list, rng, options);
 		if(layer)
 			{
 			//Pass the layer to the greybuf creator to retrieve our image.
@@ -258,7 +350,7 @@ greybuf Generate(int ctr, int h, int v, GenListRef list)
 	return out;
 	}
 
-LayerRef MakeLayer(int genctr, int h, int v, GenListRef list)
+LayerRef MakeLayer(int genctr, int h, int v, GenListRef list, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	Create a layer for later inspection.
@@ -267,6 +359,8 @@ LayerRef MakeLayer(int genctr, int h, int v, GenListRef list)
 	going to use.
 	*/
 	LayerRef out = NULL;
+	GenOptions defaults;
+	int oldmath;
 	//Verify our input parameters.
 	//The following line was the source of an extremely stupid bug in 1.0 through 1.1d3.
 	if(genctr >= 0 && genctr < CountGenerators(list) && h > 0 && v > 0)
@@ -279,13 +373,24 @@ LayerRef MakeLayer(int genctr, int h, int v, GenListRef list)
 			out->hmax = h;
 			out->vmax = v;
 			#if ROLL_TEXTURE
-			out->rollh = (rand() * h) / RAND_MAX;
-			out->rollv = (rand() * v) / RAND_MAX;
+			out->rollh = irand(rng, h);
+			out->rollv = irand(rng, v);
 			#else
 			out->rollh = out->rollv = 0;
 			#endif
+			out->aacontrast = 0;
+			out->seamwidth = 1.0;
+			out->serial = __atomic_add_fetch(&layerserial, 1, __ATOMIC_RELAXED);
 			//Now initialize our generator and save its refcon.
-			out->refcon = out->gencode->init ? out->gencode->init() : NULL;
+			if(!options)
+				{
+				DefaultGenOptions(&defaults);
+				options = &defaults;
+				}
+			out->fastmath = options->fastmath;
+			oldmath = SwapFastMath(out->fastmath);
+			out->refcon = out->gencode->init ? out->gencode->init(h, v, rng, options) : NULL;
+			SwapFastMath(oldmath);
 			}
 		}
 	return out;
@@ -314,18 +419,191 @@ channelval GetLayerPixel(int h, int v, LayerRef it)
 			code. Then we convert the floating point value to a standard 0..255
 			value and return it to the caller.
 			*/
-			float fhpos, fvpos, fhmax, fvmax, pixelval, fudge;
+			float fhpos, fvpos, fhmax, fvmax, fudge;
+			int oldmath = SwapFastMath(it->fastmath);
 			fhpos = ((h + it->rollh) < it->hmax) ? h + it->rollh : h + it->rollh - it->hmax;
 			fvpos = ((v + it->rollv) < it->vmax) ? v + it->rollv : v + it->rollv - it->vmax;
 			fhmax = it->hmax;
 			fvmax = it->vmax;
 			fudge = 1.0 / (fhmax + fvmax);
-			out = GetAntiAliasedPoint(fhpos / fhmax, fvpos / fvmax, fudge, it->refcon, it->gencode) * CHANNELVAL_FMAX;
+			if(it->aacontrast > 0 && !it->gencode->isAntiAliased)
+				{
+				//Adaptive anti-aliasing compares the pixel with its neighbours to the right and below.
+				float here, next, below, fnexth, fbelowv;
+				fnexth = (fhpos + 1 < it->hmax) ? fhpos + 1 : 0;
+				fbelowv = (fvpos + 1 < it->vmax) ? fvpos + 1 : 0;
+				here = GetWrappedPoint(fhpos / fhmax, fvpos / fvmax, it);
+				next = GetWrappedPoint(fnexth / fhmax, fvpos / fvmax, it);
+				below = GetWrappedPoint(fhpos / fhmax, fbelowv / fvmax, it);
+				out = GetAdaptivePoint(fhpos / fhmax, fvpos / fvmax, fudge, here, next, below, it) * CHANNELVAL_FMAX;
+				}
+			else out = GetAntiAliasedPoint(fhpos / fhmax, fvpos / fvmax, fudge, it) * CHANNELVAL_FMAX;
+			SwapFastMath(oldmath);
 			}
 		}
 	return out;
 	}
 
+void GetLayerSpan(int h, int v, int count, LayerRef it, channelval* out)
+	{
+	/*
+	Get a run of pixel values from one row of the layer.
+	This produces exactly the same values as calling GetLayerPixel on each
+	pixel in turn, but everything that is constant along the row - the
+	bounds check, the vertical position, the anti-alias fudge factor - is
+	worked out once for the whole span instead of once per pixel.
+	We cut the span into pieces whose rolled positions run straight, without
+	wrapping around the edge of the layer, and calculate each piece a whole
+	row of samples at a time. That way generators with a span function can
+	do each row of samples in one call.
+	*/
+	float hpos[LAYER_ROW_CHUNK];
+	int ctr, rolled, length;
+	if(!out) return;
+	if(it && v >= 0 && v < it->vmax)
+		{
+		float fhpos, fvpos, fhmax, fvmax, fudge, nextpos, belowpos;
+		int oldmath = SwapFastMath(it->fastmath);
+		fvpos = ((v + it->rollv) < it->vmax) ? v + it->rollv : v + it->rollv - it->vmax;
+		fhmax = it->hmax;
+		fvmax = it->vmax;
+		fudge = 1.0 / (fhmax + fvmax);
+		//Adaptive anti-aliasing also wants the row below.
+		belowpos = (fvpos + 1 < it->vmax) ? fvpos + 1 : 0;
+		belowpos /= fvmax;
+		fvpos /= fvmax;
+		for(ctr = 0; ctr < count; )
+			{
+			if(h + ctr < 0 || h + ctr >= it->hmax)
+				{
+				out[ctr++] = MIN_CHANVAL;
+				continue;
+				}
+			rolled = h + ctr + it->rollh;
+			if(rolled >= it->hmax) rolled -= it->hmax;
+			for
+					(
+					length = 0;
+					length < LAYER_ROW_CHUNK && ctr + length < count
+							&& h + ctr + length < it->hmax && rolled + length < it->hmax;
+					length++
+					)
+				{
+				fhpos = rolled + length;
+				hpos[length] = fhpos / fhmax;
+				}
+			//Adaptive anti-aliasing also wants the pixel just past the piece.
+			fhpos = (rolled + length < it->hmax) ? rolled + length : 0;
+			nextpos = fhpos / fhmax;
+			GetAntiAliasedRow(hpos, fvpos, fudge, nextpos, belowpos, length, it, &out[ctr]);
+			ctr += length;
+			}
+		SwapFastMath(oldmath);
+		}
+	else
+		{
+		//The whole row is out of bounds.
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = MIN_CHANVAL;
+		}
+	}
+
+void GetLayerBounds(int h, int v, int width, int height, LayerRef it, channelval* lo, channelval* hi)
+	{
+	/*
+	Find the least and greatest values GetLayerPixel could return for any
+	pixel in the block. We work out which part of the generator's 0..1 space
+	the block covers - which may be two or four pieces, if rolling the
+	texture wrapped it around an edge - and ask the generator about each.
+	Anti-aliasing reaches a little past each pixel, so we stretch the
+	rectangles to cover that. Then we convert to channel values the same
+	way GetLayerPixel does, with a little extra room for rounding.
+	*/
+	float fhmax, fvmax, fudge, boundlo, boundhi, piecelo, piecehi;
+	int hstart[2], hend[2], vstart[2], vend[2], hpieces, vpieces, hctr, vctr, oldmath;
+	*lo = MIN_CHANVAL;
+	*hi = MAX_CHANVAL;
+	if(!it || !it->gencode->bounds || width <= 0 || height <= 0) return;
+	if(h < 0 || v < 0 || h + width > it->hmax || v + height > it->vmax) return;
+	fhmax = it->hmax;
+	fvmax = it->vmax;
+	fudge = 1.0 / (fhmax + fvmax);
+	//Split the rolled block into pieces which don't wrap.
+	hpieces = vpieces = 1;
+	hstart[0] = h + it->rollh;
+	if(hstart[0] >= it->hmax) hstart[0] -= it->hmax;
+	hend[0] = hstart[0] + width - 1;
+	if(hend[0] >= it->hmax)
+		{
+		hstart[1] = 0;
+		hend[1] = hend[0] - it->hmax;
+		hend[0] = it->hmax - 1;
+		hpieces = 2;
+		}
+	vstart[0] = v + it->rollv;
+	if(vstart[0] >= it->vmax) vstart[0] -= it->vmax;
+	vend[0] = vstart[0] + height - 1;
+	if(vend[0] >= it->vmax)
+		{
+		vstart[1] = 0;
+		vend[1] = vend[0] - it->vmax;
+		vend[0] = it->vmax - 1;
+		vpieces = 2;
+		}
+	boundlo = 1.0;
+	boundhi = 0.0;
+	oldmath = SwapFastMath(it->fastmath);
+	for(hctr = 0; hctr < hpieces; hctr++)
+		{
+		for(vctr = 0; vctr < vpieces; vctr++)
+			{
+			float left, top, right, bottom;
+			left = hstart[hctr] / fhmax - BOUNDS_POSITION_SLOP;
+			top = vstart[vctr] / fvmax - BOUNDS_POSITION_SLOP;
+			right = hend[hctr] / fhmax + BOUNDS_POSITION_SLOP;
+			bottom = vend[vctr] / fvmax + BOUNDS_POSITION_SLOP;
+			if(!it->gencode->isAntiAliased)
+				{
+				right += fudge;
+				bottom += fudge;
+				}
+			if(left < 0) left = 0;
+			if(top < 0) top = 0;
+			GetWrappedBounds(left, top, right, bottom, it->refcon, it->gencode, &piecelo, &piecehi);
+			if(piecelo < boundlo) boundlo = piecelo;
+			if(piecehi > boundhi) boundhi = piecehi;
+			}
+		}
+	SwapFastMath(oldmath);
+	//Allow for rounding, then clip and convert just as the pixel functions do.
+	boundlo -= BOUNDS_VALUE_SLOP;
+	boundhi += BOUNDS_VALUE_SLOP;
+	if(boundlo < 0.0) boundlo = 0.0;
+	if(boundhi > 1.0) boundhi = 1.0;
+	if(boundlo > boundhi) return;
+	*lo = boundlo * CHANNELVAL_FMAX;
+	*hi = boundhi * CHANNELVAL_FMAX;
+	}
+
+void SetLayerAntiAliasing(LayerRef it, int contrast)
+	{
+	//Store the contrast in the same 0..1 space the generators work in.
+	if(it)
+		{
+		if(contrast < 0) contrast = 0;
+		it->aacontrast = contrast / CHANNELVAL_FMAX;
+		}
+	}
+
+void SetLayerSeamWidth(LayerRef it, float width)
+	{
+	if(it)
+		{
+		if(width > 1.0) width = 1.0;
+		if(width < MIN_SEAM_WIDTH) width = MIN_SEAM_WIDTH;
+		it->seamwidth = width;
+		}
+	}
+
 void DumpLayer(LayerRef it)
 	{
 	/*
@@ -358,28 +636,25 @@ static greybuf GeneratePointFunction(int hmax, int vmax, LayerRef it)
 	if(out)
 		{
 		/*
-		Iterate through every pixel in the greybuf.
-		For each pixel, grab a value from the layer function and install it
-		as the value in the pixel.
+		Iterate through every row in the greybuf.
+		For each row, grab a span of values from the layer function and write
+		them straight into the rasterline.
 		*/
-		int hctr, vctr;
+		int vctr;
 		//Iterate through each line of the texture, calculating points as we go.
 		for(vctr = 0; vctr < vmax; vctr++)
 			{
-			for(hctr = 0; hctr < hmax; hctr++)
-				{
-				SetGreyBufPixel(out, hctr, vctr, GetLayerPixel(hctr, vctr, it));
-				}
+			GetLayerSpan(0, vctr, hmax, it, PeekGreyRasterLine(out, vctr));
 			}
 		}
 	return out;
 	}
 
-static float GetAntiAliasedPoint(float fhpos, float fvpos, float fudge, void* refcon, GeneratorRec* gen)
+static float GetAntiAliasedPoint(float fhpos, float fvpos, float fudge, LayerRef it)
 	{
 	float pixelval;
-	pixelval = GetWrappedPoint(fhpos, fvpos, refcon, gen);
-	if(!gen->isAntiAliased)
+	pixelval = GetWrappedPoint(fhpos, fvpos, it);
+	if(!it->gencode->isAntiAliased)
 		{
 		/*
 		This generator does not anti-alias itself.
@@ -391,15 +666,195 @@ static float GetAntiAliasedPoint(float fhpos, float fvpos, float fudge, void* re
 		improves the way sharp transitions look. You can't see the individual
 		pixels nearly so easily.
 		*/
-		pixelval += GetWrappedPoint(fhpos + fudge, fvpos, refcon, gen);
-		pixelval += GetWrappedPoint(fhpos, fvpos + fudge, refcon, gen);
-		pixelval += GetWrappedPoint(fhpos + fudge, fvpos + fudge, refcon, gen);
+		pixelval += GetWrappedPoint(fhpos + fudge, fvpos, it);
+		pixelval += GetWrappedPoint(fhpos, fvpos + fudge, it);
+		pixelval += GetWrappedPoint(fhpos + fudge, fvpos + fudge, it);
 		pixelval /= 4;
 		}
 	return pixelval;
 	}
 
-static float GetWrappedPoint(float fhpos, float fvpos, void* refcon, GeneratorRec* gen)
+static void GetAntiAliasedRow
+		(
+		const float* hpos,
+		float fvpos,
+		float fudge,
+		float nextpos,
+		float belowpos,
+		int count,
+		LayerRef it,
+		channelval* out
+		)
+	{
+	/*
+	Anti-alias a row of up to LAYER_ROW_CHUNK pixels, exactly as
+	GetAntiAliasedPoint or GetAdaptivePoint would, but one row of samples
+	at a time: the pixels themselves, then the samples down and to the
+	right, and so on. With adaptive anti-aliasing, each pixel's right-hand
+	neighbour is just the next pixel, except for the last one, which is at
+	nextpos; the pixels below are the row at belowpos, which the next row
+	will want again. Only the pixels which turn out to need it get the
+	other three samples, gathered up into rows of their own.
+	*/
+	float here[LAYER_ROW_CHUNK], across[LAYER_ROW_CHUNK];
+	float down[LAYER_ROW_CHUNK], diagonal[LAYER_ROW_CHUNK], shifted[LAYER_ROW_CHUNK];
+	float below[LAYER_ROW_CHUNK], roughpos[LAYER_ROW_CHUNK];
+	int rough[LAYER_ROW_CHUNK];
+	float pixelval, next;
+	int ctr, roughcount;
+	if(it->gencode->isAntiAliased)
+		{
+		GetWrappedRow(hpos, fvpos, count, it, here);
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = here[ctr] * CHANNELVAL_FMAX;
+		return;
+		}
+	if(it->aacontrast > 0)
+		{
+		GetCachedRow(hpos, fvpos, count, it, here);
+		GetCachedRow(hpos, belowpos, count, it, below);
+		roughcount = 0;
+		for(ctr = 0; ctr < count; ctr++)
+			{
+			next = (ctr + 1 < count) ? here[ctr + 1] : GetWrappedPoint(nextpos, fvpos, it);
+			if(fabs(next - here[ctr]) <= it->aacontrast && fabs(below[ctr] - here[ctr]) <= it->aacontrast)
+				{
+				out[ctr] = here[ctr] * CHANNELVAL_FMAX;
+				continue;
+				}
+			rough[roughcount] = ctr;
+			roughpos[roughcount] = hpos[ctr];
+			shifted[roughcount] = hpos[ctr] + fudge;
+			roughcount++;
+			}
+		if(!roughcount) return;
+		GetWrappedRow(shifted, fvpos, roughcount, it, across);
+		GetWrappedRow(roughpos, fvpos + fudge, roughcount, it, down);
+		GetWrappedRow(shifted, fvpos + fudge, roughcount, it, diagonal);
+		for(ctr = 0; ctr < roughcount; ctr++)
+			{
+			pixelval = here[rough[ctr]];
+			pixelval += across[ctr];
+			pixelval += down[ctr];
+			pixelval += diagonal[ctr];
+			pixelval /= 4;
+			out[rough[ctr]] = pixelval * CHANNELVAL_FMAX;
+			}
+		return;
+		}
+	GetWrappedRow(hpos, fvpos, count, it, here);
+	for(ctr = 0; ctr < count; ctr++) shifted[ctr] = hpos[ctr] + fudge;
+	GetWrappedRow(shifted, fvpos, count, it, across);
+	GetWrappedRow(hpos, fvpos + fudge, count, it, down);
+	GetWrappedRow(shifted, fvpos + fudge, count, it, diagonal);
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		pixelval = here[ctr];
+		pixelval += across[ctr];
+		pixelval += down[ctr];
+		pixelval += diagonal[ctr];
+		pixelval /= 4;
+		out[ctr] = pixelval * CHANNELVAL_FMAX;
+		}
+	}
+
+static void GetCachedRow(const float* hpos, float vpos, int count, LayerRef it, float* out)
+	{
+	/*
+	GetWrappedRow, unless this thread has worked out the same row of
+	samples lately, in which case we copy them. Either way, we remember
+	it, in place of the oldest row we had.
+	*/
+	SampleRow* row;
+	int ctr, slot;
+	for(slot = 0; slot < SAMPLE_CACHE_ROWS; slot++)
+		{
+		row = &samplecache[slot];
+		if(row->layer == it->serial && row->vpos == vpos && row->hstart == hpos[0] && row->count == count)
+			{
+			for(ctr = 0; ctr < count; ctr++) out[ctr] = row->sample[ctr];
+			return;
+			}
+		}
+	GetWrappedRow(hpos, vpos, count, it, out);
+	row = &samplecache[samplecachenext];
+	samplecachenext = (samplecachenext + 1) % SAMPLE_CACHE_ROWS;
+	row->layer = it->serial;
+	row->vpos = vpos;
+	row->hstart = hpos[0];
+	row->count = count;
+	for(ctr = 0; ctr < count; ctr++) row->sample[ctr] = out[ctr];
+	}
+
+static float GetAdaptivePoint
+		(
+		float fhpos,
+		float fvpos,
+		float fudge,
+		float here,
+		float next,
+		float below,
+		LayerRef it
+		)
+	{
+	/*
+	Anti-alias a pixel, but only as hard as it needs. We already have this
+	pixel's own sample and those of its neighbours to the right and below.
+	If neither differs from it by more than the contrast, this pixel sits in
+	a smooth area, and its own sample tells us as much as four would.
+	Otherwise we take the other three and average all four, exactly as
+	GetAntiAliasedPoint does.
+	*/
+	float pixelval;
+	if(fabs(next - here) <= it->aacontrast && fabs(below - here) <= it->aacontrast)
+		{
+		return here;
+		}
+	pixelval = here;
+	pixelval += GetWrappedPoint(fhpos + fudge, fvpos, it);
+	pixelval += GetWrappedPoint(fhpos, fvpos + fudge, it);
+	pixelval += GetWrappedPoint(fhpos + fudge, fvpos + fudge, it);
+	return pixelval / 4;
+	}
+
+static void GetWrappedBounds
+		(
+		float left, float top, float right, float bottom,
+		void* refcon,
+		const GeneratorRec* gen,
+		float* lo,
+		float* hi
+		)
+	{
+	/*
+	Bounds on GetWrappedPoint over a rectangle. Wrapping blends each point
+	with three points a tile over, and the weights are never negative inside
+	the tile, so the blend stays within the union of the four rectangles'
+	bounds. Past the edge of the tile, the weights can go negative, so we
+	give up and say anything can happen.
+	*/
+	float farlo, farhi;
+	gen->bounds(left, top, right, bottom, refcon, lo, hi);
+	if(!gen->isSeamless)
+		{
+		if(right > 1.0 || bottom > 1.0)
+			{
+			*lo = 0.0;
+			*hi = 1.0;
+			return;
+			}
+		gen->bounds(left, top + 1.0, right, bottom + 1.0, refcon, &farlo, &farhi);
+		if(farlo < *lo) *lo = farlo;
+		if(farhi > *hi) *hi = farhi;
+		gen->bounds(left + 1.0, top, right + 1.0, bottom, refcon, &farlo, &farhi);
+		if(farlo < *lo) *lo = farlo;
+		if(farhi > *hi) *hi = farhi;
+		gen->bounds(left + 1.0, top + 1.0, right + 1.0, bottom + 1.0, refcon, &farlo, &farhi);
+		if(farlo < *lo) *lo = farlo;
+		if(farhi > *hi) *hi = farhi;
+		}
+	}
+
+static float GetWrappedPoint(float fhpos, float fvpos, LayerRef it)
 	{
 	/*
 	Get a point from this function.
@@ -411,25 +866,22 @@ static float GetWrappedPoint(float fhpos, float fvpos, void* refcon, GeneratorRe
 	*/
 	float pixelval = 0;
 	GenPointProc tempfn;
-	tempfn = (GenPointProc)gen->process;
+	void* refcon = it->refcon;
+	tempfn = (GenPointProc)it->gencode->process;
 	pixelval = tempfn(fhpos, fvpos, refcon);
 	/*
 	If this function does not generate seamlessly-tiled textures,
 	then it is our job to pull in out-of-band data and mix it in
 	with the actual pixel to get a smooth edge.
 	*/
-	if(!gen->isSeamless)
+	if(!it->gencode->isSeamless && it->seamwidth < 1.0)
+		{
+		pixelval = BlendSeamBand(fhpos, fvpos, pixelval, it);
+		}
+	else if(!it->gencode->isSeamless)
 		{
-		/*
-		We mix this pixel with out-of-band values from the opposite side
-		of the tile. This is a "weighted average" proportionate to the pixel's
-		distance from the edge of the tile. This creates a smoothly fading
-		transition from one side of the texture to the other when the edges are
-		tiled together.
-		*/
 		float farh, farv;
 		float farval1, farval2, farval3;
-		float totalweight, weight, farweight1, farweight2, farweight3;
 		//The farh and farv are on the opposite side of the tile.
 		farh = fhpos + 1.0;
 		farv = fvpos + 1.0;
@@ -437,17 +889,152 @@ static float GetWrappedPoint(float fhpos, float fvpos, void* refcon, GeneratorRe
 		farval1 = tempfn(fhpos, farv, refcon);
 		farval2 = tempfn(farh, fvpos, refcon);
 		farval3 = tempfn(farh, farv, refcon);
-		//Calculate the weight factors for each far point.
-		weight = fhpos * fvpos;
-		farweight1 = fhpos * (2.0 - farv);
-		farweight2 = (2.0 - farh) * fvpos;
-		farweight3 = (2.0 - farh) * (2.0 - farv);
-		totalweight = weight + farweight1 + farweight2 + farweight3;
-		//Now average all the pixels together, weighting each one by the local vs far weights.
-		pixelval =
-			((pixelval * weight) + (farval1 * farweight1) + (farval2 * farweight2) + (farval3 * farweight3))
-					 / totalweight;
+		pixelval = BlendSeamFull(fhpos, fvpos, pixelval, farval1, farval2, farval3);
 		}
+	return ClipPoint(pixelval);
+	}
+
+static void GetWrappedRow(const float* hpos, float fvpos, int count, LayerRef it, float* out)
+	{
+	/*
+	GetWrappedPoint for a row of up to LAYER_ROW_CHUNK points, all at the
+	same vertical position. We ask the generator for each row of values it
+	takes - the points, then their copies a tile down, and so on - then
+	blend them exactly as GetWrappedPoint does. With a narrow seam band,
+	only the points inside the band need copies from a tile across, so we
+	gather those up into a shorter row of their own.
+	*/
+	float farh[LAYER_ROW_CHUNK], farval1[LAYER_ROW_CHUNK];
+	float farval2[LAYER_ROW_CHUNK], farval3[LAYER_ROW_CHUNK];
+	int ctr;
+	EvaluateRow(hpos, fvpos, count, it, out);
+	if(!it->gencode->isSeamless && it->seamwidth < 1.0)
+		{
+		float hweight[LAYER_ROW_CHUNK], vweight, farv, farhval, farhv;
+		int inband[LAYER_ROW_CHUNK], bandcount, bandctr;
+		vweight = SeamWeight(fvpos, it->seamwidth);
+		bandcount = 0;
+		for(ctr = 0; ctr < count; ctr++)
+			{
+			hweight[ctr] = SeamWeight(hpos[ctr], it->seamwidth);
+			if(hweight[ctr] < 1.0)
+				{
+				farh[bandcount] = hpos[ctr] + 1.0;
+				inband[bandcount++] = ctr;
+				}
+			}
+		if(vweight < 1.0) EvaluateRow(hpos, fvpos + 1.0, count, it, farval1);
+		if(bandcount) EvaluateRow(farh, fvpos, bandcount, it, farval2);
+		if(bandcount && vweight < 1.0) EvaluateRow(farh, fvpos + 1.0, bandcount, it, farval3);
+		for(ctr = 0, bandctr = 0; ctr < count; ctr++)
+			{
+			farv = (vweight < 1.0) ? farval1[ctr] : 0;
+			farhval = farhv = 0;
+			if(bandctr < bandcount && inband[bandctr] == ctr)
+				{
+				farhval = farval2[bandctr];
+				if(vweight < 1.0) farhv = farval3[bandctr];
+				bandctr++;
+				}
+			out[ctr] = CombineSeamBand(out[ctr], farv, farhval, farhv, hweight[ctr], vweight);
+			}
+		}
+	else if(!it->gencode->isSeamless)
+		{
+		for(ctr = 0; ctr < count; ctr++) farh[ctr] = hpos[ctr] + 1.0;
+		EvaluateRow(hpos, fvpos + 1.0, count, it, farval1);
+		EvaluateRow(farh, fvpos, count, it, farval2);
+		EvaluateRow(farh, fvpos + 1.0, count, it, farval3);
+		for(ctr = 0; ctr < count; ctr++)
+			{
+			out[ctr] = BlendSeamFull(hpos[ctr], fvpos, out[ctr], farval1[ctr], farval2[ctr], farval3[ctr]);
+			}
+		}
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = ClipPoint(out[ctr]);
+	}
+
+static void EvaluateRow(const float* hpos, float fvpos, int count, LayerRef it, float* out)
+	{
+	//Raw values for a row of points, in one call if the generator can do rows.
+	int ctr;
+	if(it->gencode->span) it->gencode->span(hpos, fvpos, count, it->refcon, out);
+	else
+		{
+		GenPointProc tempfn = (GenPointProc)it->gencode->process;
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = tempfn(hpos[ctr], fvpos, it->refcon);
+		}
+	}
+
+static float BlendSeamFull(float fhpos, float fvpos, float here, float farval1, float farval2, float farval3)
+	{
+	/*
+	We mix this pixel with out-of-band values from the opposite side
+	of the tile. This is a "weighted average" proportionate to the pixel's
+	distance from the edge of the tile. This creates a smoothly fading
+	transition from one side of the texture to the other when the edges are
+	tiled together.
+	farval1 is from a tile down, farval2 from a tile across, and farval3
+	from a tile down and across.
+	*/
+	float farh, farv;
+	float totalweight, weight, farweight1, farweight2, farweight3;
+	farh = fhpos + 1.0;
+	farv = fvpos + 1.0;
+	//Calculate the weight factors for each far point.
+	weight = fhpos * fvpos;
+	farweight1 = fhpos * (2.0 - farv);
+	farweight2 = (2.0 - farh) * fvpos;
+	farweight3 = (2.0 - farh) * (2.0 - farv);
+	totalweight = weight + farweight1 + farweight2 + farweight3;
+	//Now average all the pixels together, weighting each one by the local vs far weights.
+	return ((here * weight) + (farval1 * farweight1) + (farval2 * farweight2) + (farval3 * farweight3))
+			/ totalweight;
+	}
+
+static float BlendSeamBand(float fhpos, float fvpos, float here, LayerRef it)
+	{
+	/*
+	The narrow version of the seam blend. The full blend fades from the
+	out-of-band copy to this one evenly across the whole tile, so every
+	point costs four generator calls. Any fade will do, as long as only the
+	far copy counts at the leading edge and only this one at the trailing
+	edge: then the two edges still meet. So we fade over a band along the
+	leading edges, and beyond it this point has all the weight. Out there we
+	never ask for the far copies, and most points cost one call instead of
+	four.
+	*/
+	GenPointProc tempfn = (GenPointProc)it->gencode->process;
+	float hweight, vweight, farv = 0, farh = 0, farhv = 0;
+	hweight = SeamWeight(fhpos, it->seamwidth);
+	vweight = SeamWeight(fvpos, it->seamwidth);
+	if(vweight < 1.0) farv = tempfn(fhpos, fvpos + 1.0, it->refcon);
+	if(hweight < 1.0) farh = tempfn(fhpos + 1.0, fvpos, it->refcon);
+	if(hweight < 1.0 && vweight < 1.0) farhv = tempfn(fhpos + 1.0, fvpos + 1.0, it->refcon);
+	return CombineSeamBand(here, farv, farh, farhv, hweight, vweight);
+	}
+
+static float CombineSeamBand(float here, float farv, float farh, float farhv, float hweight, float vweight)
+	{
+	//Mix the copies by their band weights. Copies with no weight are never fetched.
+	float out;
+	out = here * hweight * vweight;
+	if(vweight < 1.0) out += farv * hweight * (1.0 - vweight);
+	if(hweight < 1.0) out += farh * (1.0 - hweight) * vweight;
+	if(hweight < 1.0 && vweight < 1.0) out += farhv * (1.0 - hweight) * (1.0 - vweight);
+	return out;
+	}
+
+static float SeamWeight(float pos, float width)
+	{
+	//How much a point this far into the tile counts, on a smooth S-curve.
+	float t = pos / width;
+	if(t >= 1.0) return 1.0;
+	if(t <= 0.0) return 0.0;
+	return t * t * (3.0 - 2.0 * t);
+	}
+
+static float ClipPoint(float pixelval)
+	{
 	/*
 	If the generator messes up and returns an out-of-range value, we clip it here.
 	This way, curves that leap out of bounds simply get chopped off, instead of getting
@@ -45,25 +45,66 @@ throw the layer away. Or use it again, we don't really care.
 #define __starfish_generators__ 0
 
 #include "greymap.h"
+#include "genutils.h"
 
-//Opaque reference to all of the available generators.
-typedef struct GeneratorList* GenListRef;
+//Opaque reference to all of the available generators. The list is read-only.
+typedef const struct GeneratorList* GenListRef;
 //Reference to a generator instance with its package of settings.
 typedef struct LayerRec* LayerRef;
 
-//Seek out and load up all available generators.
-GenListRef LoadGenerators(void);
-//Unload all generators and release the memory they occupied.
-void UnloadGenerators(GenListRef list);
+/*
+Get the list of all available generators.
+There is only one list for the whole process. It is built into the
+program, never changes, and never needs to be thrown away, so any number
+of textures on any number of threads can share it.
+*/
+GenListRef SharedGenerators(void);
 //How many generators are available?
 int CountGenerators(GenListRef list);
 //Create a texture of appropriate dimensions from this generator.
-greybuf Generate(int ctr, int h, int v, GenListRef list);
+//All of its random choices are drawn from rng. NULL options mean the defaults.
+greybuf Generate(int ctr, int h, int v, GenListRef list, RandRef rng, GenOptionsRef options);
 
-//Create a layer for later inspection.
-LayerRef MakeLayer(int ctr, int h, int v, GenListRef list);
+//Create a layer for later inspection. All of its random choices are drawn from rng.
+//It is built with the options given, or the defaults if they are NULL.
+LayerRef MakeLayer(int ctr, int h, int v, GenListRef list, RandRef rng, GenOptionsRef options);
 //Get a pixel value from the layer. If out of bounds, returns MIN_CHANVAL.
 channelval GetLayerPixel(int h, int v, LayerRef it);
+//Get count pixel values from one row of the layer, starting at h.
+//Out of bounds pixels come back as MIN_CHANVAL, just like GetLayerPixel.
+void GetLayerSpan(int h, int v, int count, LayerRef it, channelval* out);
+/*
+Find the least and greatest values GetLayerPixel could return anywhere in
+the block of pixels width across and height down, starting at h, v. The
+bounds are conservative: they may be wider than the real values, never
+narrower. If the generator can't tell, you get MIN_CHANVAL and MAX_CHANVAL.
+*/
+void GetLayerBounds(int h, int v, int width, int height, LayerRef it, channelval* lo, channelval* hi);
+/*
+Layers from generators which don't anti-alias themselves normally average
+four samples for every pixel. Give a layer a contrast above zero, measured
+in channel values, and it takes the pixel's own sample first. If that is
+within the contrast of its neighbours to the right and below, the pixel is
+smooth and that one sample is its value; otherwise it takes the other three.
+The neighbours' samples are their own first samples, so they are shared:
+a span keeps its rows in a small cache, and the row below is found there
+when the next span asks for it. Smooth areas cost about one sample a pixel
+instead of four. Zero, the default, always takes all four, and gives exactly
+the same values as always.
+*/
+void SetLayerAntiAliasing(LayerRef it, int contrast);
+/*
+Generators which don't tile by themselves are made seamless by blending
+each point with copies of the generator one tile over, which costs four
+generator calls per point. By default the blend fades across the whole
+tile. A width below 1 fades it over only that share of the tile, along
+the top and left edges; everywhere else, a point costs one call. The
+tile still wraps seamlessly, but the pattern changes a little. Widths
+are clipped to between MIN_SEAM_WIDTH and 1.
+*/
+void SetLayerSeamWidth(LayerRef it, float width);
+//Seam bands narrower than this show their edges, so we don't allow them.
+#define MIN_SEAM_WIDTH 0.05
 //We are done with this layer; throw it away.
 void DumpLayer(LayerRef it);
 
@@ -71,4 +112,4 @@ void DumpLayer(LayerRef it);
 //point for each layer.
 #define ROLL_TEXTURE 1
 
-#endif //__starfish_generators__
\ No newline at end of file
+#endif //__starfish_generators__
@@ -27,6 +27,14 @@ to make it even more complicated by adding a third dimension...
 but that's off in the future somewhere. It would also be nice
 to add curves.
 
+Every stem is a straight line segment, so the distance to the nearest
+stem is the distance to the nearest segment. Once the tree is grown we
+file its segments away in a bounding volume hierarchy: a binary tree of
+boxes, each holding half the segments of its parent. A point can then
+skip every box that is farther away than the nearest stem it has found
+so far, which is almost all of them. The tree wraps around the edges of
+the tile, so we look for the nearest stem in the neighbouring tiles too.
+
 */
 
 #include "branchfrac-gen.h"
@@ -35,10 +43,22 @@ to add curves.
 #include <stdlib.h>
 
 #define MAX_BRANCHES 8
-#define CLOSE_ENOUGH 0.0001
-#define MAX_RAYS 128			//must be less than max(short)
-#define ROOT_RAY 0
-#define MAX_PARENTS 5
+#define MAX_RAYS 4096			//must be less than max(short)
+#define MAX_PARENTS 8
+//The most segments we put in one box of the hierarchy before splitting it.
+#define BRANCH_LEAF_SEGMENTS 4
+/*
+Boxes are padded by this much, so that the rounding of the segment ends
+never leaves a segment nearer to a point than its box seems to be.
+*/
+#define BRANCH_BOX_SLOP 0.00001
+//Deep enough for any hierarchy over MAX_RAYS segments.
+#define BRANCH_STACK_DEPTH 64
+/*
+Bounds are worked out from the distance at the middle of the rectangle,
+which rounding could leave a hair out; this much extra distance covers it.
+*/
+#define BRANCH_BOUNDS_SLOP 0.00001
 
 typedef struct Ray
 	{
@@ -51,6 +71,22 @@ typedef struct Ray
 	}
 Ray;
 
+typedef struct Segment
+	{
+	float h, v;			//where does the stem start?
+	float dirh, dirv;	//which way does it go, as a unit vector?
+	float length;		//and how far?
+	}
+Segment;
+
+typedef struct BranchNode
+	{
+	float left, top, right, bottom;	//box around every segment below this node
+	int first;		//first segment of a leaf, or first of two child nodes
+	int count;		//segments in a leaf; zero for a node with children
+	}
+BranchNode;
+
 typedef struct Tree
 	{
 	int branchmin, branchmax;	//how many branches do we add, minimum and maximum?
@@ -59,17 +95,26 @@ typedef struct Tree
 	float twistmin, twistmax;	//how far do we rotate branches from the base?
 	int raycount;				//how many rays in the array are allocated?
 	Ray branch[MAX_RAYS];		//all the rays in this tree
+	Segment* segment;			//every ray as a segment, in hierarchy order
+	BranchNode* node;			//the hierarchy; node 0 is the root
+	int nodecount;
 	}
 Tree;
 
-static float TangentRayDistance(float h, float v, Ray* ray);
-static float ValueFromRay(float h, float v, Ray* ray, Tree* tree);
-static float ValueFromBranches(float h, float v, Ray* ray, Tree* tree);
 static int AllocRay(Tree* tree);
-static void MakeLeaves(Ray* ray, Tree* tree);
-static void MakeBranch(const Ray* ray, int whichbranch, Ray* branch, Tree* tree);
+static void MakeLeaves(Ray* ray, Tree* tree, RandRef rng);
+static void MakeBranch(const Ray* ray, int whichbranch, Ray* branch, Tree* tree, RandRef rng);
+static int BuildHierarchy(Tree* tree);
+static void BuildNode(Tree* tree, int index, int first, int count);
+static int CompareSegmentH(const void* a, const void* b);
+static int CompareSegmentV(const void* a, const void* b);
+static float SegmentDistanceSquared(float h, float v, const Segment* seg);
+static float BoxDistanceSquared(float h, float v, const BranchNode* node);
+static float NearestSquared(float h, float v, const Tree* tree, float best);
+static float NearestStem(float h, float v, const Tree* tree);
+static float ValueFromDistance(float distance);
 
-void* BranchfracInit(void)
+void* BranchfracInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	Make a new tree.
@@ -79,28 +124,42 @@ void* BranchfracInit(void)
 	Tree* out = (Tree*)malloc(sizeof(Tree));
 	if(out)
 		{
+		int ctr;
 		Ray* root = &out->branch[0];
 		out->raycount = 1;
 		//The root of the tree always starts in the centre of the image.
 		root->h = root->v = 0.5;
 		//Pick some random values for our root.
-		root->angle = frand(pi * 2);
+		root->angle = frand(rng, pi * 2);
 		root->length = 0.2;
 		root->ancestors = 0;
 		root->children = 0;
-		out->scalemin = 0.7;//frand(0.5) + 0.5;
+		out->scalemin = 0.7;//frand(rng, 0.5) + 0.5;
 		out->scalemax = 0.7;
 		//Pick how many branches this tree may have. Range is from 1 through 8 per node.
 		//Min can never be greater than max, and max can never be less than 1.
-		out->branchmax = 4;//round(frand(3.0) + 1.0);
-		out->branchmin = 2;//(rand() * out->branchmax) / RAND_MAX;
+		out->branchmax = 4;//round(frand(rng, 3.0) + 1.0);
+		out->branchmin = 2;//irand(rng, out->branchmax);
 		//Now pick some random divergence values - this determines how bushy the tree will be.
 		//We go from eighth-pi through half-pi.
-		out->divgmax = frand(pi / 2);
-		out->divgmin = frand(out->divgmax - (pi / 8)) + (pi / 8);
+		out->divgmax = frand(rng, pi / 2);
+		out->divgmin = frand(rng, out->divgmax - (pi / 8)) + (pi / 8);
 		//That's all the parameters we need for the fractal.
-		//Now go build the tree.
-		MakeLeaves(root, out);
+		/*
+		Now go build the tree. Rays are allocated in order, so working
+		through the array grows the tree a generation at a time; if we run
+		out of rays, it's the finest twigs that go missing, all over the
+		tree rather than down one side of it.
+		*/
+		for(ctr = 0; ctr < out->raycount; ctr++)
+			{
+			if(out->branch[ctr].ancestors < MAX_PARENTS) MakeLeaves(&out->branch[ctr], out, rng);
+			}
+		if(!BuildHierarchy(out))
+			{
+			BranchfracExit(out);
+			out = NULL;
+			}
 		}
 	return out;
 	}
@@ -112,16 +171,16 @@ static int AllocRay(Tree* tree)
 	return tree->raycount++;
 	}
 
-static void MakeLeaves(Ray* ray, Tree* tree)
+static void MakeLeaves(Ray* ray, Tree* tree, RandRef rng)
 	{
 	/*
 	Create a bunch of branches for this ray.
 	We pick a random number of branches, then iterate through
-	each one and create it separately. Each one in turn creates
-	*its* own set of branches.
+	each one and create it separately. Each one gets its own
+	branches later, when BranchfracInit comes to it.
 	*/
 	int ctr;
-	ray->children = irandge(tree->branchmin, tree->branchmax);
+	ray->children = irandge(rng, tree->branchmin, tree->branchmax);
 	for(ctr = 0; ctr < ray->children; ctr++)
 		{
 		int leafindex;
@@ -131,7 +190,7 @@ static void MakeLeaves(Ray* ray, Tree* tree)
 		if(leafindex)
 			{
 			leaf = &tree->branch[leafindex];
-			MakeBranch(ray, ctr, leaf, tree);
+			MakeBranch(ray, ctr, leaf, tree, rng);
 			}
 		}
 	}
@@ -141,97 +200,251 @@ void BranchfracExit(void* refcon)
 	/*
 	Throw away our tree, if it was created successfully.
 	*/
-	if(refcon) free(refcon);
+	Tree* glb = (Tree*)refcon;
+	if(glb)
+		{
+		if(glb->segment) free(glb->segment);
+		if(glb->node) free(glb->node);
+		free(glb);
+		}
 	}
 
 float Branchfrac(float h, float v, void* refcon)
 	{
 	/*
-	We have a point and an angle.
-	Find the distance from (h,v) to the tangent point on the ray.
+	Find the distance from (h,v) to the nearest stem of the tree.
+	*/
+	Tree* glb = (Tree*)refcon;
+	if(!glb) return 0;
+	return ValueFromDistance(NearestStem(h, v, glb));
+	}
+
+void BranchfracBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	No point in the rectangle is farther from the middle than half its
+	diagonal, so no point's nearest stem is more than that much nearer or
+	farther than the middle's. The value only goes down as the distance
+	goes up.
 	*/
-	float out = 0;
 	Tree* glb = (Tree*)refcon;
-	//Get the distance to the nearest branch.
-	out = ValueFromRay(h, v, &glb->branch[ROOT_RAY], glb);
+	float distance, reach;
+	*lo = 0.0;
+	*hi = 1.0;
+	if(!glb) return;
+	distance = NearestStem((left + right) / 2.0, (top + bottom) / 2.0, glb);
+	reach = hypotf(right - left, bottom - top) / 2.0 + BRANCH_BOUNDS_SLOP;
+	*lo = ValueFromDistance(distance + reach);
+	*hi = (distance > reach) ? ValueFromDistance(distance - reach) : 1.0;
+	}
+
+static float ValueFromDistance(float distance)
+	{
 	//Prettify that distance so it becomes an outputable value.
 	//We will eventually have several ways to do this.
-	return 1 / ((out * 10.0) + 1.0);
+	return 1 / ((distance * 10.0) + 1.0);
 	}
 
-static float TangentRayDistance(float h, float v, Ray* ray)
+static float NearestStem(float h, float v, const Tree* tree)
 	{
 	/*
-	Calculate the distance from this point to the tangent point
-	on the specified ray. If we are past the end of the ray's length,
-	the distance is the shorter of the distance to the tangent or the
-	distance to the endpoint.
+	The distance from this point to the nearest stem, counting the copies
+	of the tree in the neighbouring tiles. The tree never reaches more than
+	a tile from the middle of its own, so those are the only copies that
+	can be nearest. Our own tile goes first, since it usually has the
+	nearest stem, and then most of the other copies are out of reach
+	before we get into them.
 	*/
-	float pointangle, distance;
-	float leg;
-	pointangle = atan((ray->v - v) / (ray->h - h)) + ray->angle;
-	distance = fabs(cos(pointangle) * hypotf(ray->v - v, ray->h - h));
-	leg = sin(pointangle) * hypotf(ray->v - v, ray->h - h);
-	if(ray->h < h) leg = -leg;
-	//This algorithm results in a smooth, circular glow around the ends of the ray.
-	if(leg < 0.0)
+	static const float offset[3] = {0.0, -1.0, 1.0};
+	float best;
+	int hctr, vctr;
+	h -= floor(h);
+	v -= floor(v);
+	best = HUGE_VAL;
+	for(vctr = 0; vctr < 3; vctr++)
 		{
-		distance = hypotf(distance, leg);
+		for(hctr = 0; hctr < 3; hctr++)
+			{
+			best = NearestSquared(h + offset[hctr], v + offset[vctr], tree, best);
+			}
 		}
-	if(leg > ray->length)
+	return sqrt(best);
+	}
+
+static float NearestSquared(float h, float v, const Tree* tree, float best)
+	{
+	/*
+	Search the hierarchy for a segment nearer to the point than best, the
+	square of the nearest distance found so far. Return the square of the
+	nearest distance, or best if nothing is nearer. We look into the nearer
+	of a node's children first, so best shrinks as fast as it can.
+	*/
+	int stack[BRANCH_STACK_DEPTH];
+	int depth, ctr, nearchild, farchild;
+	const BranchNode* node;
+	float distance;
+	depth = 0;
+	stack[depth++] = 0;
+	while(depth > 0)
 		{
-		distance = hypotf(distance, leg - ray->length);
+		node = &tree->node[stack[--depth]];
+		if(BoxDistanceSquared(h, v, node) >= best) continue;
+		if(node->count)
+			{
+			for(ctr = node->first; ctr < node->first + node->count; ctr++)
+				{
+				distance = SegmentDistanceSquared(h, v, &tree->segment[ctr]);
+				if(distance < best) best = distance;
+				}
+			}
+		else
+			{
+			nearchild = node->first;
+			farchild = node->first + 1;
+			if(BoxDistanceSquared(h, v, &tree->node[farchild]) < BoxDistanceSquared(h, v, &tree->node[nearchild]))
+				{
+				nearchild = farchild;
+				farchild = node->first;
+				}
+			stack[depth++] = farchild;
+			stack[depth++] = nearchild;
+			}
 		}
-	//This algorithm, not currently in use, creates funky-cool glowing rays.
-	//The smooth glow is preferred because it is more organicky.
-	//if(leg < 0.0) distance += fabs(leg);
-	//if(leg > ray->length) distance += fabs(leg - ray->length);
-	return distance;
+	return best;
+	}
+
+static float SegmentDistanceSquared(float h, float v, const Segment* seg)
+	{
+	/*
+	Calculate the distance from this point to the nearest point on the
+	segment, squared. Past either end of the segment, that is the end
+	itself, which gives a smooth, circular glow around the ends.
+	*/
+	float relh, relv, leg;
+	relh = h - seg->h;
+	relv = v - seg->v;
+	leg = relh * seg->dirh + relv * seg->dirv;
+	if(leg < 0.0) leg = 0.0;
+	if(leg > seg->length) leg = seg->length;
+	relh -= leg * seg->dirh;
+	relv -= leg * seg->dirv;
+	return relh * relh + relv * relv;
+	}
+
+static float BoxDistanceSquared(float h, float v, const BranchNode* node)
+	{
+	//How far is this point from the node's box, squared? Zero inside it.
+	float dh = 0.0, dv = 0.0;
+	if(h < node->left) dh = node->left - h;
+	else if(h > node->right) dh = h - node->right;
+	if(v < node->top) dv = node->top - v;
+	else if(v > node->bottom) dv = v - node->bottom;
+	return dh * dh + dv * dv;
 	}
 
-static float ValueFromRay(float h, float v, Ray* ray, Tree* tree)
+static int BuildHierarchy(Tree* tree)
 	{
 	/*
-	Calculate the value of the pixel, according to this ray.
-	We first calculate the value according to the tangent from the ray itself.
-	Then we check the ray's branches, in case they happen to be closer to the ray.
+	Turn every ray we grew into a segment, then file the segments away
+	in a hierarchy of boxes. A binary tree with a few segments in each
+	leaf never needs more than twice as many nodes as segments.
+	Returns false if we ran out of memory.
 	*/
-	float out, branchbest;
-	out = TangentRayDistance(h, v, ray);
-	//If we aren't within the "close enough" threshold, see what the branches have.
-	if(out > CLOSE_ENOUGH && ray->ancestors < MAX_PARENTS && ray->children > 0)
+	int ctr, count;
+	const Ray* ray;
+	Segment* seg;
+	tree->segment = (Segment*)malloc(tree->raycount * sizeof(Segment));
+	tree->node = (BranchNode*)malloc(2 * tree->raycount * sizeof(BranchNode));
+	if(!tree->segment || !tree->node) return 0;
+	count = 0;
+	for(ctr = 0; ctr < tree->raycount; ctr++)
 		{
-		branchbest = ValueFromBranches(h, v, ray, tree);
-		if(branchbest < out) out = branchbest;
+		ray = &tree->branch[ctr];
+		seg = &tree->segment[count++];
+		seg->h = ray->h;
+		seg->v = ray->v;
+		//A ray runs from its origin the opposite way from its angle's sine and cosine.
+		seg->dirh = -sin(ray->angle);
+		seg->dirv = -cos(ray->angle);
+		seg->length = ray->length;
 		}
-	return out;
+	tree->nodecount = 1;
+	BuildNode(tree, 0, 0, count);
+	return 1;
 	}
 
-static float ValueFromBranches(float h, float v, Ray* ray, Tree* tree)
+static void BuildNode(Tree* tree, int index, int first, int count)
 	{
-	//For testing purposes, make a single branch and return its value.
-	float out, test;
-	int ctr;
-	Ray branch;
-	out = 1 / 0.000000001;	//as close to 1/0 as the compiler will let me
-	for(ctr = 0; ctr < ray->children; ctr++)
+	/*
+	Box up these segments. If there are too many for one leaf, sort them
+	along the box's longer side by their middles, and give each half to a
+	child node.
+	*/
+	BranchNode* node = &tree->node[index];
+	const Segment* seg;
+	float endh, endv;
+	int ctr, half;
+	node->left = node->top = HUGE_VAL;
+	node->right = node->bottom = -HUGE_VAL;
+	for(ctr = first; ctr < first + count; ctr++)
 		{
-		Ray* leaf;
-		if(ray->leaf[ctr])
-			{
-			leaf = &tree->branch[ray->leaf[ctr]];
-			test = ValueFromRay(h, v, leaf, tree);
-			if(test < out) out = test;
-			}
+		seg = &tree->segment[ctr];
+		endh = seg->h + seg->dirh * seg->length;
+		endv = seg->v + seg->dirv * seg->length;
+		if(seg->h < node->left) node->left = seg->h;
+		if(endh < node->left) node->left = endh;
+		if(seg->h > node->right) node->right = seg->h;
+		if(endh > node->right) node->right = endh;
+		if(seg->v < node->top) node->top = seg->v;
+		if(endv < node->top) node->top = endv;
+		if(seg->v > node->bottom) node->bottom = seg->v;
+		if(endv > node->bottom) node->bottom = endv;
 		}
-	return out;
+	node->left -= BRANCH_BOX_SLOP;
+	node->top -= BRANCH_BOX_SLOP;
+	node->right += BRANCH_BOX_SLOP;
+	node->bottom += BRANCH_BOX_SLOP;
+	if(count <= BRANCH_LEAF_SEGMENTS)
+		{
+		node->first = first;
+		node->count = count;
+		return;
+		}
+	qsort(&tree->segment[first], count, sizeof(Segment),
+			(node->right - node->left > node->bottom - node->top) ? &CompareSegmentH : &CompareSegmentV);
+	half = count / 2;
+	node->first = tree->nodecount;
+	node->count = 0;
+	tree->nodecount += 2;
+	BuildNode(tree, node->first, first, half);
+	BuildNode(tree, node->first + 1, first + half, count - half);
+	}
+
+static int CompareSegmentH(const void* a, const void* b)
+	{
+	//Order segments by the horizontal position of their middles.
+	const Segment* sa = (const Segment*)a;
+	const Segment* sb = (const Segment*)b;
+	float ma = sa->h + sa->dirh * sa->length / 2.0;
+	float mb = sb->h + sb->dirh * sb->length / 2.0;
+	return (ma > mb) - (ma < mb);
 	}
 
-static void MakeBranch(const Ray* ray, int whichbranch, Ray* branch, Tree* tree)
+static int CompareSegmentV(const void* a, const void* b)
+	{
+	//Order segments by the vertical position of their middles.
+	const Segment* sa = (const Segment*)a;
+	const Segment* sb = (const Segment*)b;
+	float ma = sa->v + sa->dirv * sa->length / 2.0;
+	float mb = sb->v + sb->dirv * sb->length / 2.0;
+	return (ma > mb) - (ma < mb);
+	}
+
+static void MakeBranch(const Ray* ray, int whichbranch, Ray* branch, Tree* tree, RandRef rng)
 	{
 	/*
 	For testing purposes, we follow a hard-wired formula:
-	The angle is 90 degrees off. The length is half. 
+	The angle is 90 degrees off. The length is half.
 	*/
 	//Position the origin of this branch at the end of the parent ray.
 	branch->length = ray->length * tree->scalemax;// 2;
@@ -240,7 +453,8 @@ static void MakeBranch(const Ray* ray, int whichbranch, Ray* branch, Tree* tree)
 	//Now pick an angle for it, based on its position within the group.
 	//branch->angle = ray->angle - pi / 2;
 	//branch->angle += (pi / 6) * whichbranch;
-	branch->angle = frand(pi);
+	branch->angle = frand(rng, pi);
 	branch->ancestors = ray->ancestors + 1;
-	if(branch->ancestors < MAX_PARENTS) MakeLeaves(branch, tree);
-	}
\ No newline at end of file
+	//BranchfracInit gives it branches of its own when it gets to it.
+	branch->children = 0;
+	}
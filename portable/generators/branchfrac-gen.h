@@ -28,6 +28,9 @@ but that's off in the future somewhere.
 
 */
 
-void* BranchfracInit(void);
+#include "genutils.h"
+
+void* BranchfracInit(int width, int height, RandRef rng, GenOptionsRef options);
 void BranchfracExit(void* refcon);
-float Branchfrac(float h, float v, void* refcon);
\ No newline at end of file
+float Branchfrac(float h, float v, void* refcon);
+void BranchfracBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
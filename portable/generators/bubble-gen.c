@@ -32,7 +32,21 @@ adding glycerine to a tub of water and blowing in it with a straw.
 #include <stdlib.h>
 #include <math.h>
 
-#define MAX_BUBBLES 32
+//Unless its options say otherwise, a field has up to this many bubbles.
+#define DEFAULT_MAX_BUBBLES 32
+/*
+Each bubble field keeps a square grid of cells over the tile, listing in
+every cell the bubbles - and which of the nine tiles' copies of them -
+that can rise above zero anywhere in it. A field gets BUBBLE_GRID_SIZE
+cells a side. Past BUBBLE_GRID_CROWD bubbles, which are smaller, it gets
+more, in proportion to the square root of the count, up to
+MAX_BUBBLE_GRID_SIZE. A bubble's box comes from a different calculation
+than its values, so we pad it by BUBBLE_GRID_SLOP of its size to be sure.
+*/
+#define BUBBLE_GRID_SIZE 16
+#define BUBBLE_GRID_CROWD 128
+#define MAX_BUBBLE_GRID_SIZE 512
+#define BUBBLE_GRID_SLOP 1e-3
 
 typedef struct BubbleData
 	{
@@ -40,31 +54,50 @@ typedef struct BubbleData
 	float squish;			//we multiply the h by this and divide the v by it
 	float angle;			//how far should we rotate this bubble's coordinate system?
 	float h, v;				//coordinates for the origin of the bubble
-	float boundL, boundT, boundR, boundB;	//approximate bounding box for the circle
+	float boundL, boundT, boundR, boundB;	//box around everywhere the bubble is above zero
 	}
 BubbleData;
 
+//One bubble in a grid cell, by its place in the field, and which tile's copy of it reaches the cell.
+typedef struct BubbleGridEntry
+	{
+	int bub;
+	signed char hshift, vshift;
+	}
+BubbleGridEntry;
+
 typedef struct BubbleGlobals
 	{
 	int count;
 	float scalemin, scalemax;
 	float squishmin, squishmax;
 	float anglemin, anglemax;
-	BubbleData tip[MAX_BUBBLES];
+	BubbleData* tip;
+	//The grid is gridsize cells a side. The entries for cell n are
+	//cellentry[cellstart[n]] up to cellentry[cellstart[n + 1]].
+	int gridsize;
+	int* cellstart;
+	BubbleGridEntry* cellentry;
 	}
 BubbleGlobals;
 typedef BubbleGlobals* BubbleRef;
 
 static float GetAllWrappedBubblesValue(float h, float v, BubbleRef it);
 static float GetAllBubblesValue(float h, float v, BubbleRef it);
+static float GetGridBubblesValue(float h, float v, BubbleRef it);
 static float GetOneBubbleValue(float h, float v, BubbleData* bub);
 static float GetSpunBubbleValue(float h, float v, BubbleData* bub);
 static float GetSquishedBubbleValue(float h, float v, BubbleData* bub);
 static float GetRawBubbleValue(float h, float v, BubbleData* bub);
-static void InitBubble(BubbleData* bub, BubbleRef globals);
+static void InitBubble(BubbleData* bub, BubbleRef globals, RandRef rng);
 static void CalcBubbleBoundingBox(BubbleData* bub);
+static void BuildBubbleGrid(BubbleRef it);
+static int BubbleGridCell(float pos, int gridsize);
+static void GetGridBubblesBounds(float left, float top, float right, float bottom, BubbleRef it, float* lo, float* hi);
+static void GetAllBubblesBounds(float left, float top, float right, float bottom, BubbleRef it, float* lo, float* hi);
+static void GetOneBubbleBounds(float left, float top, float right, float bottom, BubbleData* bub, float* lo, float* hi);
 
-void* BubbleInit(void)
+void* BubbleInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	BubbleRef out = (BubbleRef)malloc(sizeof(BubbleGlobals));
 	if(out)
@@ -74,12 +107,23 @@ void* BubbleInit(void)
 		Pick a random number of bubbles. We have a compiled-in maximum
 		number of bubbles - obviously we won't use more than that. I pseudo-
 		arbitrarily chose max / 2 as the minimum, simply to see how it looked.
-		Some other number less than MAX_BUBBLES could just as easily be chosen.
+		Some other number less than DEFAULT_MAX_BUBBLES could just as easily be chosen.
 		The number should be small enough to be distinct from max, but large
 		enough that many of the bubbles intersect each other - that's where
-		the look comes from.
+		the look comes from. If somebody asked for a particular number of
+		bubbles, they get that instead.
 		*/
-		out->count = irandge(MAX_BUBBLES / 4, MAX_BUBBLES);
+		out->count = irandge(rng, DEFAULT_MAX_BUBBLES / 4, DEFAULT_MAX_BUBBLES);
+		if(options->bubbles > 0)
+			{
+			out->count = (options->bubbles < MAX_BUBBLE_COUNT) ? options->bubbles : MAX_BUBBLE_COUNT;
+			}
+		out->tip = (BubbleData*)malloc(out->count * sizeof(BubbleData));
+		if(!out->tip)
+			{
+			free(out);
+			return NULL;
+			}
 		/*
 		Pick a random minimum and maximum size. Based on empirical testing I've
 		decided that 0.2 is the largest reasonable scale. Any bigger than that
@@ -87,8 +131,18 @@ void* BubbleInit(void)
 		will fall within the range we pick here. It doesn't matter if the "min"
 		and "max" are actually reversed; frandge will take care of it.
 		*/
-		out->scalemin = frand(0.2);
-		out->scalemax = frand(0.2);
+		out->scalemin = frand(rng, 0.2);
+		out->scalemax = frand(rng, 0.2);
+		/*
+		A crowd of bubbles that size would just be one big lump. So when there
+		are more than usual, we shrink them all, keeping the share of the tile
+		they cover about the same. That makes a foam.
+		*/
+		if(out->count > DEFAULT_MAX_BUBBLES)
+			{
+			out->scalemin *= (float)DEFAULT_MAX_BUBBLES / out->count;
+			out->scalemax *= (float)DEFAULT_MAX_BUBBLES / out->count;
+			}
 		/*
 		Pick random squish sizes. A squish of 1 means a perfect circle. Under 1
 		means it becomes taller and narrower. Over 1 means it becomes wider and
@@ -99,16 +153,16 @@ void* BubbleInit(void)
 		Variety is a good thing, but too much of it is chaos. This is a way of
 		"directing randomness" to get interesting variety.
 		*/
-		if(maybe())
+		if(maybe(rng))
 			{
-			out->squishmin = frandge(1.0, 4.0);
-			if(maybe()) out->squishmin = 1.0 / out->squishmin;
+			out->squishmin = frandge(rng, 1.0, 4.0);
+			if(maybe(rng)) out->squishmin = 1.0 / out->squishmin;
 			}
 		else out->squishmin = 1.0;
-		if(maybe())
+		if(maybe(rng))
 			{
-			out->squishmax = frandge(1.0, 4.0);
-			if(maybe()) out->squishmax = 1.0 / out->squishmax;
+			out->squishmax = frandge(rng, 1.0, 4.0);
+			if(maybe(rng)) out->squishmax = 1.0 / out->squishmax;
 			}
 		else out->squishmax = 1.0;
 		/*
@@ -120,22 +174,30 @@ void* BubbleInit(void)
 		retain some consistency.
 		Circular bubbles don't exhibit much appearance change when rotated.
 		*/
-		out->anglemin = frand(pi / 2.0);
-		out->anglemax = frand(pi / 2.0);
+		out->anglemin = frand(rng, pi / 2.0);
+		out->anglemax = frand(rng, pi / 2.0);
 		/*
 		Now go through and create all of the bubbles using these data.
 		*/
 		for(ctr = 0; ctr < out->count; ctr++)
 			{
-			InitBubble(&out->tip[ctr], out);
+			InitBubble(&out->tip[ctr], out, rng);
 			}
+		BuildBubbleGrid(out);
 		}
 	return out;
 	}
 
 void BubbleExit(void* refcon)
 	{
-	if(refcon) free(refcon);
+	BubbleRef it = (BubbleRef)refcon;
+	if(it)
+		{
+		free(it->cellstart);
+		free(it->cellentry);
+		free(it->tip);
+		free(it);
+		}
 	}
 
 float Bubble(float h, float v, void* refcon)
@@ -144,11 +206,30 @@ float Bubble(float h, float v, void* refcon)
 	Get the biggest value we can find out of all these bubbles.
 	We will eventually do more interesting things with bubble clumps,
 	points, and antibubbles, but this is just a beginning.
+	Inside the tile, the grid tells us which bubbles to look at. Outside
+	it, or if we couldn't build a grid, we look at all of them.
 	*/
 	BubbleRef it = (BubbleRef)refcon;
+	if(!it) return 0;
+	if(it->cellstart && h >= 0.0 && h <= 1.0 && v >= 0.0 && v <= 1.0)
+		{
+		return GetGridBubblesValue(h, v, it);
+		}
 	return GetAllWrappedBubblesValue(h, v, it);
 	}
 
+void BubbleSpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	//Bubble for a whole row of points. The grid does all the work, so there's nothing to share.
+	int ctr;
+	if(!refcon)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0;
+		return;
+		}
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = Bubble(h[ctr], v, refcon);
+	}
+
 static float GetAllWrappedBubblesValue(float h, float v, BubbleRef it)
 	{
 	/*
@@ -199,6 +280,38 @@ static float GetAllBubblesValue(float h, float v, BubbleRef it)
 	return best;
 	}
 
+static float GetGridBubblesValue(float h, float v, BubbleRef it)
+	{
+	/*
+	GetAllWrappedBubblesValue, looking only at the copies of bubbles which
+	the grid says can reach this point's cell. Inside the tile, the damping
+	factors are never negative, so damping each value and then taking the
+	best gives exactly what taking the best and then damping it does. And
+	the best is the same whichever order we find the values in.
+	*/
+	BubbleGridEntry* entry;
+	BubbleGridEntry* last;
+	float value, current, best = 0;
+	double damped;
+	int cell;
+	cell = BubbleGridCell(v, it->gridsize) * it->gridsize + BubbleGridCell(h, it->gridsize);
+	entry = &it->cellentry[it->cellstart[cell]];
+	last = &it->cellentry[it->cellstart[cell + 1]];
+	for(; entry < last; entry++)
+		{
+		value = GetOneBubbleValue(h + (double)entry->hshift, v + (double)entry->vshift, &it->tip[entry->bub]);
+		//Damp the neighbouring tiles, in the same order GetAllWrappedBubblesValue does.
+		damped = value;
+		if(entry->hshift > 0) damped *= (1.0 - h);
+		if(entry->hshift < 0) damped *= (h);
+		if(entry->vshift > 0) damped *= (1.0 - v);
+		if(entry->vshift < 0) damped *= (v);
+		current = damped;
+		if(current > best) best = current;
+		}
+	return best;
+	}
+
 static float GetOneBubbleValue(float h, float v, BubbleData* bub)
 	{
 	return GetSpunBubbleValue(h, v, bub);
@@ -216,18 +329,18 @@ static float GetSpunBubbleValue(float h, float v, BubbleData* bub)
 	h -= bub->h;
 	v -= bub->v;
 	//Calculate the distance from the new origin to this point.
-	hypotenuse = hypotf(h, v);
+	hypotenuse = genhypotf(h, v);
 	/*
 	Draw a line from the origin to this point. Get the angle this line
 	forms with the horizontal. Then add the amount this bubble is rotated.
 	*/
-	hypangle = atan(v / h) + bub->angle;
+	hypangle = genatan(v / h) + bub->angle;
 	//The next line is magic. I don't quite understand it.
 	if(h < 0) hypangle += pi;
 	//We have the angle and the hypotenuse. Take the sine and cosine to get
 	//the new horizontal and vertical distances in the new coordinate system.
-	transverse = (cos(hypangle) * hypotenuse) + bub->h;
-	distance = (sin(hypangle) * hypotenuse) + bub->h;
+	transverse = (gencos(hypangle) * hypotenuse) + bub->h;
+	distance = (gensin(hypangle) * hypotenuse) + bub->h;
 	//That's it. Pass in the transverse and distance values as the new h and v.
 	return GetSquishedBubbleValue(transverse, distance, bub);
 	}
@@ -253,11 +366,11 @@ static float GetRawBubbleValue(float h, float v, BubbleData* bub)
 	a number between zero and 1.
 	*/
 	float hypotenuse;
-	hypotenuse = hypotf(h - bub->h, v - bub->v);
+	hypotenuse = genhypotf(h - bub->h, v - bub->v);
 	return 1.0 - hypotenuse * hypotenuse / bub->scale;
 	}
 
-static void InitBubble(BubbleData* bub, BubbleRef globals)
+static void InitBubble(BubbleData* bub, BubbleRef globals, RandRef rng)
 	{
 	/*
 	Come up with some reasonable values for this bubble.
@@ -269,24 +382,24 @@ static void InitBubble(BubbleData* bub, BubbleRef globals)
 	There is no proximity limit yet.
 	Bubbles can be positioned anywhere in the field.
 	*/
-	bub->h = frand(1.0);
-	bub->v = frand(1.0);
+	bub->h = frand(rng, 1.0);
+	bub->v = frand(rng, 1.0);
 	/*
 	The bubble's scale must be in line with the scale limits for this field.
 	This can force a bubble-scene to be uniform or allow it to be diverse.
 	*/
-	bub->scale = frandge(globals->scalemin, globals->scalemax);
+	bub->scale = frandge(rng, globals->scalemin, globals->scalemax);
 	/*
 	The bubble's squish factor has to fit the bubblefield, too. This is what
 	determines its height-to-width aspect ratio.
 	*/
-	bub->squish = frandge(globals->squishmin, globals->squishmax);
+	bub->squish = frandge(rng, globals->squishmin, globals->squishmax);
 	/*
 	Each bubble needs an angle. This determines the rotation of its coordinate
 	system around the bubble's origin, relative to the bubblefield. It's what
 	makes squished bubbles point in different directions.
 	*/
-	bub->angle = frandge(globals->anglemin, globals->anglemax);
+	bub->angle = frandge(rng, globals->anglemin, globals->anglemax);
 	/*
 	We've set up all the bubble's information. Now give it a bounding box so we can
 	do quicker hit tests.
@@ -300,10 +413,256 @@ static void CalcBubbleBoundingBox(BubbleData* bub)
 	Calculate the greatest and least coordinate values this bubble is able to hit in
 	both horizontal and vertical axes. This is useful for hit-testing; we can quickly
 	exclude circles that a given point doesn't hit.
+	The bubble is above zero where the spun and squished distance is less
+	than the square root of its scale. The spinner turns the point around
+	the origin and moves it by the difference between the origin's
+	coordinates; the squisher stretches one axis and shrinks the other.
+	So the bubble is an ellipse, turned back by the angle, and centred off
+	to one side of the origin. A bubble with no size or no squish could be
+	anywhere, so it gets a box bigger than all nine tiles.
+	*/
+	double radius, axisH, axisV, cosangle, sinangle, offset, centreH, centreV, extentH, extentV;
+	if(!(bub->scale > 0) || bub->squish == 0)
+		{
+		bub->boundL = bub->boundT = -2.0;
+		bub->boundR = bub->boundB = 3.0;
+		return;
+		}
+	radius = sqrt(bub->scale);
+	axisH = radius / fabs(bub->squish);
+	axisV = radius * fabs(bub->squish);
+	cosangle = cos(bub->angle);
+	sinangle = sin(bub->angle);
+	offset = bub->h - bub->v;
+	centreH = bub->h - offset * sinangle;
+	centreV = bub->v - offset * cosangle;
+	extentH = hypot(axisH * cosangle, axisV * sinangle);
+	extentV = hypot(axisH * sinangle, axisV * cosangle);
+	extentH += BUBBLE_GRID_SLOP * (1.0 + extentH);
+	extentV += BUBBLE_GRID_SLOP * (1.0 + extentV);
+	bub->boundL = centreH - extentH;
+	bub->boundR = centreH + extentH;
+	bub->boundT = centreV - extentV;
+	bub->boundB = centreV + extentV;
+	}
+
+static int BubbleGridCell(float pos, int gridsize)
+	{
+	//Which row or column of the grid holds this position? Positions must be within the tile.
+	int cell = pos * gridsize;
+	return (cell < gridsize) ? cell : gridsize - 1;
+	}
+
+static void BuildBubbleGrid(BubbleRef it)
+	{
+	/*
+	Sort the bubbles into the grid. Bubble values for a point in the tile
+	come from nine copies of the bubble field, shifted a tile over in each
+	direction. So for each bubble and each shift, we move the bubble's box
+	back by the shift, clip it to the tile, and list that copy of the bubble
+	in every cell the box touches. The first pass counts the entries in
+	each cell, and the second fills them in. If we run out of memory, the
+	field just goes without a grid.
+	*/
+	int* cursor = NULL;
+	int pass, bub, hshift, vshift, row, col, cell, cells, rowlo, rowhi, collo, colhi;
+	float left, top, right, bottom;
+	it->gridsize = BUBBLE_GRID_SIZE;
+	if(it->count > BUBBLE_GRID_CROWD)
+		{
+		it->gridsize = BUBBLE_GRID_SIZE * sqrt((double)it->count / BUBBLE_GRID_CROWD);
+		if(it->gridsize > MAX_BUBBLE_GRID_SIZE) it->gridsize = MAX_BUBBLE_GRID_SIZE;
+		}
+	cells = it->gridsize * it->gridsize;
+	it->cellentry = NULL;
+	it->cellstart = (int*)calloc(cells + 1, sizeof(int));
+	if(!it->cellstart) return;
+	for(pass = 0; pass < 2; pass++)
+		{
+		for(bub = 0; bub < it->count; bub++)
+			{
+			for(vshift = -1; vshift <= 1; vshift++)
+				{
+				for(hshift = -1; hshift <= 1; hshift++)
+					{
+					left = it->tip[bub].boundL - hshift;
+					right = it->tip[bub].boundR - hshift;
+					top = it->tip[bub].boundT - vshift;
+					bottom = it->tip[bub].boundB - vshift;
+					if(right < 0.0 || left > 1.0 || bottom < 0.0 || top > 1.0) continue;
+					collo = BubbleGridCell((left > 0.0) ? left : 0.0, it->gridsize);
+					colhi = BubbleGridCell((right < 1.0) ? right : 1.0, it->gridsize);
+					rowlo = BubbleGridCell((top > 0.0) ? top : 0.0, it->gridsize);
+					rowhi = BubbleGridCell((bottom < 1.0) ? bottom : 1.0, it->gridsize);
+					for(row = rowlo; row <= rowhi; row++)
+						{
+						for(col = collo; col <= colhi; col++)
+							{
+							cell = row * it->gridsize + col;
+							if(pass == 0) it->cellstart[cell + 1]++;
+							else
+								{
+								BubbleGridEntry* entry = &it->cellentry[cursor[cell]++];
+								entry->bub = bub;
+								entry->hshift = hshift;
+								entry->vshift = vshift;
+								}
+							}
+						}
+					}
+				}
+			}
+		if(pass == 0)
+			{
+			//Turn the counts into starting places, and make room for the entries.
+			for(cell = 0; cell < cells; cell++) it->cellstart[cell + 1] += it->cellstart[cell];
+			it->cellentry = (BubbleGridEntry*)malloc((it->cellstart[cells] + 1) * sizeof(BubbleGridEntry));
+			cursor = (int*)malloc(cells * sizeof(int));
+			if(!it->cellentry || !cursor)
+				{
+				free(it->cellentry);
+				free(it->cellstart);
+				free(cursor);
+				it->cellentry = NULL;
+				it->cellstart = NULL;
+				return;
+				}
+			for(cell = 0; cell < cells; cell++) cursor[cell] = it->cellstart[cell];
+			}
+		}
+	free(cursor);
+	}
+
+void BubbleBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	The value is the best of nine copies of the bubble field: the main tile
+	and its neighbours, damped by factors between 0 and 1. So the main tile
+	gives us a floor, and the best any copy could possibly do is a ceiling.
 	*/
-	bub->boundL = bub->h - (bub->scale);
-	bub->boundR = bub->h + (bub->scale);
-	bub->boundT = bub->v - (bub->scale);
-	bub->boundB = bub->v + (bub->scale);
+	BubbleRef it = (BubbleRef)refcon;
+	float copylo, copyhi;
+	int hshift, vshift;
+	*lo = 0.0;
+	*hi = 1.0;
+	if(!it) return;
+	//Outside the tile, the damping factors can go negative; don't try to be clever there.
+	if(left < 0.0 || top < 0.0 || right > 1.0 || bottom > 1.0) return;
+	if(it->cellstart)
+		{
+		GetGridBubblesBounds(left, top, right, bottom, it, lo, hi);
+		return;
+		}
+	GetAllBubblesBounds(left, top, right, bottom, it, lo, hi);
+	for(hshift = -1; hshift <= 1; hshift++)
+		{
+		for(vshift = -1; vshift <= 1; vshift++)
+			{
+			if(!hshift && !vshift) continue;
+			GetAllBubblesBounds(left + hshift, top + vshift, right + hshift, bottom + vshift, it, &copylo, &copyhi);
+			if(copyhi > *hi) *hi = copyhi;
+			}
+		}
 	}
-
\ No newline at end of file
+
+static void GetGridBubblesBounds(float left, float top, float right, float bottom, BubbleRef it, float* lo, float* hi)
+	{
+	/*
+	BubbleBounds, looking only at the copies of bubbles listed in the grid
+	cells the rectangle covers. A copy which isn't listed there is below
+	zero all over the rectangle, so it could never be the best; leaving it
+	out can only make the bounds tighter. As in BubbleBounds, only the main
+	tile's copies raise the floor. A copy listed in several cells gets
+	looked at several times, which doesn't change the answer.
+	*/
+	BubbleGridEntry* entry;
+	BubbleGridEntry* last;
+	float bubblelo, bubblehi;
+	int row, col, rowlo, rowhi, collo, colhi, cell;
+	*lo = *hi = 0;
+	collo = BubbleGridCell(left, it->gridsize);
+	colhi = BubbleGridCell(right, it->gridsize);
+	rowlo = BubbleGridCell(top, it->gridsize);
+	rowhi = BubbleGridCell(bottom, it->gridsize);
+	for(row = rowlo; row <= rowhi; row++)
+		{
+		for(col = collo; col <= colhi; col++)
+			{
+			cell = row * it->gridsize + col;
+			entry = &it->cellentry[it->cellstart[cell]];
+			last = &it->cellentry[it->cellstart[cell + 1]];
+			for(; entry < last; entry++)
+				{
+				GetOneBubbleBounds
+						(
+						left + entry->hshift, top + entry->vshift,
+						right + entry->hshift, bottom + entry->vshift,
+						&it->tip[entry->bub], &bubblelo, &bubblehi
+						);
+				if(!entry->hshift && !entry->vshift && bubblelo > *lo) *lo = bubblelo;
+				if(bubblehi > *hi) *hi = bubblehi;
+				}
+			}
+		}
+	}
+
+static void GetAllBubblesBounds(float left, float top, float right, float bottom, BubbleRef it, float* lo, float* hi)
+	{
+	/*
+	The best bubble wins, and nothing scores below zero, so the bounds are
+	the best of each bubble's bounds, or zero.
+	*/
+	float bubblelo, bubblehi;
+	int ctr;
+	*lo = *hi = 0;
+	for(ctr = 0; ctr < it->count; ctr++)
+		{
+		GetOneBubbleBounds(left, top, right, bottom, &it->tip[ctr], &bubblelo, &bubblehi);
+		if(bubblelo > *lo) *lo = bubblelo;
+		if(bubblehi > *hi) *hi = bubblehi;
+		}
+	}
+
+static void GetOneBubbleBounds(float left, float top, float right, float bottom, BubbleData* bub, float* lo, float* hi)
+	{
+	/*
+	Spinning and squishing add up to a linear map of the point's offset
+	from the bubble's origin: rotate by the angle, shift v by the difference
+	between the origin's coordinates (that's what the spinner does), then
+	stretch h by the squish and shrink v by it. The value falls off with
+	the square of the mapped distance. A linear map takes the corners of
+	the rectangle to the extremes on each axis, so we box in the mapped
+	rectangle and see how near and far it gets from the centre.
+	*/
+	float cosangle, sinangle, boxL, boxT, boxR, boxB, nearest, farthest;
+	float cornerH[4], cornerV[4];
+	int ctr;
+	if(bub->scale <= 0 || bub->squish == 0)
+		{
+		*lo = 0.0;
+		*hi = 1.0;
+		return;
+		}
+	cosangle = cos(bub->angle);
+	sinangle = sin(bub->angle);
+	for(ctr = 0; ctr < 4; ctr++)
+		{
+		float h = ((ctr & 1) ? right : left) - bub->h;
+		float v = ((ctr & 2) ? bottom : top) - bub->v;
+		cornerH[ctr] = (cosangle * h - sinangle * v) * bub->squish;
+		cornerV[ctr] = (sinangle * h + cosangle * v + bub->h - bub->v) / bub->squish;
+		}
+	boxL = boxR = cornerH[0];
+	boxT = boxB = cornerV[0];
+	for(ctr = 1; ctr < 4; ctr++)
+		{
+		if(cornerH[ctr] < boxL) boxL = cornerH[ctr];
+		if(cornerH[ctr] > boxR) boxR = cornerH[ctr];
+		if(cornerV[ctr] < boxT) boxT = cornerV[ctr];
+		if(cornerV[ctr] > boxB) boxB = cornerV[ctr];
+		}
+	RectDistanceBounds(boxL, boxT, boxR, boxB, 0, 0, &nearest, &farthest);
+	*hi = 1.0 - nearest * nearest / bub->scale;
+	*lo = 1.0 - farthest * farthest / bub->scale;
+	}
+
@@ -25,6 +25,17 @@ it is going to work. I'll add detail later when I see its output... :-)
 
 */
 
-void* BubbleInit(void);
+#include "genutils.h"
+
+void* BubbleInit(int width, int height, RandRef rng, GenOptionsRef options);
 void BubbleExit(void* refcon);
-float Bubble(float h, float v, void* refcon);
\ No newline at end of file
+float Bubble(float h, float v, void* refcon);
+void BubbleSpan(const float* h, float v, int count, void* refcon, float* out);
+void BubbleBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
+/*
+A field normally has a random number of bubbles, up to 32. Its options'
+bubble count, if not zero, gives it that many instead, up to
+MAX_BUBBLE_COUNT. Crowds of more than 32 are made of smaller bubbles, and
+look like foam.
+*/
+#define MAX_BUBBLE_COUNT 100000
@@ -52,12 +52,19 @@ typedef struct CoswaveGlobals
 	float wavescale;
 	float squish, sqangle, distortion;
 	int packmethod;
+	PackedCosProc packer;
 	int accelmethod;
 	float accel;
 	}
 CoswaveGlobals;
 
-void* CoswaveInit(void)
+//The most points CoswaveSpan works out distances for at once.
+#define COSWAVE_SPAN_PIECE 64
+
+static float CoswaveDistance(float h, float v, CoswaveGlobals* glb);
+static void CoswaveFastDistances(const float* h, float v, int count, CoswaveGlobals* glb, float* out);
+
+void* CoswaveInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	We don't actually care about the pixel size of this texture, though I suppose
@@ -69,9 +76,10 @@ void* CoswaveInit(void)
 	out = (CoswaveGlobals*)malloc(sizeof(CoswaveGlobals));
 	if(out)
 		{
-		out->originH = frand(1);
-		out->originV = frand(1);
-		out->packmethod = RandomPackMethod();
+		out->originH = frand(rng, 1);
+		out->originV = frand(rng, 1);
+		out->packmethod = RandomPackMethod(rng);
+		out->packer = PackedCosKernel(out->packmethod);
 		/*
 		I once attempted to make the coswave shift its scale over time, much like
 		the spinflake generator does with its twist. I wasn't particularly succesful.
@@ -84,10 +92,10 @@ void* CoswaveInit(void)
 		begins to happen. Odd eddies show up, turbulences become visible, and a bit of static
 		shines through here and there. It's quite beautiful in an abstract sort of way.
 		*/
-		if(maybe() && maybe() && maybe() && maybe() && maybe() && maybe())
+		if(maybe(rng) && maybe(rng) && maybe(rng) && maybe(rng) && maybe(rng) && maybe(rng))
 			{
 			out->accelmethod = accelLinear;
-			out->accel = frand(2.0) + 1.0;
+			out->accel = frand(rng, 2.0) + 1.0;
 			}
 		else out->accelmethod = accelNone;
 		/*
@@ -96,7 +104,7 @@ void* CoswaveInit(void)
 		wavescale, then double it with the scaleToFit method to put it in range
 		with the other packmethods.
 		*/
-		out->wavescale = frand(25) + 1.0;
+		out->wavescale = frand(rng, 25) + 1.0;
 		if(out->packmethod == scaleToFit) out->wavescale *= 2;
 		/*
 		We don't like waves that are always perfect circles; they're too
@@ -108,10 +116,10 @@ void* CoswaveInit(void)
 		strength of the squish is determined by the sine of the difference between
 		the angle between the current point and the origin, and the sqangle.
 		*/
-		out->squish = frand(2.0) + 0.5;
-		if(maybe()) out->squish = -out->squish;
-		out->sqangle = frand(pi);
-		out->distortion = frand(1.5) + 0.5;
+		out->squish = frand(rng, 2.0) + 0.5;
+		if(maybe(rng)) out->squish = -out->squish;
+		out->sqangle = frand(rng, pi);
+		out->distortion = frand(rng, 1.5) + 0.5;
 		}
 	return out;
 	}
@@ -133,17 +141,9 @@ float Coswave(float h, float v, void* refcon)
 		Perform a cosine on the point.
 		Then move the results of the cosine into the appropriate range.
 		*/
-		float hypotenuse, hypangle;
-		float rawcos, compwavescale;
-		//Rotate the axes of this shape.
-		h -= glb->originH;
-		v -= glb->originV;
-		hypangle = atan((v / h) * glb->distortion) + glb->sqangle;
-		hypotenuse = hypot(h, v);
-		h = (cos(hypangle) * hypotenuse);
-		v = (sin(hypangle) * hypotenuse);
-		//Calculate the squished distance from the origin to the desired point.
-		hypotenuse = hypot(h * glb->squish, v / glb->squish);
+		float hypotenuse;
+		float compwavescale;
+		hypotenuse = CoswaveDistance(h, v, glb);
 		//Scale the wavescale according to our accelerator function.
 		switch(glb->accelmethod)
 			{
@@ -151,7 +151,7 @@ float Coswave(float h, float v, void* refcon)
 				compwavescale = glb->wavescale;
 				break;
 			case accelLinear:
-				compwavescale = powf(glb->wavescale, hypotenuse * glb->accel);
+				compwavescale = genpowf(glb->wavescale, hypotenuse * glb->accel);
 				break;
 			}
 		//Now map our cosine function along that distance.
@@ -159,4 +159,133 @@ float Coswave(float h, float v, void* refcon)
 		}
 	return out;
 	}
-
\ No newline at end of file
+
+void CoswaveSpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	/*
+	Coswave for a whole row of points. The accelerator is the same all along
+	the row, so we pick the loop for it once, instead of at every point.
+	We work out the distances a piece of the row at a time first; with fast
+	math, that runs the trig through the array kernels. Then the layer's
+	packed cosine kernel does the whole piece. With the accelerator, each
+	point has its own scale, so we fold it into the distance and pack at
+	a scale of 1, which multiplies out to exactly the same arguments.
+	*/
+	CoswaveGlobals* glb = (CoswaveGlobals*)refcon;
+	float hypotenuse[COSWAVE_SPAN_PIECE];
+	int ctr, piece;
+	if(!glb)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0.0;
+		return;
+		}
+	if(glb->accelmethod != accelNone && glb->accelmethod != accelLinear)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = Coswave(h[ctr], v, refcon);
+		return;
+		}
+	while(count > 0)
+		{
+		piece = (count < COSWAVE_SPAN_PIECE) ? count : COSWAVE_SPAN_PIECE;
+		if(UsingFastMath()) CoswaveFastDistances(h, v, piece, glb, hypotenuse);
+		else for(ctr = 0; ctr < piece; ctr++) hypotenuse[ctr] = CoswaveDistance(h[ctr], v, glb);
+		if(glb->accelmethod == accelNone) glb->packer(hypotenuse, glb->wavescale, piece, out);
+		else
+			{
+			for(ctr = 0; ctr < piece; ctr++)
+				hypotenuse[ctr] *= genpowf(glb->wavescale, hypotenuse[ctr] * glb->accel);
+			glb->packer(hypotenuse, 1.0, piece, out);
+			}
+		h += piece;
+		out += piece;
+		count -= piece;
+		}
+	}
+
+static float CoswaveDistance(float h, float v, CoswaveGlobals* glb)
+	{
+	//The squished distance from the origin to this point, after twisting the axes.
+	float hypotenuse, hypangle;
+	//Rotate the axes of this shape.
+	h -= glb->originH;
+	v -= glb->originV;
+	hypangle = genatan((v / h) * glb->distortion) + glb->sqangle;
+	hypotenuse = genhypot(h, v);
+	h = (gencos(hypangle) * hypotenuse);
+	v = (gensin(hypangle) * hypotenuse);
+	//Calculate the squished distance from the origin to the desired point.
+	return genhypot(h * glb->squish, v / glb->squish);
+	}
+
+static void CoswaveFastDistances(const float* h, float v, int count, CoswaveGlobals* glb, float* out)
+	{
+	/*
+	CoswaveDistance for up to COSWAVE_SPAN_PIECE points along a row, with
+	fast math. It goes a step at a time, so the angles go through the array
+	kernels together. Every step rounds just as CoswaveDistance does, so the
+	answers are the same ones it gives.
+	*/
+	float dh[COSWAVE_SPAN_PIECE], angle[COSWAVE_SPAN_PIECE];
+	float cosangle[COSWAVE_SPAN_PIECE], sinangle[COSWAVE_SPAN_PIECE];
+	float dv, hypotenuse;
+	int ctr;
+	dv = v - glb->originV;
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		dh[ctr] = h[ctr] - glb->originH;
+		angle[ctr] = (dv / dh[ctr]) * glb->distortion;
+		}
+	FastAtanArray(angle, count, angle);
+	for(ctr = 0; ctr < count; ctr++) angle[ctr] += glb->sqangle;
+	FastCosArray(angle, count, cosangle);
+	FastSinArray(angle, count, sinangle);
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		hypotenuse = FastHypot(dh[ctr], dv);
+		out[ctr] = FastHypot
+				(
+				(cosangle[ctr] * hypotenuse) * glb->squish,
+				(sinangle[ctr] * hypotenuse) / glb->squish
+				);
+		}
+	}
+
+void CoswaveBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	Every point on the wave depends only on its squished distance from the
+	origin. Twisting the axes doesn't change the distance, and squishing
+	can stretch or shrink it by at most the squish factor. So we find the
+	nearest and farthest the rectangle gets to the origin, allow for the
+	squish, and see what the wave does over that stretch of distances.
+	*/
+	CoswaveGlobals* glb = (CoswaveGlobals*)refcon;
+	float nearest, farthest, squish;
+	*lo = 0.0;
+	*hi = 1.0;
+	if(!glb) return;
+	RectDistanceBounds(left, top, right, bottom, glb->originH, glb->originV, &nearest, &farthest);
+	squish = fabs(glb->squish);
+	if(squish < 1.0) squish = 1.0 / squish;
+	nearest /= squish;
+	farthest *= squish;
+	switch(glb->accelmethod)
+		{
+		case accelNone:
+			PackedCosBounds(nearest, farthest, glb->wavescale, glb->packmethod, lo, hi);
+			break;
+		case accelLinear:
+			//The wavescale grows with distance, so the cosine's argument still only goes up.
+			PackedCosBounds
+					(
+					nearest * pow(glb->wavescale, nearest * glb->accel),
+					farthest * pow(glb->wavescale, farthest * glb->accel),
+					1.0,
+					glb->packmethod,
+					lo,
+					hi
+					);
+			break;
+		}
+	}
+
@@ -28,6 +28,10 @@ neat turbulent lumpy patterns. Very smooth.
 
 */
 
-void* CoswaveInit(void);
+#include "genutils.h"
+
+void* CoswaveInit(int width, int height, RandRef rng, GenOptionsRef options);
 void CoswaveExit(void* refcon);
-float Coswave(float h, float v, void* refcon);
\ No newline at end of file
+float Coswave(float h, float v, void* refcon);
+void CoswaveSpan(const float* h, float v, int count, void* refcon, float* out);
+void CoswaveBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
\ No newline at end of file
@@ -58,10 +58,12 @@ typedef struct WaveRec
 	{
 	float scale;
 	int packmethod;
+	PackedCosProc packer;
 	int accelmethod;
 	float accelscale;
 	float accelamp;
 	int accelpack;
+	PackedCosProc accelpacker;
 	}
 WaveRec;
 
@@ -74,6 +76,7 @@ typedef struct WavePacketRec
 	{
 	float originH, originV;
 	float angle;
+	double sinangle, cosangle;	//for turning points straight into the packet's frame
 	WaveRec wave;
 	}
 WavePacketRec;
@@ -85,6 +88,14 @@ wavepackets and a description of the way to
 interfere them with each other.
 */
 #define MAX_WAVE_PACKETS 3
+//The most points FlatwaveSpan runs each packet over at once.
+#define FLATWAVE_SPAN_PIECE 64
+/*
+Points along a row count as evenly spaced if none is further than this,
+in proportion to their size, from where even spacing would put it. That
+is a few times the rounding of a single precision position.
+*/
+#define FLATWAVE_SPACING_SLOP 4e-7
 typedef struct FlatwaveRec
 	{
 	int packets;
@@ -93,12 +104,28 @@ typedef struct FlatwaveRec
 	}
 FlatwaveRec;
 
-void InitWavePacket(WavePacketRec* it);
-void InitWave(WaveRec* it);
+void InitWavePacket(WavePacketRec* it, RandRef rng);
+void InitWave(WaveRec* it, RandRef rng);
 float CalcWavePacket(float h, float v, WavePacketRec* it);
 float CalcWave(float distance, float transverse, WaveRec* it);
+static void WavePacketLegs(float h, float v, WavePacketRec* it, float* distance, float* transverse);
+static void CalcWavePacketRow(const float* h, float v, int count, WavePacketRec* it, float* out);
+static int EvenlySpaced(const float* h, int count, float* step);
+static void SteppedWavePacketRow(float h, float step, float v, int count, WavePacketRec* it, float* out);
+static void WavePacketBounds
+		(
+		float left, float top, float right, float bottom,
+		WavePacketRec* it,
+		float* lo, float* hi
+		);
+static void LinearBounds
+		(
+		float left, float top, float right, float bottom,
+		float hfactor, float vfactor,
+		float* lo, float* hi
+		);
 
-void* FlatwaveInit(void)
+void* FlatwaveInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	All of the information we use to create an image lives in a FlatwaveRec.
@@ -109,38 +136,41 @@ void* FlatwaveInit(void)
 		{
 		int ctr;
 		//Pick a random number of packets, from 1 through MAX_WAVE_PACKETS.
-		out->packets = irand(MAX_WAVE_PACKETS) + 1;
-		out->interferencemethod = (rand() * MAX_INTERFERENCE_METHODS) / RAND_MAX;
+		out->packets = irand(rng, MAX_WAVE_PACKETS) + 1;
+		out->interferencemethod = irand(rng, MAX_INTERFERENCE_METHODS);
 		for(ctr = 0; ctr <= out->packets; ctr++)
 			{
-			InitWavePacket(&out->packet[ctr]);
+			InitWavePacket(&out->packet[ctr], rng);
 			}
 		}
 	return out;
 	}
 
-void InitWavePacket(WavePacketRec* it)
+void InitWavePacket(WavePacketRec* it, RandRef rng)
 	{
 	/*
 	Pick a location and angle for this wave packet.
 	Then create a wave.
 	*/
-	it->originH = frand(1.0);
-	it->originV = frand(1.0);
-	it->angle = frand(pi);
-	InitWave(&it->wave);
+	it->originH = frand(rng, 1.0);
+	it->originV = frand(rng, 1.0);
+	it->angle = frand(rng, pi);
+	it->sinangle = sin(it->angle);
+	it->cosangle = cos(it->angle);
+	InitWave(&it->wave, rng);
 	}
 
-void InitWave(WaveRec* it)
+void InitWave(WaveRec* it, RandRef rng)
 	{
 	/*
 	Set up this wave.
 	Pick a scaling factor and display packing method.
 	*/
-	it->scale = frandge(2.0, 30.0);
-	it->packmethod = RandomPackMethod();
+	it->scale = frandge(rng, 2.0, 30.0);
+	it->packmethod = RandomPackMethod(rng);
 	if(it->packmethod == scaleToFit) it->scale *= 2.0;
-	it->accelmethod = irand(MAX_ACCEL_METHODS);
+	it->packer = PackedCosKernel(it->packmethod);
+	it->accelmethod = irand(rng, MAX_ACCEL_METHODS);
 	switch(it->accelmethod)
 		{
 		case accelNone:
@@ -148,9 +178,10 @@ void InitWave(WaveRec* it)
 			break;
 		case accelWave:
 			//Make a sine wave to squiggle this one sideways.
-			it->accelscale = frandge(2.0, 30.0);
-			it->accelamp = frand(0.1);
-			it->accelpack = RandomPackMethod();
+			it->accelscale = frandge(rng, 2.0, 30.0);
+			it->accelamp = frand(rng, 0.1);
+			it->accelpack = RandomPackMethod(rng);
+			it->accelpacker = PackedCosKernel(it->accelpack);
 			break;
 		}
 	}
@@ -238,32 +269,203 @@ float Flatwave(float h, float v, void* refcon)
 	return out;
 	}
 
+void FlatwaveSpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	/*
+	Flatwave for a whole row of points. Instead of running every packet at
+	each point, we run each packet along a piece of the row, folding its
+	values into the results as we go. Each point still sees the packets in
+	the same order, so the results are the same, but the interference
+	method is picked once per packet instead of once per packet per point,
+	and each packet's waves are packed a piece at a time.
+	*/
+	FlatwaveRec* glb = (FlatwaveRec*)refcon;
+	float layer[FLATWAVE_SPAN_PIECE], start = 0.5;
+	int ctr, packet, piece;
+	if(!glb)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0.5;
+		return;
+		}
+	switch(glb->interferencemethod)
+		{
+		case intfMostExtreme:
+			start = 0.5;
+			break;
+		case intfLeastExtreme:
+		case intfMax:
+		case intfAverage:
+			start = 0;
+			break;
+		case intfMin:
+			start = 1;
+			break;
+		}
+	while(count > 0)
+		{
+		piece = (count < FLATWAVE_SPAN_PIECE) ? count : FLATWAVE_SPAN_PIECE;
+		for(ctr = 0; ctr < piece; ctr++) out[ctr] = start;
+		for(packet = 0; packet <= glb->packets; packet++)
+			{
+			CalcWavePacketRow(h, v, piece, &glb->packet[packet], layer);
+			if(glb->packets <= 1)
+				{
+				for(ctr = 0; ctr < piece; ctr++) out[ctr] = layer[ctr];
+				continue;
+				}
+			switch(glb->interferencemethod)
+				{
+				case intfMostExtreme:
+					for(ctr = 0; ctr < piece; ctr++)
+						if(fabs(layer[ctr] - 0.5) > fabs(out[ctr] - 0.5)) out[ctr] = layer[ctr];
+					break;
+				case intfLeastExtreme:
+					for(ctr = 0; ctr < piece; ctr++)
+						if(fabs(layer[ctr] - 0.5) < fabs(out[ctr] - 0.5)) out[ctr] = layer[ctr];
+					break;
+				case intfMax:
+					for(ctr = 0; ctr < piece; ctr++) if(layer[ctr] > out[ctr]) out[ctr] = layer[ctr];
+					break;
+				case intfMin:
+					for(ctr = 0; ctr < piece; ctr++) if(out[ctr] > layer[ctr]) out[ctr] = layer[ctr];
+					break;
+				case intfAverage:
+					for(ctr = 0; ctr < piece; ctr++) out[ctr] += layer[ctr];
+					break;
+				default:
+					for(ctr = 0; ctr < piece; ctr++) out[ctr] = layer[ctr];
+				}
+			}
+		if(glb->interferencemethod == intfAverage)
+			{
+			for(ctr = 0; ctr < piece; ctr++) out[ctr] /= glb->packets;
+			}
+		h += piece;
+		out += piece;
+		count -= piece;
+		}
+	}
+
 float CalcWavePacket(float h, float v, WavePacketRec* it)
 	{
 	/*
 	Calculate the value returned by this wave packet.
-	We find the origin of the wave and determine how far away and
-	at what angle this point lies from that origin.
-	Then we feed the distance & traverse values we get into each
-	wave. We combine the results with any of several interference schemes.
+	We find how far along and across the packet's line this point lies,
+	then feed the distance & traverse values into the wave.
 	*/
-	float hypangle, hypotenuse;
 	float distance, transverse;
-	float out = 0.5;
+	WavePacketLegs(h, v, it, &distance, &transverse);
+	return CalcWave(distance, transverse, &it->wave);
+	}
+
+static void WavePacketLegs(float h, float v, WavePacketRec* it, float* distance, float* transverse)
+	{
+	/*
+	Find the origin of the wave and determine how far away and at what
+	angle this point lies from that origin. Turn that into a right
+	triangle, whose legs are the distance along the wave and across it.
+	*/
+	float hypangle, hypotenuse;
 	//Re-centre the point on our wave's origin.
 	h -= it->originH;
 	v -= it->originV;
+	if(UsingFastMath())
+		{
+		/*
+		All the trigonometry below comes to turning the point through the
+		packet's angle, which takes no trigonometry at all once we know the
+		angle's sine and cosine. It's only not the default because the
+		rounding is different.
+		*/
+		*transverse = h * it->cosangle - v * it->sinangle;
+		*distance = h * it->sinangle + v * it->cosangle;
+		return;
+		}
 	//Now figure the length from the origin to this point.
-	hypotenuse = hypotf(h, v);
+	hypotenuse = genhypotf(h, v);
 	//Find the angle of the line from this point to the origin.
-	hypangle = atan(v / h) + it->angle;
+	hypangle = genatan(v / h) + it->angle;
 	if(h < 0) hypangle += pi;
 	//Using the angle and the hypotenuse, we can figure out the individual legs.
-	transverse = (cos(hypangle) * hypotenuse);
-	distance = (sin(hypangle) * hypotenuse);
-	//Our return value, for now, is just the value of our wave.
-	out = CalcWave(distance, transverse, &it->wave);
-	return out;
+	*transverse = (gencos(hypangle) * hypotenuse);
+	*distance = (gensin(hypangle) * hypotenuse);
+	}
+
+static void CalcWavePacketRow(const float* h, float v, int count, WavePacketRec* it, float* out)
+	{
+	/*
+	CalcWavePacket for up to FLATWAVE_SPAN_PIECE points along a row. We
+	find the legs a point at a time, then let the wave's packed cosine
+	kernels do the whole row, the way CalcWave would point by point.
+	With fast math, if the points are evenly spaced, as they nearly always
+	are, we can do better; see SteppedWavePacketRow.
+	*/
+	float distance[FLATWAVE_SPAN_PIECE], transverse[FLATWAVE_SPAN_PIECE];
+	float step;
+	int ctr;
+	if(UsingFastMath() && EvenlySpaced(h, count, &step))
+		{
+		SteppedWavePacketRow(h[0], step, v, count, it, out);
+		return;
+		}
+	for(ctr = 0; ctr < count; ctr++) WavePacketLegs(h[ctr], v, it, &distance[ctr], &transverse[ctr]);
+	if(it->wave.accelmethod == accelWave)
+		{
+		it->wave.accelpacker(transverse, it->wave.accelscale, count, transverse);
+		for(ctr = 0; ctr < count; ctr++) distance[ctr] += transverse[ctr] * it->wave.accelamp;
+		}
+	it->wave.packer(distance, it->wave.scale, count, out);
+	}
+
+static int EvenlySpaced(const float* h, int count, float* step)
+	{
+	/*
+	Are these points evenly spaced, give or take their rounding? If so,
+	find the step between them. We take it from the ends of the run, which
+	pins it down far more closely than the gap between any two neighbours.
+	*/
+	float slop;
+	int ctr;
+	if(count < 2) return 0;
+	*step = (h[count - 1] - h[0]) / (count - 1);
+	slop = (fabs(h[0]) + fabs(h[count - 1]) + 1.0) * FLATWAVE_SPACING_SLOP;
+	for(ctr = 1; ctr < count - 1; ctr++)
+		{
+		if(fabs(h[ctr] - (h[0] + ctr * *step)) > slop) return 0;
+		}
+	return 1;
+	}
+
+static void SteppedWavePacketRow(float h, float step, float v, int count, WavePacketRec* it, float* out)
+	{
+	/*
+	A wave packet along evenly spaced points, with no trigonometry per
+	point. Turning a row of points into the packet's frame is linear, so
+	the distance and transverse legs go up by the same amount at every
+	step, and a wave over evenly spaced distances is what PackedCosRun is
+	for. The squiggle makes the distances uneven, so a squiggled wave has
+	to go through its packed cosine kernel, after the squiggle itself has
+	been done by steps.
+	*/
+	float distance[FLATWAVE_SPAN_PIECE];
+	double start, across, distancestep;
+	int ctr;
+	h -= it->originH;
+	v -= it->originV;
+	start = h * it->sinangle + v * it->cosangle;
+	distancestep = step * it->sinangle;
+	if(it->wave.accelmethod != accelWave)
+		{
+		PackedCosRun(start, distancestep, it->wave.scale, count, it->wave.packmethod, out);
+		return;
+		}
+	across = h * it->cosangle - v * it->sinangle;
+	PackedCosRun(across, step * it->cosangle, it->wave.accelscale, count, it->wave.accelpack, distance);
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		distance[ctr] = start + ctr * distancestep + distance[ctr] * it->wave.accelamp;
+		}
+	it->wave.packer(distance, it->wave.scale, count, out);
 	}
 
 float CalcWave(float distance, float transverse, WaveRec* it)
@@ -285,4 +487,116 @@ float CalcWave(float distance, float transverse, WaveRec* it)
 		}
 	out = PackedCos(distance, it->scale, it->packmethod);
 	return out;
-	}
\ No newline at end of file
+	}
+
+void FlatwaveBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	Find the bounds of every packet over the rectangle, then combine them
+	the same way Flatwave combines the packets' values.
+	*/
+	FlatwaveRec* glb = (FlatwaveRec*)refcon;
+	float packetlo, packethi;
+	int ctr;
+	*lo = 0.5;
+	*hi = 0.5;
+	if(!glb) return;
+	switch(glb->interferencemethod)
+		{
+		case intfLeastExtreme:
+		case intfMax:
+		case intfAverage:
+			*lo = *hi = 0;
+			break;
+		case intfMin:
+			*lo = *hi = 1;
+			break;
+		}
+	for(ctr = 0; ctr <= glb->packets; ctr++)
+		{
+		WavePacketBounds(left, top, right, bottom, &glb->packet[ctr], &packetlo, &packethi);
+		if(glb->packets <= 1)
+			{
+			//With only one packet, each one simply replaces the value before it.
+			if(ctr == 0)
+				{
+				*lo = packetlo;
+				*hi = packethi;
+				}
+			else
+				{
+				if(packetlo < *lo) *lo = packetlo;
+				if(packethi > *hi) *hi = packethi;
+				}
+			}
+		else if(glb->interferencemethod == intfAverage)
+			{
+			*lo += packetlo;
+			*hi += packethi;
+			}
+		else if(glb->interferencemethod == intfMax)
+			{
+			if(packetlo > *lo) *lo = packetlo;
+			if(packethi > *hi) *hi = packethi;
+			}
+		else if(glb->interferencemethod == intfMin)
+			{
+			if(packetlo < *lo) *lo = packetlo;
+			if(packethi < *hi) *hi = packethi;
+			}
+		else
+			{
+			//The extreme-picking methods return some packet's value, but we can't say which.
+			if(packetlo < *lo) *lo = packetlo;
+			if(packethi > *hi) *hi = packethi;
+			}
+		}
+	if(glb->interferencemethod == intfAverage)
+		{
+		*lo /= glb->packets;
+		*hi /= glb->packets;
+		}
+	}
+
+static void WavePacketBounds
+		(
+		float left, float top, float right, float bottom,
+		WavePacketRec* it,
+		float* lo, float* hi
+		)
+	{
+	/*
+	CalcWavePacket rotates the point around the packet's origin, which
+	works out to distance = h sin(angle) + v cos(angle), measured from the
+	origin. That is linear, so its bounds over the rectangle are at the
+	corners. Then we see what the wave does over that range of distances.
+	*/
+	float distlo, disthi, translo, transhi, accello, accelhi;
+	left -= it->originH;
+	right -= it->originH;
+	top -= it->originV;
+	bottom -= it->originV;
+	LinearBounds(left, top, right, bottom, sin(it->angle), cos(it->angle), &distlo, &disthi);
+	if(it->wave.accelmethod == accelWave)
+		{
+		//The transverse axis squiggles the distance by a wave of its own.
+		LinearBounds(left, top, right, bottom, cos(it->angle), -sin(it->angle), &translo, &transhi);
+		PackedCosBounds(translo, transhi, it->wave.accelscale, it->wave.accelpack, &accello, &accelhi);
+		distlo += accello * it->wave.accelamp;
+		disthi += accelhi * it->wave.accelamp;
+		}
+	PackedCosBounds(distlo, disthi, it->wave.scale, it->wave.packmethod, lo, hi);
+	}
+
+static void LinearBounds
+		(
+		float left, float top, float right, float bottom,
+		float hfactor, float vfactor,
+		float* lo, float* hi
+		)
+	{
+	//Bounds of h * hfactor + v * vfactor over a rectangle.
+	*lo = ((hfactor < 0) ? right : left) * hfactor + ((vfactor < 0) ? bottom : top) * vfactor;
+	*hi = ((hfactor < 0) ? left : right) * hfactor + ((vfactor < 0) ? top : bottom) * vfactor;
+	}
+
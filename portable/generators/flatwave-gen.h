@@ -27,6 +27,10 @@ interfering with each other and making interesting effects.
 
 */
 
-void* FlatwaveInit(void);
+#include "genutils.h"
+
+void* FlatwaveInit(int width, int height, RandRef rng, GenOptionsRef options);
 void FlatwaveExit(void* refcon);
-float Flatwave(float h, float v, void* refcon);
\ No newline at end of file
+float Flatwave(float h, float v, void* refcon);
+void FlatwaveSpan(const float* h, float v, int count, void* refcon, float* out);
+void FlatwaveBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
\ No newline at end of file
@@ -24,6 +24,15 @@ This works, and makes convincing-looking, perfectly spherical galaxies.
 It isn't too interesting or flexible, though. More of a novelty than
 a useful Starfish engine.
 
+The sparkle is a random number for every point. Rather than draw the
+numbers one after another, which would make every point depend on which
+points came before it, we take the number a point's coordinates pick out
+of the galaxy's own random stream. So a point always comes out the same,
+whatever order the points are asked for in and on whatever thread.
+The galaxy sits in the middle of the tile and wraps around its edges by
+itself: across the edge, the distance from the middle of the tile only
+turns round and starts getting shorter again.
+
 */
 
 #include "galaxy-gen.h"
@@ -31,22 +40,26 @@ a useful Starfish engine.
 #include <stdlib.h>
 #include <math.h>
 
+//Rounding can put a point a hair outside its bounds; this much covers it.
+#define GALAXY_BOUNDS_SLOP 0.00001
 
 typedef struct GalaxyGlobals
 	{
 	float rangemin;
 	float rangemax;
+	uint64_t sparkle;	//seed of the stream the points pick their sparkle from
 	}
 GalaxyGlobals;
 typedef GalaxyGlobals* GalaxyRef;
 
-void* GalaxyInit(void)
+void* GalaxyInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	GalaxyRef out = (GalaxyRef)malloc(sizeof(GalaxyGlobals));
 	if(out)
 		{
-		out->rangemin = frandge(0.0, 4.0);
-		out->rangemax = frandge(1.0, 48.0);
+		out->rangemin = frandge(rng, 0.0, 4.0);
+		out->rangemax = frandge(rng, 1.0, 48.0);
+		out->sparkle = RandomSeed(rng);
 		}
 	return out;
 	}
@@ -56,10 +69,67 @@ void GalaxyExit(void* refcon)
 	if(refcon) free(refcon);
 	}
 
+static float Sparkle(float h, float v, GalaxyRef it)
+	{
+	/*
+	The random number for this point: the one the stream would give at a
+	position made from the bits of the point's coordinates.
+	*/
+	union { float f; uint32_t bits; } hbits, vbits;
+	RandomRec draw;
+	hbits.f = h;
+	vbits.f = v;
+	draw.seed = it->sparkle;
+	draw.counter = ((uint64_t)hbits.bits << 32) | vbits.bits;
+	return frandge(&draw, it->rangemin, it->rangemax);
+	}
+
 float Galaxy(float h, float v, void* refcon)
 	{
-	float dist;
+	float dh, dv;
 	GalaxyRef it = (GalaxyRef)refcon;
-	dist = hypot(h - 0.5, v - 0.5);
-	return 1.0 - dist  * dist * frandge(it->rangemin, it->rangemax);
-	}
\ No newline at end of file
+	if(!it) return 0;
+	dh = h - floor(h) - 0.5;
+	dv = v - floor(v) - 0.5;
+	return 1.0 - (dh * dh + dv * dv) * Sparkle(h, v, it);
+	}
+
+void GalaxySpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	//Galaxy along a row; the vertical distance is the same all the way.
+	float dh, dv;
+	int ctr;
+	GalaxyRef it = (GalaxyRef)refcon;
+	if(!it)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0;
+		return;
+		}
+	dv = v - floor(v) - 0.5;
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		dh = h[ctr] - floor(h[ctr]) - 0.5;
+		out[ctr] = 1.0 - (dh * dh + dv * dv) * Sparkle(h[ctr], v, it);
+		}
+	}
+
+void GalaxyBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	The sparkle is somewhere between rangemin and rangemax, whichever way
+	round they came out, and the distance from the middle is between the
+	rectangle's nearest and farthest. Outside the tile, the distance wraps
+	around; don't try to be clever there.
+	*/
+	float nearest, farthest, sparklemin, sparklemax;
+	GalaxyRef it = (GalaxyRef)refcon;
+	*lo = 0.0;
+	*hi = 1.0;
+	if(!it) return;
+	if(left < 0.0 || top < 0.0 || right > 1.0 || bottom > 1.0) return;
+	RectDistanceBounds(left, top, right, bottom, 0.5, 0.5, &nearest, &farthest);
+	sparklemin = (it->rangemin < it->rangemax) ? it->rangemin : it->rangemax;
+	sparklemax = (it->rangemin < it->rangemax) ? it->rangemax : it->rangemin;
+	*lo = 1.0 - farthest * farthest * sparklemax - GALAXY_BOUNDS_SLOP;
+	*hi = 1.0 - nearest * nearest * sparklemin + GALAXY_BOUNDS_SLOP;
+	}
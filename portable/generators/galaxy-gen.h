@@ -26,11 +26,15 @@ galaxy effect. It looks like a field of stars clustering in a brilliant core,
 so bright you can't pick out the individual elements. The galaxy comes in
 random sizes, and that's about the extent of it.
 
-This is not an official part of the starfish canon because it is so predictable.
+This was long left out of the starfish canon because it is so predictable.
 I like generators to be a little more flexible than this is.
 
 */
 
-void* GalaxyInit(void);
+#include "genutils.h"
+
+void* GalaxyInit(int width, int height, RandRef rng, GenOptionsRef options);
 void GalaxyExit(void* refcon);
-float Galaxy(float h, float v, void* refcon);
\ No newline at end of file
+float Galaxy(float h, float v, void* refcon);
+void GalaxySpan(const float* h, float v, int count, void* refcon, float* out);
+void GalaxyBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
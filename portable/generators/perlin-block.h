@@ -0,0 +1,152 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Perlin Block Kernel
+
+This is not an ordinary header: perlin-gen.c includes it once for each
+instruction set, with PERLIN_LANES set to the number of floats in one of
+its registers, PERLIN_SUFFIX to the instruction set's name and
+PERLIN_ATTRIBUTES to its target attributes. Each inclusion defines its own
+vector types and a PerlinBlocks function for that instruction set, named
+with the suffix: PerlinBlocksSSE2 and so on. The kernel matches PerlinPoint
+step for step, so every copy gives exactly the same answers.
+
+*/
+
+#define PERLIN_PASTE(name, suffix) name##suffix
+#define PERLIN_NAME(name, suffix) PERLIN_PASTE(name, suffix)
+#define perlinvec PERLIN_NAME(perlinvec, PERLIN_SUFFIX)
+#define perlinivec PERLIN_NAME(perlinivec, PERLIN_SUFFIX)
+#define perlinuvec PERLIN_NAME(perlinuvec, PERLIN_SUFFIX)
+#define MixHashBlock PERLIN_NAME(MixHashBlock, PERLIN_SUFFIX)
+#define GradientBlock PERLIN_NAME(GradientBlock, PERLIN_SUFFIX)
+#define PerlinBlock PERLIN_NAME(PerlinBlock, PERLIN_SUFFIX)
+#define PerlinBlocksHere PERLIN_NAME(PerlinBlocks, PERLIN_SUFFIX)
+
+typedef float perlinvec __attribute__((vector_size(PERLIN_LANES * sizeof(float))));
+typedef int32_t perlinivec __attribute__((vector_size(PERLIN_LANES * sizeof(float))));
+typedef uint32_t perlinuvec __attribute__((vector_size(PERLIN_LANES * sizeof(float))));
+#ifndef PERLIN_KERNEL
+#define PERLIN_KERNEL static inline __attribute__((always_inline))
+#endif
+//Lanewise mask ? a : b, where mask lanes are all ones or all zeros.
+#define PERLIN_SELECT(mask, a, b) ((perlinvec)(((perlinuvec)(a) & (mask)) | ((perlinuvec)(b) & ~(mask))))
+
+/*
+Vector comparisons come out a lane at a time on some targets, so the
+kernel gets its masks from sign bits and hash bits instead. PerlinPoint
+makes the same decisions the ordinary way.
+*/
+
+PERLIN_KERNEL void MixHashBlock(perlinuvec* hash)
+	{
+	//Vector arguments go by pointer, as in genutils, to keep clear of ABI trouble.
+	*hash ^= *hash >> 16;
+	*hash *= HASH_MIX1;
+	*hash ^= *hash >> 15;
+	*hash *= HASH_MIX2;
+	*hash ^= *hash >> 16;
+	}
+
+PERLIN_KERNEL void GradientBlock(const perlinuvec* corner, const perlinvec* h, const perlinvec* v, perlinvec* out)
+	{
+	//Gradient for a block. Flipping the sign bit is just what negation does.
+	perlinvec zero = {0}, gradh, gradv;
+	perlinuvec hash, diagonal, odd, signh, signv;
+	hash = *corner;
+	MixHashBlock(&hash);
+	diagonal = 0 - ((hash >> 2) & 1);
+	odd = 0 - (hash & 1);
+	gradh = PERLIN_SELECT(diagonal, zero + PERLIN_DIAGONAL, PERLIN_SELECT(odd, zero + 1.0f, zero));
+	gradv = PERLIN_SELECT(diagonal, zero + PERLIN_DIAGONAL, PERLIN_SELECT(odd, zero, zero + 1.0f));
+	//Diagonals take the horizontal sign from bit 0; everything else from bit 1.
+	signv = (hash & 2) << 30;
+	signh = (diagonal & (hash << 31)) | (~diagonal & signv);
+	gradh = (perlinvec)((perlinuvec)gradh ^ signh);
+	gradv = (perlinvec)((perlinuvec)gradv ^ signv);
+	*out = gradh * *h + gradv * *v;
+	}
+
+PERLIN_KERNEL void PerlinBlock(const float* h, const PerlinRow* row, const PerlinGlobals* it, float* out)
+	{
+	perlinvec vh, pos, posfrac, posfrac1, above, below, fade;
+	perlinvec topleft, topright, bottomleft, bottomright, top, bottom, noise, sum, zero = {0};
+	perlinivec cell;
+	perlinuvec left, right, corner;
+	int ctr;
+	memcpy(&vh, h, sizeof(vh));
+	sum = zero;
+	for(ctr = 0; ctr < it->octaves; ctr++)
+		{
+		pos = vh * it->period[ctr];
+		cell = __builtin_convertvector(pos, perlinivec);
+		posfrac = pos - __builtin_convertvector(cell, perlinvec);
+		cell += (perlinivec)posfrac >> 31;
+		posfrac = pos - __builtin_convertvector(cell, perlinvec);
+		posfrac1 = posfrac - 1.0f;
+		above = zero + row[ctr].above;
+		below = zero + row[ctr].below;
+		left = it->seed[ctr] ^ ((perlinuvec)(cell & it->mask[ctr]) * HASH_H);
+		right = it->seed[ctr] ^ ((perlinuvec)((cell + 1) & it->mask[ctr]) * HASH_H);
+		corner = left ^ row[ctr].top;
+		GradientBlock(&corner, &posfrac, &above, &topleft);
+		corner = right ^ row[ctr].top;
+		GradientBlock(&corner, &posfrac1, &above, &topright);
+		corner = left ^ row[ctr].bottom;
+		GradientBlock(&corner, &posfrac, &below, &bottomleft);
+		corner = right ^ row[ctr].bottom;
+		GradientBlock(&corner, &posfrac1, &below, &bottomright);
+		fade = posfrac * posfrac * posfrac * (posfrac * (posfrac * 6.0f - 15.0f) + 10.0f);
+		top = topleft + fade * (topright - topleft);
+		bottom = bottomleft + fade * (bottomright - bottomleft);
+		noise = top + row[ctr].fade * (bottom - top);
+		if(it->style == perlinBillowStyle) noise = (perlinvec)((perlinuvec)noise & ~PERLIN_SIGN);
+		else if(it->style == perlinRidgeStyle) noise = PERLIN_RANGE - (perlinvec)((perlinuvec)noise & ~PERLIN_SIGN);
+		sum = sum + it->amplitude[ctr] * noise;
+		}
+	sum = sum * it->scale + it->offset;
+	sum = PERLIN_SELECT((perlinuvec)((perlinivec)sum >> 31), zero, sum);
+	sum = PERLIN_SELECT((perlinuvec)((perlinivec)(1.0f - sum) >> 31), zero + 1.0f, sum);
+	memcpy(out, &sum, sizeof(sum));
+	}
+
+PERLIN_ATTRIBUTES
+static void PerlinBlocksHere(const float* h, int blocks, const PerlinRow* row, const PerlinGlobals* it, float* out)
+	{
+	int ctr;
+	for(ctr = 0; ctr < blocks; ctr++, h += PERLIN_LANES, out += PERLIN_LANES)
+		{
+		PerlinBlock(h, row, it, out);
+		}
+	}
+
+#undef PERLIN_SELECT
+#undef PerlinBlocksHere
+#undef PerlinBlock
+#undef GradientBlock
+#undef MixHashBlock
+#undef perlinuvec
+#undef perlinivec
+#undef perlinvec
+#undef PERLIN_NAME
+#undef PERLIN_PASTE
+#undef PERLIN_ATTRIBUTES
+#undef PERLIN_SUFFIX
+#undef PERLIN_LANES
@@ -0,0 +1,351 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Perlin Generator
+
+Each octave is a square grid of cells laid over the tile, with a random
+gradient at every corner. A point's value comes from the four corners of
+its cell: each corner's gradient tells how fast the value climbs away from
+it, and the four slopes are blended with a smooth curve across the cell.
+The gradients come from a hash of the corner's position and the octave,
+rather than from a table, so there is nothing to build and nothing to
+look up, and they repeat exactly when the position wraps around the tile.
+
+There are three styles. Plain noise is rolling clouds. Billows take the
+size of the noise, so it folds over at zero into puffy lumps; ridges turn
+those upside down, into sharp crests like mountain ranges.
+
+PerlinSpan works a block of points at a time in GCC vector types, picking
+SSE2, AVX2 or AVX-512 code at run time, much like the fast maths in
+genutils; Perlin does the same sums one point at a time, in the same
+order, so the two always agree exactly.
+
+*/
+
+#include "perlin-gen.h"
+#include "genutils.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Unless its options say otherwise, a layer gets this many octaves, or so.
+#define MIN_DEFAULT_OCTAVES 3
+#define MAX_DEFAULT_OCTAVES 7
+//The coarsest octave has 2, 4 or 8 cells across the tile; each octave has twice as many as the last.
+#define MIN_PERIOD_SCALE 1
+#define MAX_PERIOD_SCALE 3
+//Octaves stop before their cells get narrower than this many pixels.
+#define PERLIN_PIXELS_PER_CELL 2
+/*
+With unit gradients, two-dimensional gradient noise never gets farther
+than this from zero: the square root of a half.
+*/
+#define PERLIN_RANGE 0.70710678f
+//Diagonal gradients are this long along each axis.
+#define PERLIN_DIAGONAL 0.70710678f
+//The hash multipliers.
+#define HASH_OCTAVE 0x9E3779B9u
+#define HASH_H 0x85EBCA6Bu
+#define HASH_V 0xC2B2AE35u
+#define HASH_MIX1 0x7FEB352Du
+#define HASH_MIX2 0x846CA68Bu
+
+enum perlinstyles
+	{
+	perlinPlainStyle,
+	perlinBillowStyle,
+	perlinRidgeStyle,
+	MAX_PERLIN_STYLES
+	};
+
+typedef struct PerlinGlobals
+	{
+	int octaves;
+	int style;
+	uint32_t seed[MAX_PERLIN_OCTAVES];		//hash seed for each octave
+	int mask[MAX_PERLIN_OCTAVES];			//cells across, less one; always a power of two less one
+	float period[MAX_PERLIN_OCTAVES];		//cells across
+	float amplitude[MAX_PERLIN_OCTAVES];
+	float scale, offset;		//turn the sum of the octaves into 0..1
+	}
+PerlinGlobals;
+typedef PerlinGlobals* PerlinRef;
+
+/*
+Everything about one octave that is the same all along a row: the hashed
+rows of corners above and below, where the row is between them, and how
+far the blend has gone from one to the other.
+*/
+typedef struct PerlinRow
+	{
+	uint32_t top, bottom;
+	float above, below;		//vertical distance from the top and bottom corners
+	float fade;
+	}
+PerlinRow;
+
+static void SetupRows(float v, const PerlinGlobals* it, PerlinRow* row);
+static float PerlinPoint(float h, const PerlinRow* row, const PerlinGlobals* it);
+static uint32_t MixHash(uint32_t hash);
+static float Gradient(uint32_t hash, float h, float v);
+static float Fade(float t);
+
+void* PerlinInit(int width, int height, RandRef rng, GenOptionsRef options)
+	{
+	/*
+	Pick a style, a size for the coarsest cells, and how much fainter each
+	octave is than the last. The layer's size decides how many of the
+	octaves are worth working out, but not how bright the rest are.
+	*/
+	PerlinRef out = (PerlinRef)malloc(sizeof(PerlinGlobals));
+	if(out)
+		{
+		int ctr, scale, finest, widest;
+		float gain, total;
+		uint32_t seed;
+		out->style = irand(rng, MAX_PERLIN_STYLES);
+		scale = irandge(rng, MIN_PERIOD_SCALE, MAX_PERIOD_SCALE + 1);
+		out->octaves = irandge(rng, MIN_DEFAULT_OCTAVES, MAX_DEFAULT_OCTAVES + 1);
+		if(options->octaves > 0)
+			{
+			out->octaves = (options->octaves < MAX_PERLIN_OCTAVES) ? options->octaves : MAX_PERLIN_OCTAVES;
+			}
+		gain = frandge(rng, 0.4, 0.65);
+		seed = NextRandom(rng);
+		/*
+		The total amplitude counts every octave the layer is meant to have,
+		even ones we leave out below for being too fine. That way a small
+		render of a layer has the same contrast as a big one, and only
+		lacks detail it couldn't show anyway.
+		*/
+		total = 0.0;
+		for(ctr = 0; ctr < out->octaves; ctr++)
+			{
+			out->seed[ctr] = seed + ctr * HASH_OCTAVE;
+			out->mask[ctr] = (1 << (scale + ctr)) - 1;
+			out->period[ctr] = 1 << (scale + ctr);
+			out->amplitude[ctr] = (ctr == 0) ? 1.0 : out->amplitude[ctr - 1] * gain;
+			total += out->amplitude[ctr];
+			}
+		//Don't bother with cells too small to see.
+		widest = (width > height) ? width : height;
+		finest = scale + out->octaves - 1;
+		while(out->octaves > 1 && (1 << finest) * PERLIN_PIXELS_PER_CELL > widest)
+			{
+			out->octaves--;
+			finest--;
+			}
+		/*
+		Plain noise runs from -PERLIN_RANGE to PERLIN_RANGE times the total
+		amplitude, so its middle goes in the middle; billows and ridges run
+		from zero to PERLIN_RANGE times the total.
+		*/
+		if(out->style == perlinPlainStyle)
+			{
+			out->scale = 0.5 / (PERLIN_RANGE * total);
+			out->offset = 0.5;
+			}
+		else
+			{
+			out->scale = 1.0 / (PERLIN_RANGE * total);
+			out->offset = 0.0;
+			}
+		}
+	return out;
+	}
+
+void PerlinExit(void* refcon)
+	{
+	if(refcon) free(refcon);
+	}
+
+float Perlin(float h, float v, void* refcon)
+	{
+	PerlinRow row[MAX_PERLIN_OCTAVES];
+	PerlinRef it = (PerlinRef)refcon;
+	if(!it) return 0;
+	SetupRows(v, it, row);
+	return PerlinPoint(h, row, it);
+	}
+
+static void SetupRows(float v, const PerlinGlobals* it, PerlinRow* row)
+	{
+	//Work out the part of each octave which only depends on the row.
+	float pos, posfrac;
+	int ctr, cell;
+	for(ctr = 0; ctr < it->octaves; ctr++)
+		{
+		pos = v * it->period[ctr];
+		cell = (int)pos;
+		if(pos < cell) cell--;
+		posfrac = pos - (float)cell;
+		row[ctr].top = (uint32_t)(cell & it->mask[ctr]) * HASH_V;
+		row[ctr].bottom = (uint32_t)((cell + 1) & it->mask[ctr]) * HASH_V;
+		row[ctr].above = posfrac;
+		row[ctr].below = posfrac - 1.0f;
+		row[ctr].fade = Fade(posfrac);
+		}
+	}
+
+static float PerlinPoint(float h, const PerlinRow* row, const PerlinGlobals* it)
+	{
+	/*
+	Add up the octaves at one point. PerlinBlock does exactly the same
+	sums, step for step, for a block of points.
+	*/
+	float pos, posfrac, fade, topleft, topright, bottomleft, bottomright, top, bottom, noise, sum;
+	uint32_t left, right;
+	int ctr, cell;
+	sum = 0.0f;
+	for(ctr = 0; ctr < it->octaves; ctr++)
+		{
+		pos = h * it->period[ctr];
+		cell = (int)pos;
+		if(pos < cell) cell--;
+		posfrac = pos - (float)cell;
+		left = it->seed[ctr] ^ ((uint32_t)(cell & it->mask[ctr]) * HASH_H);
+		right = it->seed[ctr] ^ ((uint32_t)((cell + 1) & it->mask[ctr]) * HASH_H);
+		topleft = Gradient(MixHash(left ^ row[ctr].top), posfrac, row[ctr].above);
+		topright = Gradient(MixHash(right ^ row[ctr].top), posfrac - 1.0f, row[ctr].above);
+		bottomleft = Gradient(MixHash(left ^ row[ctr].bottom), posfrac, row[ctr].below);
+		bottomright = Gradient(MixHash(right ^ row[ctr].bottom), posfrac - 1.0f, row[ctr].below);
+		fade = Fade(posfrac);
+		top = topleft + fade * (topright - topleft);
+		bottom = bottomleft + fade * (bottomright - bottomleft);
+		noise = top + row[ctr].fade * (bottom - top);
+		if(it->style == perlinBillowStyle) noise = fabsf(noise);
+		else if(it->style == perlinRidgeStyle) noise = PERLIN_RANGE - fabsf(noise);
+		sum = sum + it->amplitude[ctr] * noise;
+		}
+	sum = sum * it->scale + it->offset;
+	//Rounding could nudge the very brightest or darkest points out of range.
+	if(sum <= 0.0f) sum = 0.0f;
+	if(1.0f - sum < 0.0f) sum = 1.0f;
+	return sum;
+	}
+
+static uint32_t MixHash(uint32_t hash)
+	{
+	//Stir the bits of a corner's hash together, so every bit counts.
+	hash ^= hash >> 16;
+	hash *= HASH_MIX1;
+	hash ^= hash >> 15;
+	hash *= HASH_MIX2;
+	hash ^= hash >> 16;
+	return hash;
+	}
+
+static float Gradient(uint32_t hash, float h, float v)
+	{
+	/*
+	The slope from a corner, towards the point h, v away from it. Three
+	bits of the hash pick one of eight unit gradients: the four axes and
+	the four diagonals.
+	*/
+	float gradh, gradv;
+	if(hash & 4)
+		{
+		gradh = PERLIN_DIAGONAL;
+		gradv = PERLIN_DIAGONAL;
+		if(hash & 1) gradh = -gradh;
+		}
+	else
+		{
+		gradh = (hash & 1) ? 1.0f : 0.0f;
+		gradv = (hash & 1) ? 0.0f : 1.0f;
+		if(hash & 2) gradh = -gradh;
+		}
+	if(hash & 2) gradv = -gradv;
+	return gradh * h + gradv * v;
+	}
+
+static float Fade(float t)
+	{
+	//Perlin's smootherstep: flat at both ends, and so is its slope.
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+	}
+
+#if STARFISH_SIMD
+/*
+The block kernels work on a block of points in GCC vector types, one lane
+per point. perlin-block.h holds the kernel; we stamp out one copy for each
+instruction set, each with blocks exactly one register wide, since a
+block wider than the registers runs out of them and spills.
+*/
+#define PERLIN_SIGN 0x80000000u
+
+#define PERLIN_LANES 4
+#define PERLIN_SUFFIX SSE2
+#define PERLIN_ATTRIBUTES __attribute__((target("sse2")))
+#include "perlin-block.h"
+
+#define PERLIN_LANES 8
+#define PERLIN_SUFFIX AVX2
+#define PERLIN_ATTRIBUTES __attribute__((target("avx2")))
+#include "perlin-block.h"
+
+//AVX-512 brings FMA along, which would round differently from Perlin.
+#define PERLIN_LANES 16
+#define PERLIN_SUFFIX AVX512
+#define PERLIN_ATTRIBUTES __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#include "perlin-block.h"
+
+static int PerlinBlocks(const float* h, int count, const PerlinRow* row, const PerlinGlobals* it, float* out)
+	{
+	/*
+	Run as many whole blocks as there are on the widest kernel the CPU
+	has. Returns how many points that came to.
+	*/
+	int lanes;
+	if(__builtin_cpu_supports("avx512f")) lanes = 16;
+	else if(__builtin_cpu_supports("avx2")) lanes = 8;
+	else if(__builtin_cpu_supports("sse2")) lanes = 4;
+	else return 0;
+	count -= count % lanes;
+	if(lanes == 16) PerlinBlocksAVX512(h, count / lanes, row, it, out);
+	else if(lanes == 8) PerlinBlocksAVX2(h, count / lanes, row, it, out);
+	else PerlinBlocksSSE2(h, count / lanes, row, it, out);
+	return count;
+	}
+#endif //STARFISH_SIMD
+
+void PerlinSpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	/*
+	Perlin for a whole row of points. The vertical half of every octave is
+	worked out once for the row; then whole blocks go through the vector
+	kernel, and whatever is left over is done a point at a time, which
+	comes to the same thing.
+	*/
+	PerlinRow row[MAX_PERLIN_OCTAVES];
+	PerlinRef it = (PerlinRef)refcon;
+	int ctr, done;
+	if(!it)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0;
+		return;
+		}
+	SetupRows(v, it, row);
+	done = 0;
+	#if STARFISH_SIMD
+	done = PerlinBlocks(h, count, row, it, out);
+	#endif
+	for(ctr = done; ctr < count; ctr++) out[ctr] = PerlinPoint(h[ctr], row, it);
+	}
@@ -0,0 +1,43 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Perlin Generator
+
+Smooth, cloudy, organic noise: Ken Perlin's gradient noise, several octaves
+of it stacked up, each one finer and fainter than the last. Every octave
+has a whole number of cells across the tile, and the cells along the edges
+use the same gradients as the ones on the far side, so it tiles by itself.
+
+*/
+
+#include "genutils.h"
+
+void* PerlinInit(int width, int height, RandRef rng, GenOptionsRef options);
+void PerlinExit(void* refcon);
+float Perlin(float h, float v, void* refcon);
+void PerlinSpan(const float* h, float v, int count, void* refcon, float* out);
+/*
+A layer normally has a random number of octaves, from 3 to 7. Its options'
+octave count, if not zero, gives it that many instead, up to
+MAX_PERLIN_OCTAVES. Layers leave out octaves finer than a couple of pixels
+a cell, but are scaled as if they had them all, so a layer looks the same
+at any size apart from its finest detail.
+*/
+#define MAX_PERLIN_OCTAVES 12
@@ -27,7 +27,7 @@ working version of starfish
 #include "ramp-gen.h"
 #include <math.h>
 
-void* RampgenInit(void)
+void* RampgenInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	return NULL;
 	}
@@ -128,4 +128,4 @@ float Rampgen(float h, float v, void* refcon)
 #endif
 	/*
 	*/
-	}
\ No newline at end of file
+	}
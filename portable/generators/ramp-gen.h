@@ -26,6 +26,8 @@ working version of starfish
 
 */
 
-void* RampgenInit(void);
+#include "genutils.h"
+
+void* RampgenInit(int width, int height, RandRef rng, GenOptionsRef options);
 void RampgenExit(void* refcon);
-float Rampgen(float h, float v, void* refcon);
\ No newline at end of file
+float Rampgen(float h, float v, void* refcon);
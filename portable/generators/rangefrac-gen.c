@@ -33,6 +33,13 @@ materials.
 #include <stdlib.h>
 #include <math.h>
 
+#ifndef STARFISH_THREADS
+#define STARFISH_THREADS 0
+#endif
+#if STARFISH_THREADS
+#include <pthread.h>
+#endif
+
 /*
 Our points are stored in a big matrix.
 When the caller asks for a data point, we calculate it
@@ -43,30 +50,99 @@ based on the stuff in the matrix.
 The scale determines how many data points we calculate.
 The more data points, the tighter the resolution, and the
 larger the quantity of memory consumed.
-The size must be an even power of 2 in order to work 
-properly, so we calculate it in terms of SCALE.
-SCALE should be a value 3..10.
+The size must be an even power of 2 in order to work
+properly, so we calculate it in terms of the scale.
+Every layer picks its own scale when it is set up, so that there is a
+point for every RANGEFRAC_PIXELS_PER_POINT pixels across the layer.
+Small layers never get fewer points than MIN_VALMATRIX_SCALE, which is
+what every layer had before, and huge ones never get more than
+MAX_VALMATRIX_SCALE, which already costs 16 megabytes.
+*/
+#define MIN_VALMATRIX_SCALE 8
+#define MAX_VALMATRIX_SCALE 11
+#define RANGEFRAC_PIXELS_PER_POINT 4
+/*
+RangefracBounds looks at no more than about this many cells across the
+rectangle it is given. Bigger rectangles are answered from a coarser mip
+level instead of point by point.
 */
-#define VALMATRIX_SCALE 8
-#define VALMATRIX_SIZE (1<<VALMATRIX_SCALE)
-#define VALMATRIX_MAX (VALMATRIX_SIZE - 1)
+#define RANGEFRAC_BOUNDS_CELLS 32
+/*
+The coarse grids of the fractal, down to one point every RANGEFRAC_BLOCK
+points, are built for the whole matrix at once. The finer ones are built
+a block of RANGEFRAC_BLOCK by RANGEFRAC_BLOCK points at a time: once the
+coarse grid is there, every block can be finished on its own, so blocks
+can be shared out among threads, or left until somebody asks for them.
+*/
+#define RANGEFRAC_BLOCK_SCALE 6
+#define RANGEFRAC_BLOCK (1<<RANGEFRAC_BLOCK_SCALE)
 
 typedef struct RangefracGlobals
 	{
-	float data[VALMATRIX_SIZE][VALMATRIX_SIZE];
-	int level[VALMATRIX_SIZE][VALMATRIX_SIZE];
+	int scale;		//the matrix is 1<<scale points on a side
+	int size;
+	int mask;		//size - 1; wraps a matrix coordinate around the tile
+	float* data;	//size * size values, stored one row after another
+	/*
+	Mip levels for the bounds. A cell of level n covers a block of 1<<n by
+	1<<n points, and holds the lowest and highest of them. Level 0 is the
+	matrix itself, so lomip[0] and himip[0] are both data. Lazy matrices
+	don't know their fine points yet, so their finest level is the one
+	with a cell per block, and it holds the range those points must lie
+	in rather than the range they do.
+	*/
+	float* lomip[MAX_VALMATRIX_SCALE + 1];
+	float* himip[MAX_VALMATRIX_SCALE + 1];
+	int finestmip;
+	/*
+	Every point gets one random draw, which we take straight from the
+	counter-based stream by its position, so blocks can be finished in
+	any order and still come out the same.
+	*/
+	uint64_t seed;
+	uint64_t firstdraw;
+	//Lazy matrices only: which blocks are finished. NULL when all of them are.
+	unsigned char* ready;
+	int blocks;		//blocks across the matrix
+	int threads;	//how many threads FinishBlocks may share the blocks among
+	#if STARFISH_THREADS
+	pthread_mutex_t lock;	//only one thread finishes blocks at a time
+	#endif
 	}
 RangefracGlobals;
 
-void ClearMatrix(RangefracGlobals* out);
-void GenerateFractal(RangefracGlobals* out);
-float CalcDistance(int matrixh, int matrixv, float desth, float destv);
-float CalcWeight(int matrixh, int matrixv, float desth, float destv);
-float GetMatrixVal(int matrixh, int matrixv, RangefracGlobals* glb);
-int WrapH(int coord);
-int WrapV(int coord);
+#if STARFISH_THREADS
+//Some of the blocks of a matrix, for one worker thread to finish.
+typedef struct RangefracWork
+	{
+	RangefracGlobals* glb;
+	int first;
+	int stride;
+	}
+RangefracWork;
+#endif
+
+static int PickScale(int width, int height);
+static void GenerateFractal(RangefracGlobals* out, RandRef rng);
+static void FinishBlocks(RangefracGlobals* out);
+#if STARFISH_THREADS
+static void* FinishBlocksWorker(void* refcon);
+#endif
+static void FinishBlock(RangefracGlobals* glb, int blockh, int blockv);
+static void NeedBlocks(RangefracGlobals* glb, int firstH, int lastH, int firstV, int lastV);
+static void NeedBlock(RangefracGlobals* glb, int blockh, int blockv);
+static void GrowRange(float val, float* min, float* max);
+static float DrawPoint(const RangefracGlobals* glb, uint64_t index, float min, float max);
+static int PointLevel(int h, int v, const RangefracGlobals* glb);
+static int AllocateMips(RangefracGlobals* out);
+static void FillMips(RangefracGlobals* out);
+static void FillLazyCells(RangefracGlobals* out);
+static float CalcDistance(int matrixh, int matrixv, float desth, float destv, const RangefracGlobals* glb);
+static float CalcWeight(int matrixh, int matrixv, float desth, float destv, const RangefracGlobals* glb);
+static float GetMatrixVal(int matrixh, int matrixv, const RangefracGlobals* glb);
+static float RowWeight(float distH, float distV);
 
-void* RangefracInit(void)
+void* RangefracInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	Create a globals record which will store all of our
@@ -74,21 +150,87 @@ void* RangefracInit(void)
 	We also fill it out here, because I think that is a quick
 	operation. If it turns out not to be quick, we will fill it
 	progressively as it is requested.
+	It did turn out not to be quick, once matrices grew with the layers,
+	so a lazy matrix only gets its coarse grid here. Rangefrac finishes
+	each block the first time a point needs it.
 	*/
 	RangefracGlobals* out;
-	int tempblinder;
+	int level, ctr;
 	out = (RangefracGlobals*)malloc(sizeof(RangefracGlobals));
 	if(out)
 		{
-		ClearMatrix(out);
-		GenerateFractal(out);
+		out->scale = PickScale(width, height);
+		out->size = 1 << out->scale;
+		out->mask = out->size - 1;
+		out->blocks = out->size / RANGEFRAC_BLOCK;
+		out->finestmip = options->lazy ? RANGEFRAC_BLOCK_SCALE : 0;
+		out->threads = options->threads;
+		if(out->threads < 1) out->threads = 1;
+		if(out->threads > MAX_RANGEFRAC_THREADS) out->threads = MAX_RANGEFRAC_THREADS;
+		out->ready = NULL;
+		for(level = 0; level <= MAX_VALMATRIX_SCALE; level++)
+			{
+			out->lomip[level] = out->himip[level] = NULL;
+			}
+		out->data = (float*)malloc(out->size * out->size * sizeof(float));
+		if(options->lazy && out->data)
+			{
+			out->ready = (unsigned char*)malloc(out->blocks * out->blocks);
+			if(out->ready)
+				{
+				for(ctr = 0; ctr < out->blocks * out->blocks; ctr++) out->ready[ctr] = 0;
+				#if STARFISH_THREADS
+				pthread_mutex_init(&out->lock, NULL);
+				#endif
+				}
+			else
+				{
+				free(out->data);
+				out->data = NULL;
+				}
+			}
+		if(out->data && AllocateMips(out))
+			{
+			//The draws for the whole matrix come out of the stream now, whenever they are used.
+			out->seed = rng->seed;
+			out->firstdraw = rng->counter;
+			GenerateFractal(out, rng);
+			rng->counter = out->firstdraw + (uint64_t)out->size * out->size;
+			if(out->ready) FillLazyCells(out);
+			else FinishBlocks(out);
+			FillMips(out);
+			}
+		else
+			{
+			RangefracExit(out);
+			out = NULL;
+			}
 		}
 	return out;
 	}
 
 void RangefracExit(void* refcon)
 	{
-	if(refcon) free(refcon);
+	RangefracGlobals* glb = (RangefracGlobals*)refcon;
+	int level;
+	if(glb)
+		{
+		//Level 0 of the mips is the matrix, which we free separately.
+		for(level = 1; level <= MAX_VALMATRIX_SCALE; level++)
+			{
+			if(glb->lomip[level]) free(glb->lomip[level]);
+			if(glb->himip[level]) free(glb->himip[level]);
+			}
+		if(glb->ready)
+			{
+			#if STARFISH_THREADS
+			pthread_mutex_destroy(&glb->lock);
+			#endif
+			free(glb->ready);
+			}
+		if(glb->data) free(glb->data);
+		free(glb);
+		}
 	}
 
 float Rangefrac(float h, float v, void* refcon)
@@ -115,29 +257,30 @@ float Rangefrac(float h, float v, void* refcon)
 		*/
 		totalweight = 0;
 		totalsum = 0;
-		tweaker = 0.5 / VALMATRIX_SIZE;
-		smallH = floor(h * VALMATRIX_SIZE - tweaker);
-		smallV = floor(v * VALMATRIX_SIZE - tweaker);
+		tweaker = 0.5 / glb->size;
+		smallH = floor(h * glb->size - tweaker);
+		smallV = floor(v * glb->size - tweaker);
 		bigH = smallH + 1;
 		bigV = smallV + 1;
+		if(glb->ready) NeedBlocks(glb, smallH, bigH, smallV, bigV);
 		//TOPLEFT
 		localval = GetMatrixVal(smallH, smallV, glb);
-		localweight = CalcWeight(smallH, smallV, h, v);
+		localweight = CalcWeight(smallH, smallV, h, v, glb);
 		totalsum += (localval * localweight);
 		totalweight += localweight;
 		//TOPRIGHT
 		localval = GetMatrixVal(bigH, smallV, glb);
-		localweight = CalcWeight(bigH, smallV, h, v);
+		localweight = CalcWeight(bigH, smallV, h, v, glb);
 		totalsum += (localval * localweight);
 		totalweight += localweight;
 		//BOTLEFT
 		localval = GetMatrixVal(smallH, bigV, glb);
-		localweight = CalcWeight(smallH, bigV, h, v);
+		localweight = CalcWeight(smallH, bigV, h, v, glb);
 		totalsum += (localval * localweight);
 		totalweight += localweight;
 		//BOTRIGHT
 		localval = GetMatrixVal(bigH, bigV, glb);
-		localweight = CalcWeight(bigH, bigV, h, v);
+		localweight = CalcWeight(bigH, bigV, h, v, glb);
 		totalsum += (localval * localweight);
 		totalweight += localweight;
 		//TAKE AVERAGE
@@ -146,23 +289,103 @@ float Rangefrac(float h, float v, void* refcon)
 	return out;
 	}
 
-void ClearMatrix(RangefracGlobals* out)
+void RangefracSpan(const float* h, float v, int count, void* refcon, float* out)
 	{
 	/*
-	Clear out all the flags in the matrix.
-	This makes sure we don't accidentally use garbage data.
+	Rangefrac for a whole row of points. The two rows of the matrix we
+	blend between, and how far each of them is from the row of points
+	vertically, are the same all along the row, so we only work them out
+	once. The arithmetic is otherwise exactly that of Rangefrac.
 	*/
-	int h, v;
-	for(v = 0; v < VALMATRIX_SIZE; v++)
+	int smallH, smallV, bigH, bigV, ctr, mask;
+	float tweaker, smalldistV, bigdistV, fsize;
+	float totalweight, totalsum;
+	float localval, localweight;
+	const float* smallrow;
+	const float* bigrow;
+	RangefracGlobals* glb = (RangefracGlobals*)refcon;
+	if(!glb)
 		{
-		for(h = 0; h < VALMATRIX_SIZE; h++)
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0.0;
+		return;
+		}
+	mask = glb->mask;
+	fsize = glb->size;
+	tweaker = 0.5 / glb->size;
+	smallV = floor(v * glb->size - tweaker);
+	bigV = smallV + 1;
+	smalldistV = smallV - (v * glb->size);
+	bigdistV = bigV - (v * glb->size);
+	if(glb->ready && count > 0)
+		{
+		//Finish every block the row can touch before we start.
+		int firstH, lastH;
+		firstH = lastH = floor(h[0] * fsize - tweaker);
+		for(ctr = 1; ctr < count; ctr++)
 			{
-			out->level[h][v] = 0;
+			smallH = floor(h[ctr] * fsize - tweaker);
+			if(smallH < firstH) firstH = smallH;
+			if(smallH > lastH) lastH = smallH;
 			}
+		NeedBlocks(glb, firstH, lastH + 1, smallV, bigV);
+		}
+	//The matrix is stored a row at a time, so both rows we need are runs of memory.
+	smallrow = &glb->data[(smallV & mask) * glb->size];
+	bigrow = &glb->data[(bigV & mask) * glb->size];
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		smallH = floor(h[ctr] * fsize - tweaker);
+		bigH = smallH + 1;
+		totalweight = 0;
+		totalsum = 0;
+		//TOPLEFT
+		localval = smallrow[smallH & mask];
+		localweight = RowWeight(smallH - (h[ctr] * fsize), smalldistV);
+		totalsum += (localval * localweight);
+		totalweight += localweight;
+		//TOPRIGHT
+		localval = smallrow[bigH & mask];
+		localweight = RowWeight(bigH - (h[ctr] * fsize), smalldistV);
+		totalsum += (localval * localweight);
+		totalweight += localweight;
+		//BOTLEFT
+		localval = bigrow[smallH & mask];
+		localweight = RowWeight(smallH - (h[ctr] * fsize), bigdistV);
+		totalsum += (localval * localweight);
+		totalweight += localweight;
+		//BOTRIGHT
+		localval = bigrow[bigH & mask];
+		localweight = RowWeight(bigH - (h[ctr] * fsize), bigdistV);
+		totalsum += (localval * localweight);
+		totalweight += localweight;
+		//TAKE AVERAGE
+		out[ctr] = totalsum / totalweight;
 		}
 	}
 
-void GenerateFractal(RangefracGlobals* out)
+static float RowWeight(float distH, float distV)
+	{
+	//CalcWeight, for distances that have already been worked out.
+	float out;
+	out = 1 - genhypotf(distH, distV);
+	if(out < 0.0) out = 0.0;
+	return out;
+	}
+
+static int PickScale(int width, int height)
+	{
+	/*
+	Find the smallest matrix with a point for every few pixels along the
+	longer side of the layer, within the limits.
+	*/
+	int longest, scale;
+	longest = (width > height) ? width : height;
+	scale = MIN_VALMATRIX_SCALE;
+	while(scale < MAX_VALMATRIX_SCALE && (RANGEFRAC_PIXELS_PER_POINT << scale) < longest) scale++;
+	return scale;
+	}
+
+static void GenerateFractal(RangefracGlobals* out, RandRef rng)
 	{
 	/*
 	Walk through the matrix.
@@ -170,80 +393,97 @@ void GenerateFractal(RangefracGlobals* out)
 	of higher level than current, compare its value against the current
 	min and max. If the neighboring point exceeds min or max, use its
 	value as the new min or max. Repeat.
+	Each pass works on a grid twice as fine as the one before, and visits
+	its points in the same order whatever the size of the matrix. So the
+	first passes draw exactly the same random numbers for the same places
+	in a big matrix as in a small one, and a big matrix holds the same
+	pattern with more detail in between.
+	We only do the coarse passes here, down to a point every
+	RANGEFRAC_BLOCK points. FinishBlock does the rest.
 	*/
-	int h, v;
+	int h, v, size, mask;
 	int step;
-	for(step = VALMATRIX_SIZE / 2; step > 0; step /= 2)
+	float* data = out->data;
+	size = out->size;
+	mask = out->mask;
+	for(step = size / 2; step >= RANGEFRAC_BLOCK; step /= 2)
 		{
-		for(v = 0; v < VALMATRIX_SIZE; v += step)
+		for(v = 0; v < size; v += step)
 			{
-			for(h = 0; h < VALMATRIX_SIZE; h += step)
+			int above = ((v - step) & mask) * size;
+			int here = v * size;
+			int below = ((v + step) & mask) * size;
+			int vabove = (v - step) & mask;
+			int vbelow = (v + step) & mask;
+			for(h = 0; h < size; h += step)
 				{
 				float max, min, val;
+				int left = (h - step) & mask;
+				int right = (h + step) & mask;
 				//See if we need to calculate this pixel at all.
-				if(out->level[h][v] < step)
+				if(PointLevel(h, v, out) == step)
 					{
 					//Go hunting for the highest and lowest values among this pixel's neighbors.
 					max = 0.0;
 					min = 1.0;
 					//Top left
-					if(out->level[WrapH(h - step)][WrapV(v - step)] > step)
+					if(PointLevel(left, vabove, out) > step)
 						{
-						val = out->data[WrapH(h - step)][WrapV(v - step)];
+						val = data[above + left];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Top
-					if(out->level[h][WrapV(v - step)] > step)
+					if(PointLevel(h, vabove, out) > step)
 						{
-						val = out->data[h][WrapV(v - step)];
+						val = data[above + h];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Top right
-					if(out->level[WrapH(h + step)][WrapV(v - step)] > step)
+					if(PointLevel(right, vabove, out) > step)
 						{
-						val = out->data[WrapH(h + step)][WrapV(v - step)];
+						val = data[above + right];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Left
-					if(out->level[WrapH(h - step)][v] > step)
+					if(PointLevel(left, v, out) > step)
 						{
-						val = out->data[WrapH(h - step)][v];
+						val = data[here + left];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Right
-					if(out->level[WrapH(h + step)][v] > step)
+					if(PointLevel(right, v, out) > step)
 						{
-						val = out->data[WrapH(h + step)][v];
+						val = data[here + right];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Bottom left
-					if(out->level[WrapH(h - step)][WrapV(v + step)] > step)
+					if(PointLevel(left, vbelow, out) > step)
 						{
-						val = out->data[WrapH(h - step)][WrapV(v + step)];
+						val = data[below + left];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Bottom
-					if(out->level[h][WrapV(v + step)] > step)
+					if(PointLevel(h, vbelow, out) > step)
 						{
-						val = out->data[h][WrapV(v + step)];
+						val = data[below + h];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
 					//Bottom right
-					if(out->level[WrapH(h + step)][WrapV(v + step)] > step)
+					if(PointLevel(right, vbelow, out) > step)
 						{
-						val = out->data[WrapH(h + step)][WrapV(v + step)];
+						val = data[below + right];
 						if(val < min) min = val;
 						if(val > max) max = val;
 						}
-					val = frand(max - min) + min;
-					if(step >= VALMATRIX_SIZE / 2)
+					val = frand(rng, max - min) + min;
+					if(step >= size / 2)
 						{
 						/*
 						The first pieces of data are always picked completely at random,
@@ -258,44 +498,399 @@ void GenerateFractal(RangefracGlobals* out)
 						valint = (val > 0.5) ? 1 : 0;
 						val = (valint + val) / 2.0;
 						}
-					out->data[h][v] = val;
-					out->level[h][v] = step;
+					data[here + h] = val;
 					}
 				}
 			}
 		}
 	}
 
-float CalcDistance(int matrixh, int matrixv, float desth, float destv)
+static void FinishBlocks(RangefracGlobals* out)
+	{
+	/*
+	Finish every block of the matrix, sharing them out among as many
+	threads as we have been allowed. The blocks don't depend on each
+	other, and each point's random draw is fixed by its position, so the
+	matrix comes out the same however many threads there are.
+	*/
+	int ctr;
+	#if STARFISH_THREADS
+	RangefracWork work[MAX_RANGEFRAC_THREADS];
+	pthread_t workers[MAX_RANGEFRAC_THREADS];
+	int threads, started;
+	//The smallest matrices are done before the threads would get going.
+	threads = (out->scale > MIN_VALMATRIX_SCALE) ? out->threads : 1;
+	if(threads > out->blocks * out->blocks) threads = out->blocks * out->blocks;
+	if(threads > 1)
+		{
+		for(ctr = 0; ctr < threads; ctr++)
+			{
+			work[ctr].glb = out;
+			work[ctr].first = ctr;
+			work[ctr].stride = threads;
+			}
+		//If a thread won't start, the calling thread does its share.
+		for(started = 1; started < threads; started++)
+			{
+			if(pthread_create(&workers[started], NULL, FinishBlocksWorker, &work[started])) break;
+			}
+		for(ctr = started; ctr < threads; ctr++) FinishBlocksWorker(&work[ctr]);
+		FinishBlocksWorker(&work[0]);
+		while(started > 1) pthread_join(workers[--started], NULL);
+		return;
+		}
+	#endif
+	for(ctr = 0; ctr < out->blocks * out->blocks; ctr++)
+		{
+		FinishBlock(out, ctr % out->blocks, ctr / out->blocks);
+		}
+	}
+
+#if STARFISH_THREADS
+static void* FinishBlocksWorker(void* refcon)
 	{
-	return hypotf(matrixh - (desth * VALMATRIX_SIZE),
-		    matrixv - (destv * VALMATRIX_SIZE));
+	RangefracWork* work = (RangefracWork*)refcon;
+	int ctr, blocks;
+	blocks = work->glb->blocks;
+	for(ctr = work->first; ctr < blocks * blocks; ctr += work->stride)
+		{
+		FinishBlock(work->glb, ctr % blocks, ctr / blocks);
+		}
+	return NULL;
 	}
+#endif
 
-float CalcWeight(int matrixh, int matrixv, float desth, float destv)
+static void FinishBlock(RangefracGlobals* glb, int blockh, int blockv)
 	{
-	float out;
-	out = 1 - CalcDistance(matrixh, matrixv, desth, destv);
-	if(out < 0.0) out = 0.0;
-	return out;
+	/*
+	Run the fine passes of the fractal over one block. On the grid of each
+	pass, a new point's neighbours on coarser grids - the only ones whose
+	range counts - are easy to name: the points either side of it, if it
+	is on an old row; the points above and below it, if it is in an old
+	column; otherwise the four diagonal ones. None of them is ever outside
+	the block, counting its far edges, so we work on a copy of the block
+	and its far edges, starting from its corners on the coarse grid, and
+	only write the block itself back. Its neighbours' edges are theirs to
+	write, and come out the same whoever works them out.
+	*/
+	float work[(RANGEFRAC_BLOCK + 1) * (RANGEFRAC_BLOCK + 1)];
+	const int stride = RANGEFRAC_BLOCK + 1;
+	int shift, step, grid, points, across, down, gridh, gridv, h, v, x;
+	uint64_t rowdraw;
+	float* row;
+	const float* above;
+	const float* below;
+	float min, max;
+	int left = blockh * RANGEFRAC_BLOCK;
+	int top = blockv * RANGEFRAC_BLOCK;
+	//The corners come from the coarse grid.
+	for(v = 0; v <= RANGEFRAC_BLOCK; v += RANGEFRAC_BLOCK)
+		{
+		for(h = 0; h <= RANGEFRAC_BLOCK; h += RANGEFRAC_BLOCK)
+			{
+			work[v * stride + h] = GetMatrixVal(left + h, top + v, glb);
+			}
+		}
+	for(shift = RANGEFRAC_BLOCK_SCALE - 1; shift >= 0; shift--)
+		{
+		step = 1 << shift;
+		grid = glb->size >> shift;
+		points = RANGEFRAC_BLOCK >> shift;
+		for(down = 0; down <= points; down++)
+			{
+			//Work out where this row's draws start, as DrawPoint explains.
+			gridv = ((top >> shift) + down) & (grid - 1);
+			rowdraw = (uint64_t)(grid / 2) * (grid / 2);
+			rowdraw += (uint64_t)((gridv + 1) / 2) * (grid / 2) + (uint64_t)(gridv / 2) * grid;
+			row = &work[(down << shift) * stride];
+			above = row - step * stride;
+			below = row + step * stride;
+			//Old rows only get new points between the old ones.
+			for(across = (down & 1) ? 0 : 1; across <= points; across += (down & 1) ? 1 : 2)
+				{
+				gridh = ((left >> shift) + across) & (grid - 1);
+				x = across << shift;
+				max = 0.0;
+				min = 1.0;
+				if(!(down & 1))
+					{
+					GrowRange(row[x - step], &min, &max);
+					GrowRange(row[x + step], &min, &max);
+					row[x] = DrawPoint(glb, rowdraw + gridh / 2, min, max);
+					}
+				else if(!(across & 1))
+					{
+					GrowRange(above[x], &min, &max);
+					GrowRange(below[x], &min, &max);
+					row[x] = DrawPoint(glb, rowdraw + gridh, min, max);
+					}
+				else
+					{
+					GrowRange(above[x - step], &min, &max);
+					GrowRange(above[x + step], &min, &max);
+					GrowRange(below[x - step], &min, &max);
+					GrowRange(below[x + step], &min, &max);
+					row[x] = DrawPoint(glb, rowdraw + gridh, min, max);
+					}
+				}
+			}
+		}
+	for(v = 0; v < RANGEFRAC_BLOCK; v++)
+		{
+		for(h = 0; h < RANGEFRAC_BLOCK; h++)
+			{
+			glb->data[(top + v) * glb->size + left + h] = work[v * stride + h];
+			}
+		}
+	}
+
+static void NeedBlocks(RangefracGlobals* glb, int firstH, int lastH, int firstV, int lastV)
+	{
+	//Make sure every block holding a point from firstH, firstV to lastH, lastV is finished.
+	int blockh, blockv, firstblockh, lastblockh, firstblockv, lastblockv;
+	if(lastH - firstH >= glb->size)
+		{
+		firstH = 0;
+		lastH = glb->mask;
+		}
+	if(lastV - firstV >= glb->size)
+		{
+		firstV = 0;
+		lastV = glb->mask;
+		}
+	//Shift from wrapped, never negative, coordinates.
+	firstblockh = (firstH & glb->mask) >> RANGEFRAC_BLOCK_SCALE;
+	lastblockh = firstblockh + (((firstH & (RANGEFRAC_BLOCK - 1)) + lastH - firstH) >> RANGEFRAC_BLOCK_SCALE);
+	firstblockv = (firstV & glb->mask) >> RANGEFRAC_BLOCK_SCALE;
+	lastblockv = firstblockv + (((firstV & (RANGEFRAC_BLOCK - 1)) + lastV - firstV) >> RANGEFRAC_BLOCK_SCALE);
+	for(blockv = firstblockv; blockv <= lastblockv; blockv++)
+		{
+		for(blockh = firstblockh; blockh <= lastblockh; blockh++)
+			{
+			NeedBlock(glb, blockh % glb->blocks, blockv % glb->blocks);
+			}
+		}
+	}
+
+static void NeedBlock(RangefracGlobals* glb, int blockh, int blockv)
+	{
+	/*
+	Finish a block of a lazy matrix, unless it already is. Other threads
+	may be reading finished blocks while we work, so the flag only goes up
+	once the block is written, and a thread which sees it up sees the block.
+	*/
+	unsigned char* ready = &glb->ready[blockv * glb->blocks + blockh];
+	#if STARFISH_THREADS
+	if(__atomic_load_n(ready, __ATOMIC_ACQUIRE)) return;
+	pthread_mutex_lock(&glb->lock);
+	if(!*ready)
+		{
+		FinishBlock(glb, blockh, blockv);
+		__atomic_store_n(ready, 1, __ATOMIC_RELEASE);
+		}
+	pthread_mutex_unlock(&glb->lock);
+	#else
+	if(!*ready)
+		{
+		FinishBlock(glb, blockh, blockv);
+		*ready = 1;
+		}
+	#endif
+	}
+
+static void GrowRange(float val, float* min, float* max)
+	{
+	if(val < *min) *min = val;
+	if(val > *max) *max = val;
+	}
+
+static float DrawPoint(const RangefracGlobals* glb, uint64_t index, float min, float max)
+	{
+	/*
+	Pick a value between min and max with the random draw GenerateFractal
+	would have used for the point, if it had gone on through every pass
+	in order. Every point on the coarser grids drew first. Then each pass
+	draws once for each of its new points, a row at a time: one for every
+	point on the odd rows of its grid, and every other one on the even
+	rows. The index counts the draws before this point's.
+	*/
+	RandomRec draw;
+	draw.seed = glb->seed;
+	draw.counter = glb->firstdraw + index;
+	return frand(&draw, max - min) + min;
+	}
+
+static int PointLevel(int h, int v, const RangefracGlobals* glb)
+	{
+	/*
+	Which pass of GenerateFractal fills in this point? That is the step of
+	the coarsest grid the point lies on: the lowest bit set in either
+	coordinate. The corner lies on every grid, and belongs to the first.
+	We used to keep a matrix of these, but they are quicker to work out
+	than to look up.
+	*/
+	int bits = h | v;
+	return bits ? (bits & -bits) : glb->size / 2;
+	}
+
+static int AllocateMips(RangefracGlobals* out)
+	{
+	//Make room for the mip levels. Returns false if we ran out of memory.
+	int level, size;
+	if(out->finestmip == 0)
+		{
+		out->lomip[0] = out->himip[0] = out->data;
+		}
+	for(level = (out->finestmip > 1) ? out->finestmip : 1; level <= out->scale; level++)
+		{
+		size = out->size >> level;
+		out->lomip[level] = (float*)malloc(size * size * sizeof(float));
+		out->himip[level] = (float*)malloc(size * size * sizeof(float));
+		if(!out->lomip[level] || !out->himip[level]) return 0;
+		}
+	return 1;
+	}
+
+static void FillMips(RangefracGlobals* out)
+	{
+	//Each cell of a level covers four cells of the level below.
+	int level, size, h, v;
+	const float* lofiner;
+	const float* hifiner;
+	for(level = out->finestmip + 1; level <= out->scale; level++)
+		{
+		size = out->size >> level;
+		lofiner = out->lomip[level - 1];
+		hifiner = out->himip[level - 1];
+		for(v = 0; v < size; v++)
+			{
+			for(h = 0; h < size; h++)
+				{
+				int finer = (v * 2) * (size * 2) + h * 2;
+				float lo, hi;
+				lo = lofiner[finer];
+				if(lofiner[finer + 1] < lo) lo = lofiner[finer + 1];
+				if(lofiner[finer + size * 2] < lo) lo = lofiner[finer + size * 2];
+				if(lofiner[finer + size * 2 + 1] < lo) lo = lofiner[finer + size * 2 + 1];
+				hi = hifiner[finer];
+				if(hifiner[finer + 1] > hi) hi = hifiner[finer + 1];
+				if(hifiner[finer + size * 2] > hi) hi = hifiner[finer + size * 2];
+				if(hifiner[finer + size * 2 + 1] > hi) hi = hifiner[finer + size * 2 + 1];
+				out->lomip[level][v * size + h] = lo;
+				out->himip[level][v * size + h] = hi;
+				}
+			}
+		}
+	}
+
+static void FillLazyCells(RangefracGlobals* out)
+	{
+	/*
+	A lazy matrix's finest mip level has a cell for every block, but only
+	the blocks' corners are known. Every point the fine passes will pick
+	lies between values of coarser neighbours, each nearer to it than the
+	last step was, so all told less than a block away. So the points of a
+	block lie within the range of the corners of its own and its eight
+	neighbouring blocks: a square of four by four corners.
+	*/
+	int blockh, blockv, h, v, size, mask;
+	float lo, hi, val;
+	size = out->size;
+	mask = out->mask;
+	for(blockv = 0; blockv < out->blocks; blockv++)
+		{
+		for(blockh = 0; blockh < out->blocks; blockh++)
+			{
+			lo = 1.0;
+			hi = 0.0;
+			for(v = blockv - 1; v <= blockv + 2; v++)
+				{
+				for(h = blockh - 1; h <= blockh + 2; h++)
+					{
+					val = out->data[((v * RANGEFRAC_BLOCK) & mask) * size + ((h * RANGEFRAC_BLOCK) & mask)];
+					if(val < lo) lo = val;
+					if(val > hi) hi = val;
+					}
+				}
+			out->lomip[out->finestmip][blockv * out->blocks + blockh] = lo;
+			out->himip[out->finestmip][blockv * out->blocks + blockh] = hi;
+			}
+		}
 	}
 
-float GetMatrixVal(int matrixh, int matrixv, RangefracGlobals* glb)
+static float CalcDistance(int matrixh, int matrixv, float desth, float destv, const RangefracGlobals* glb)
 	{
-	return glb->data[WrapH(matrixh)][WrapV(matrixv)];
+	return genhypotf(matrixh - (desth * glb->size),
+		    matrixv - (destv * glb->size));
 	}
 
-int WrapH(int coord)
+static float CalcWeight(int matrixh, int matrixv, float desth, float destv, const RangefracGlobals* glb)
 	{
-	while(coord > VALMATRIX_MAX) coord -= VALMATRIX_SIZE;
-	while(coord < 0) coord += VALMATRIX_SIZE;
-	return coord;
+	float out;
+	out = 1 - CalcDistance(matrixh, matrixv, desth, destv, glb);
+	if(out < 0.0) out = 0.0;
+	return out;
 	}
 
-int WrapV(int coord)
+static float GetMatrixVal(int matrixh, int matrixv, const RangefracGlobals* glb)
 	{
-	while(coord > VALMATRIX_MAX) coord -= VALMATRIX_SIZE;
-	while(coord < 0) coord += VALMATRIX_SIZE;
-	return coord;
+	//The size is a power of two, so masking wraps negative coordinates too.
+	return glb->data[(matrixv & glb->mask) * glb->size + (matrixh & glb->mask)];
+	}
+
+void RangefracBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	Every value is a weighted average of the four matrix points around it,
+	with weights that are never negative. So it can't go outside the range
+	of the matrix points Rangefrac would look at anywhere in the rectangle.
+	For a big rectangle we don't visit every one of those points: we go up
+	the mip levels until the rectangle is only a few dozen cells across,
+	and take the range of every cell it touches. Those cells reach a
+	little past the rectangle, so the bounds may come out a little wider,
+	never narrower. A lazy matrix can't start any finer than its blocks.
+	*/
+	RangefracGlobals* glb = (RangefracGlobals*)refcon;
+	int firstH, firstV, lastH, lastV, h, v, level, extent, cells, cellmask;
+	const float* lomip;
+	const float* himip;
+	float tweaker;
+	*lo = 0.0;
+	*hi = 1.0;
+	if(!glb) return;
+	tweaker = 0.5 / glb->size;
+	firstH = floor(left * glb->size - tweaker);
+	firstV = floor(top * glb->size - tweaker);
+	lastH = floor(right * glb->size - tweaker) + 1;
+	lastV = floor(bottom * glb->size - tweaker) + 1;
+	//A rectangle this big sees the whole matrix anyway.
+	if(lastH - firstH >= glb->size || lastV - firstV >= glb->size)
+		{
+		*lo = glb->lomip[glb->scale][0];
+		*hi = glb->himip[glb->scale][0];
+		return;
+		}
+	//Work from wrapped, never negative, coordinates so we can shift them.
+	lastH = (firstH & glb->mask) + (lastH - firstH);
+	lastV = (firstV & glb->mask) + (lastV - firstV);
+	firstH &= glb->mask;
+	firstV &= glb->mask;
+	extent = (lastH - firstH > lastV - firstV) ? lastH - firstH : lastV - firstV;
+	level = glb->finestmip;
+	while(level < glb->scale && (extent >> level) > RANGEFRAC_BOUNDS_CELLS) level++;
+	cells = glb->size >> level;
+	cellmask = cells - 1;
+	lomip = glb->lomip[level];
+	himip = glb->himip[level];
+	*lo = 1.0;
+	*hi = 0.0;
+	for(v = firstV >> level; v <= lastV >> level; v++)
+		{
+		for(h = firstH >> level; h <= lastH >> level; h++)
+			{
+			int cell = (v & cellmask) * cells + (h & cellmask);
+			if(lomip[cell] < *lo) *lo = lomip[cell];
+			if(himip[cell] > *hi) *hi = himip[cell];
+			}
+		}
 	}
-
\ No newline at end of file
@@ -26,6 +26,20 @@ using existing values as min/max points for intermediate random values.
 
 */
 
-void* RangefracInit(void);
+#include "genutils.h"
+
+void* RangefracInit(int width, int height, RandRef rng, GenOptionsRef options);
 void RangefracExit(void* refcon);
-float Rangefrac(float h, float v, void* refcon);
\ No newline at end of file
+float Rangefrac(float h, float v, void* refcon);
+void RangefracSpan(const float* h, float v, int count, void* refcon, float* out);
+void RangefracBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
+/*
+How new matrices are built, from the layer's options. Big layers get big
+matrices, which take a while to build. The options' thread count shares
+the work out among up to that many threads, up to MAX_RANGEFRAC_THREADS,
+if we were built with STARFISH_THREADS. A lazy layer builds only the
+coarse grid when it is set up, and fills in each part of the fine detail
+the first time a point needs it, so parts of a layer nobody looks at never
+get built. The values come out exactly the same either way.
+*/
+#define MAX_RANGEFRAC_THREADS 64
@@ -0,0 +1,530 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Spectral Generator
+
+The layer is a grid of values, worked out once when the layer is set up,
+and a point's value is read off the grid between its four nearest
+neighbours. The grid comes from a spectrum: every wave with a whole
+number of cycles across the tile, up to a limit set by the size of the
+layer, gets a strength that falls off with its frequency to the power of
+beta, and a random phase. The higher beta, the less the short waves count,
+and the smoother the result. Waves can be stretched along one direction,
+for streaky, windswept patterns. One inverse Fourier transform turns the
+spectrum into the grid. Every wave repeats exactly across the tile, so the
+grid wraps around by itself.
+
+The transform is the plain radix-2 kind, done in place, a pass at a time:
+first down the columns, a few columns side by side so that every step
+works on whole cache lines; then the grid is turned on its side, a tile
+at a time, and the columns - which were the rows - get the same again.
+Columns and tiles don't depend on each other, so each pass can be shared
+out among threads.
+
+Each wave's strength and phase are drawn from the random stream by its
+frequency, not by the order we come to it in, so the long waves are the
+same whatever size of grid the layer gets, and however many threads work
+on it.
+
+*/
+
+#include "spectral-gen.h"
+#include "genutils.h"
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef STARFISH_THREADS
+#define STARFISH_THREADS 0
+#endif
+#if STARFISH_THREADS
+#include <pthread.h>
+#endif
+
+/*
+The grid is 1<<scale points on a side, with a point every
+SPECTRAL_PIXELS_PER_POINT pixels across the layer, but never fewer than
+MIN_SPECTRAL_SCALE or more than MAX_SPECTRAL_SCALE, which takes 32
+megabytes while it is being built and 16 after. The shortest waves are
+SPECTRAL_PIXELS_PER_WAVE pixels long, so the layer doesn't need
+supersampling, and always fit between two grid points.
+*/
+#define MIN_SPECTRAL_SCALE 7
+#define MAX_SPECTRAL_SCALE 11
+#define SPECTRAL_PIXELS_PER_POINT 4
+#define SPECTRAL_PIXELS_PER_WAVE 8
+//Strength falls off with frequency to the power of half of beta.
+#define MIN_SPECTRAL_BETA 2.0
+#define MAX_SPECTRAL_BETA 4.0
+#define MAX_SPECTRAL_STRETCH 3.0
+/*
+The column passes work on this many columns side by side; sixteen floats
+make a cache line. The grid is turned on its side in square tiles this
+many points across.
+*/
+#define SPECTRAL_FFT_COLUMNS 16
+#define SPECTRAL_TILE 32
+
+typedef struct SpectralGlobals
+	{
+	int scale;			//the grid is 1<<scale points on a side
+	int size;
+	int mask;			//size - 1; wraps a grid coordinate around the tile
+	float* data;		//size * size values, one row after another
+	}
+SpectralGlobals;
+typedef SpectralGlobals* SpectralRef;
+
+//Everything the passes of the transform need, while the grid is being built.
+typedef struct SpectralBuild
+	{
+	SpectralRef glb;
+	float* re;			//the grid, real and imaginary parts
+	float* im;
+	float* twiddlere;	//the size / 2 roots of unity the butterflies use
+	float* twiddleim;
+	int* reversed;		//each row number with its bits in reverse order
+	int threads;		//how many threads RunPass may share each pass among
+	//The spectrum.
+	uint64_t seed;
+	int cutoff;			//no wave has more cycles across the tile than this
+	float beta;
+	float stretch;
+	float stretchcos, stretchsin;
+	}
+SpectralBuild;
+
+enum spectralpasses
+	{
+	spectralFillPass,
+	spectralColumnPass,
+	spectralTurnPass
+	};
+
+#if STARFISH_THREADS
+//Some of the work of a pass, for one worker thread to do.
+typedef struct SpectralWork
+	{
+	SpectralBuild* build;
+	int pass;
+	int first;
+	int stride;
+	}
+SpectralWork;
+#endif
+
+static int PickScale(int width, int height);
+static int BuildGrid(SpectralRef out, SpectralBuild* build);
+static void RunPass(SpectralBuild* build, int pass);
+#if STARFISH_THREADS
+static void* RunPassWorker(void* refcon);
+#endif
+static int PassUnits(SpectralBuild* build, int pass);
+static void DoPassUnit(SpectralBuild* build, int pass, int unit);
+static void FillSpectrumRow(SpectralBuild* build, int row);
+static void InverseFFTColumns(SpectralBuild* build, int first, int width);
+static void TurnTileRow(float* grid, int size, int tilerow);
+static void SpectralRow(const float* h, float v, int count, SpectralRef it, float* out);
+
+void* SpectralInit(int width, int height, RandRef rng, GenOptionsRef options)
+	{
+	/*
+	Pick the shape of the spectrum, then build the grid. Streaks are not
+	for everyone, so only half the layers get them.
+	*/
+	SpectralRef out = (SpectralRef)malloc(sizeof(SpectralGlobals));
+	if(out)
+		{
+		SpectralBuild build;
+		double angle;
+		int widest;
+		out->scale = PickScale(width, height);
+		out->size = 1 << out->scale;
+		out->mask = out->size - 1;
+		build.glb = out;
+		build.threads = options->threads;
+		if(build.threads < 1) build.threads = 1;
+		if(build.threads > MAX_SPECTRAL_THREADS) build.threads = MAX_SPECTRAL_THREADS;
+		build.seed = RandomSeed(rng);
+		build.beta = frandge(rng, MIN_SPECTRAL_BETA, MAX_SPECTRAL_BETA);
+		build.stretch = maybe(rng) ? frandge(rng, 1.0, MAX_SPECTRAL_STRETCH) : 1.0;
+		angle = frand(rng, pi);
+		build.stretchcos = cos(angle);
+		build.stretchsin = sin(angle);
+		widest = (width > height) ? width : height;
+		build.cutoff = widest / SPECTRAL_PIXELS_PER_WAVE;
+		if(build.cutoff > out->size / 2 - 1) build.cutoff = out->size / 2 - 1;
+		if(build.cutoff < 1) build.cutoff = 1;
+		if(!BuildGrid(out, &build))
+			{
+			free(out);
+			return NULL;
+			}
+		}
+	return out;
+	}
+
+void SpectralExit(void* refcon)
+	{
+	SpectralRef it = (SpectralRef)refcon;
+	if(it)
+		{
+		free(it->data);
+		free(it);
+		}
+	}
+
+float Spectral(float h, float v, void* refcon)
+	{
+	//One point is just a very short row.
+	float out;
+	SpectralSpan(&h, v, 1, refcon, &out);
+	return out;
+	}
+
+void SpectralSpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	int ctr;
+	if(!refcon)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0;
+		return;
+		}
+	SpectralRow(h, v, count, (SpectralRef)refcon, out);
+	}
+
+static void SpectralRow(const float* h, float v, int count, SpectralRef it, float* out)
+	{
+	/*
+	Read a row of points off the grid, blending the four grid points around
+	each. The two rows of grid points, and how far the row is between them,
+	are the same all the way along. Grid coordinates wrap around, so a
+	point on one edge of the tile and its twin on the other read the same
+	grid points with the same weights.
+	*/
+	const float* above;
+	const float* below;
+	float pos, frach, fracv, top, bottom;
+	int ctr, row, col, left, right;
+	pos = v * it->size;
+	row = (int)floor(pos);
+	fracv = pos - row;
+	above = &it->data[(row & it->mask) * it->size];
+	below = &it->data[((row + 1) & it->mask) * it->size];
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		pos = h[ctr] * it->size;
+		col = (int)floor(pos);
+		frach = pos - col;
+		left = col & it->mask;
+		right = (col + 1) & it->mask;
+		top = above[left] + frach * (above[right] - above[left]);
+		bottom = below[left] + frach * (below[right] - below[left]);
+		out[ctr] = top + fracv * (bottom - top);
+		}
+	}
+
+static int PickScale(int width, int height)
+	{
+	//The smallest grid with a point for every SPECTRAL_PIXELS_PER_POINT pixels across the layer.
+	int widest, scale;
+	widest = (width > height) ? width : height;
+	for(scale = MIN_SPECTRAL_SCALE; scale < MAX_SPECTRAL_SCALE; scale++)
+		{
+		if((1 << scale) * SPECTRAL_PIXELS_PER_POINT >= widest) break;
+		}
+	return scale;
+	}
+
+static int BuildGrid(SpectralRef out, SpectralBuild* build)
+	{
+	/*
+	Fill in the spectrum, transform it, and squeeze what comes out into
+	0..1. We only keep the real part. The spectrum goes in on its side -
+	the first grid coordinate is the horizontal frequency - because the
+	transform turns the grid over once along the way, and we want the
+	result the right way up. Returns zero if we ran out of memory.
+	*/
+	int size = out->size;
+	int ctr, bit;
+	float lo, hi, range;
+	double angle;
+	build->re = (float*)malloc(size * size * sizeof(float));
+	build->im = (float*)malloc(size * size * sizeof(float));
+	build->twiddlere = (float*)malloc(size / 2 * sizeof(float));
+	build->twiddleim = (float*)malloc(size / 2 * sizeof(float));
+	build->reversed = (int*)malloc(size * sizeof(int));
+	if(!build->re || !build->im || !build->twiddlere || !build->twiddleim || !build->reversed)
+		{
+		free(build->re);
+		free(build->im);
+		free(build->twiddlere);
+		free(build->twiddleim);
+		free(build->reversed);
+		return 0;
+		}
+	for(ctr = 0; ctr < size / 2; ctr++)
+		{
+		angle = 2.0 * pi * ctr / size;
+		build->twiddlere[ctr] = cos(angle);
+		build->twiddleim[ctr] = sin(angle);
+		}
+	for(ctr = 0; ctr < size; ctr++)
+		{
+		build->reversed[ctr] = 0;
+		for(bit = 0; bit < out->scale; bit++)
+			{
+			if(ctr & (1 << bit)) build->reversed[ctr] |= 1 << (out->scale - 1 - bit);
+			}
+		}
+	RunPass(build, spectralFillPass);
+	RunPass(build, spectralColumnPass);
+	RunPass(build, spectralTurnPass);
+	RunPass(build, spectralColumnPass);
+	free(build->im);
+	free(build->twiddlere);
+	free(build->twiddleim);
+	free(build->reversed);
+	out->data = build->re;
+	lo = hi = out->data[0];
+	for(ctr = 1; ctr < size * size; ctr++)
+		{
+		if(out->data[ctr] < lo) lo = out->data[ctr];
+		if(out->data[ctr] > hi) hi = out->data[ctr];
+		}
+	range = hi - lo;
+	for(ctr = 0; ctr < size * size; ctr++)
+		{
+		out->data[ctr] = (range > 0) ? (out->data[ctr] - lo) / range : 0.5;
+		}
+	return 1;
+	}
+
+static void RunPass(SpectralBuild* build, int pass)
+	{
+	/*
+	Do one pass of the build, sharing its units of work out among as many
+	threads as we have been allowed. Every unit comes out the same whoever
+	does it, so the grid does too.
+	*/
+	int units, ctr;
+	#if STARFISH_THREADS
+	SpectralWork work[MAX_SPECTRAL_THREADS];
+	pthread_t workers[MAX_SPECTRAL_THREADS];
+	int threads, started;
+	#endif
+	units = PassUnits(build, pass);
+	#if STARFISH_THREADS
+	//The smallest grids are done before the threads would get going.
+	threads = (build->glb->scale > MIN_SPECTRAL_SCALE) ? build->threads : 1;
+	if(threads > units) threads = units;
+	if(threads > 1)
+		{
+		for(ctr = 0; ctr < threads; ctr++)
+			{
+			work[ctr].build = build;
+			work[ctr].pass = pass;
+			work[ctr].first = ctr;
+			work[ctr].stride = threads;
+			}
+		//If a thread won't start, the calling thread does its share.
+		for(started = 1; started < threads; started++)
+			{
+			if(pthread_create(&workers[started], NULL, RunPassWorker, &work[started])) break;
+			}
+		for(ctr = started; ctr < threads; ctr++) RunPassWorker(&work[ctr]);
+		RunPassWorker(&work[0]);
+		while(started > 1) pthread_join(workers[--started], NULL);
+		return;
+		}
+	#endif
+	for(ctr = 0; ctr < units; ctr++) DoPassUnit(build, pass, ctr);
+	}
+
+#if STARFISH_THREADS
+static void* RunPassWorker(void* refcon)
+	{
+	SpectralWork* work = (SpectralWork*)refcon;
+	int ctr, units;
+	units = PassUnits(work->build, work->pass);
+	for(ctr = work->first; ctr < units; ctr += work->stride)
+		{
+		DoPassUnit(work->build, work->pass, ctr);
+		}
+	return NULL;
+	}
+#endif
+
+static int PassUnits(SpectralBuild* build, int pass)
+	{
+	//How many independent pieces of work a pass comes in.
+	int size = build->glb->size;
+	switch(pass)
+		{
+		case spectralFillPass:
+			return size;
+		case spectralColumnPass:
+			return size / SPECTRAL_FFT_COLUMNS;
+		case spectralTurnPass:
+		default:
+			return size / SPECTRAL_TILE;
+		}
+	}
+
+static void DoPassUnit(SpectralBuild* build, int pass, int unit)
+	{
+	switch(pass)
+		{
+		case spectralFillPass:
+			FillSpectrumRow(build, unit);
+			break;
+		case spectralColumnPass:
+			InverseFFTColumns(build, unit * SPECTRAL_FFT_COLUMNS, SPECTRAL_FFT_COLUMNS);
+			break;
+		case spectralTurnPass:
+			TurnTileRow(build->re, build->glb->size, unit);
+			TurnTileRow(build->im, build->glb->size, unit);
+			break;
+		}
+	}
+
+static void FillSpectrumRow(SpectralBuild* build, int row)
+	{
+	/*
+	Give every wave in this row of the spectrum its strength and phase. Grid
+	coordinates past the middle stand for negative frequencies. The wave
+	gets two draws, picked out of the layer's stream by its frequency, and
+	turns them into a normally distributed complex number (Box and Muller's
+	way), which we scale by the strength. Waves past the cutoff, and the
+	constant term, get nothing. Stretching squeezes the frequencies along
+	one direction before they are measured, so waves that way are stronger.
+	*/
+	RandomRec draw;
+	int size = build->glb->size;
+	float* re = &build->re[row * size];
+	float* im = &build->im[row * size];
+	int col, freqh, freqv;
+	double along, across, measure, strength, radius, angle;
+	freqh = (row < size / 2) ? row : row - size;
+	for(col = 0; col < size; col++)
+		{
+		freqv = (col < size / 2) ? col : col - size;
+		if((!freqh && !freqv) || freqh * freqh + freqv * freqv > build->cutoff * build->cutoff)
+			{
+			re[col] = im[col] = 0;
+			continue;
+			}
+		along = (freqh * build->stretchcos + freqv * build->stretchsin) * build->stretch;
+		across = (freqv * build->stretchcos - freqh * build->stretchsin) / build->stretch;
+		measure = along * along + across * across;
+		strength = pow(measure, -build->beta / 4.0);
+		draw.seed = build->seed;
+		draw.counter = (((uint64_t)(uint32_t)freqh << 32) | (uint32_t)freqv) << 1;
+		radius = sqrt(-2.0 * log(1.0 - frand(&draw, 1.0)));
+		angle = frand(&draw, 2.0 * pi);
+		re[col] = strength * radius * cos(angle);
+		im[col] = strength * radius * sin(angle);
+		}
+	}
+
+static void InverseFFTColumns(SpectralBuild* build, int first, int width)
+	{
+	/*
+	Transform width columns of the grid, starting with column first, side
+	by side: each step does the same sums for every column, along a short
+	run of neighbouring points in memory. First the rows are shuffled into
+	bit-reversed order; then each stage joins pairs of transforms half as
+	long as its own into one.
+	*/
+	int size = build->glb->size;
+	float* re = build->re + first;
+	float* im = build->im + first;
+	float* rea;
+	float* ima;
+	float* reb;
+	float* imb;
+	float wre, wim, tre, tim, swap;
+	int row, other, half, group, step, pair, col;
+	for(row = 0; row < size; row++)
+		{
+		other = build->reversed[row];
+		if(other <= row) continue;
+		for(col = 0; col < width; col++)
+			{
+			swap = re[row * size + col];
+			re[row * size + col] = re[other * size + col];
+			re[other * size + col] = swap;
+			swap = im[row * size + col];
+			im[row * size + col] = im[other * size + col];
+			im[other * size + col] = swap;
+			}
+		}
+	for(half = 1; half < size; half *= 2)
+		{
+		step = size / (half * 2);
+		for(group = 0; group < size; group += half * 2)
+			{
+			for(pair = 0; pair < half; pair++)
+				{
+				wre = build->twiddlere[pair * step];
+				wim = build->twiddleim[pair * step];
+				rea = &re[(group + pair) * size];
+				ima = &im[(group + pair) * size];
+				reb = &re[(group + pair + half) * size];
+				imb = &im[(group + pair + half) * size];
+				for(col = 0; col < width; col++)
+					{
+					tre = reb[col] * wre - imb[col] * wim;
+					tim = reb[col] * wim + imb[col] * wre;
+					reb[col] = rea[col] - tre;
+					imb[col] = ima[col] - tim;
+					rea[col] += tre;
+					ima[col] += tim;
+					}
+				}
+			}
+		}
+	}
+
+static void TurnTileRow(float* grid, int size, int tilerow)
+	{
+	/*
+	Turn the grid on its side - swap rows for columns - for one row of
+	tiles: each tile from the diagonal rightwards swaps places with its
+	twin below the diagonal, and flips over on the way. Tiles are small
+	enough that both stay in the cache.
+	*/
+	int tilecol, h, v, top, left;
+	float swap;
+	top = tilerow * SPECTRAL_TILE;
+	for(tilecol = tilerow; tilecol < size / SPECTRAL_TILE; tilecol++)
+		{
+		left = tilecol * SPECTRAL_TILE;
+		for(v = 0; v < SPECTRAL_TILE; v++)
+			{
+			//On the diagonal, only swap the half above it with the half below.
+			for(h = (tilecol == tilerow) ? v + 1 : 0; h < SPECTRAL_TILE; h++)
+				{
+				swap = grid[(top + v) * size + left + h];
+				grid[(top + v) * size + left + h] = grid[(left + h) * size + top + v];
+				grid[(left + h) * size + top + v] = swap;
+				}
+			}
+		}
+	}
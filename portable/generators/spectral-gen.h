@@ -0,0 +1,44 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Spectral Generator
+
+Smooth, rolling clouds and hills, made the way a physicist would make a
+random landscape: pick a random strength and phase for every wave that
+fits across the tile a whole number of times, with the long waves strong
+and the short ones weak, and add them all up. Because every wave fits
+the tile, so does the sum.
+
+*/
+
+#include "genutils.h"
+
+void* SpectralInit(int width, int height, RandRef rng, GenOptionsRef options);
+void SpectralExit(void* refcon);
+float Spectral(float h, float v, void* refcon);
+void SpectralSpan(const float* h, float v, int count, void* refcon, float* out);
+/*
+Adding up the waves takes a two-dimensional Fourier transform, which for a
+big layer is worth sharing out. The layer's options' thread count shares
+it among up to that many threads, up to MAX_SPECTRAL_THREADS, if we were
+built with STARFISH_THREADS. The values come out exactly the same however
+many there are.
+*/
+#define MAX_SPECTRAL_THREADS 64
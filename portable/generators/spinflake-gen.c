@@ -75,6 +75,8 @@ enum twirlmethods
 #define MAX_TWIRL 14
 #define MAX_SINEAMP 4.0
 #define MAX_FLORETS 3
+//The most points SpinflakeSpan works on at once.
+#define SPINFLAKE_SPAN_PIECE 64
 
 typedef struct floret
 	{
@@ -91,6 +93,7 @@ typedef struct spinflake
 	{
 	float originH, originV;
 	float radius, squish, twist;
+	float twistcos, twistsin;	//for twisting points without trigonometry
 	int averageflorets;
 	int florets;
 	floret layer[MAX_FLORETS];
@@ -104,51 +107,55 @@ typedef struct SpinflakeGlobals
 	}
 SpinflakeGlobals;
 
-void InitFloret(floret* it);
-void InitSpinflake(spinflake* it);
+void InitFloret(floret* it, RandRef rng);
+void InitSpinflake(spinflake* it, RandRef rng);
 static float calctheta(float h, float v, spinflake* it);
-static float calcwave(float theta, float origindist, floret* it);
-static float chopsin(float theta, floret* glb);
-static float rawpoint(float h, float v, spinflake* glb);
-static float vtiledpoint(float h, float v, SpinflakeGlobals* glb);
+static float twirlangle(float theta, float dist, floret* it);
+static void chopsinrow(const float* theta, int count, floret* it, float* out);
+static void polarrow(const float* h, float v, int count, spinflake* glb, float* origindist, float* pointangle);
+static void rawrow(const float* h, float v, int count, spinflake* glb, float* out);
+static void vblendedrow(const float* h, float v, int count, int vfar, float weight, float farweight, spinflake* glb, float* out);
+static void spanpiece(const float* h, float v, int count, int vfar, float vweight, float vfarweight, spinflake* glb, float* out);
+static void rawbounds(float left, float top, float right, float bottom, spinflake* glb, float* lo, float* hi);
+static float pointfromproportion(float proportiondist);
 
-void InitFloret(floret* it)
+void InitFloret(floret* it, RandRef rng)
 	{
 	/*
 	Pick a random packing method for the sine wave.
 	We have several ways to use the sine function's range to
 	produce a 0..1 value.
 	*/
-	it->sineposmethod = (rand() * MAX_SINEPOS_METHODS) / RAND_MAX;
+	it->sineposmethod = irand(rng, MAX_SINEPOS_METHODS);
 	//If backward is true, we will flip the sine wave over.
-	it->backward = maybe();
+	it->backward = maybe(rng);
 	//Pick a random number of "spines" on the wave, from 1 to 16.
-	it->spines = (rand() * 15 / RAND_MAX) + 1;
+	it->spines = irand(rng, 15) + 1;
 	//All modes but absolute-method require an even number of spines.
 	if(it->sineposmethod != sineAbsoluteMethod && (it->spines & 1)) it->spines++;
 	//Pick a height for the spines, similar to the range of the main radius.
-	it->spineradius = frand(0.5);
+	it->spineradius = frand(rng, 0.5);
 	//Instead of aligning to the Y axis, twirl the flake a bit.
-	it->twirlbase = frand(pi);
+	it->twirlbase = frand(rng, pi);
 	//We use different methods to twirl the flake for unique effects.
-	it->twirlmethod = (rand() * MAX_TWIRL_METHODS) / RAND_MAX;
+	it->twirlmethod = irand(rng, MAX_TWIRL_METHODS);
 	switch(it->twirlmethod)
 		{
 		case twirlNoneMethod:
 			break;
 		case twirlSineMethod:
-			it->twirlspeed = frand(MAX_TWIRL * pi);
-			it->twirlamp = frand(MAX_SINEAMP * 2) - MAX_SINEAMP;
-			it->twirlmod = frand(1.0) - 0.5;
+			it->twirlspeed = frand(rng, MAX_TWIRL * pi);
+			it->twirlamp = frand(rng, MAX_SINEAMP * 2) - MAX_SINEAMP;
+			it->twirlmod = frand(rng, 1.0) - 0.5;
 			break;
 		case twirlCurveMethod:
-			it->twirlspeed = frand(MAX_TWIRL * 2) - MAX_TWIRL;
-			it->twirlamp = frand(MAX_SINEAMP * 2) - MAX_SINEAMP;
+			it->twirlspeed = frand(rng, MAX_TWIRL * 2) - MAX_TWIRL;
+			it->twirlamp = frand(rng, MAX_SINEAMP * 2) - MAX_SINEAMP;
 			break;
 		}
 	}
 
-void InitSpinflake(spinflake* it)
+void InitSpinflake(spinflake* it, RandRef rng)
 	{
 	/*
 	Pick a random location and size for this spinflake.
@@ -157,24 +164,26 @@ void InitSpinflake(spinflake* it)
 	*/
 	int ctr;
 	//Pick somewhere for the flake to radiate from.
-	it->originH = frand(1);
-	it->originV = frand(1);
+	it->originH = frand(rng, 1);
+	it->originV = frand(rng, 1);
 	//Pick a random radius for our main circle.
-	it->radius = frand(0.5);
+	it->radius = frand(rng, 0.5);
 	//Squish it horizontally/vertically a bit. Just a small bit.
-	it->squish = 0.25 + frand(2.75);
-	it->twist = frand(pi);
+	it->squish = 0.25 + frand(rng, 2.75);
+	it->twist = frand(rng, pi);
+	it->twistcos = cos(it->twist);
+	it->twistsin = sin(it->twist);
 	//Flip a coin - should we average out the values of our florets, or merely combine?
-	it->averageflorets = maybe();
+	it->averageflorets = maybe(rng);
 	//Now fill out our florets.
-	it->florets = ((rand() * MAX_FLORETS) / RAND_MAX) + 1;
+	it->florets = (irand(rng, MAX_FLORETS)) + 1;
 	for(ctr = 0; ctr < it->florets; ctr++)
 		{
-		InitFloret(&it->layer[ctr]);
+		InitFloret(&it->layer[ctr], rng);
 		}
 	}
 
-void* SpinflakeInit(void)
+void* SpinflakeInit(int width, int height, RandRef rng, GenOptionsRef options)
 	{
 	/*
 	Create a globals record and fill out all appropriate random values.
@@ -183,7 +192,7 @@ void* SpinflakeInit(void)
 	out = (SpinflakeGlobals*)malloc(sizeof(SpinflakeGlobals));
 	if(out)
 		{
-		InitSpinflake(&out->flake[0]);
+		InitSpinflake(&out->flake[0], rng);
 		}
 	return out;
 	}
@@ -201,128 +210,191 @@ void SpinflakeExit(void* refcon)
 
 float Spinflake(float h, float v, void* refcon)
 	{
+	//One point is just a very short row.
 	float out;
-	SpinflakeGlobals* glb = (SpinflakeGlobals*)refcon;
-	if(glb)
-		{
-		float point, farpoint, weight, farweight;
-		point = vtiledpoint(h, v, glb);
-		if(h > 0.5)
-			{
-			farpoint = vtiledpoint(h - 1.0, v, glb);
-			farweight = (h - 0.5) * 2.0;
-			weight = 1.0 - farweight;
-			out = (point * weight) + (farpoint * farweight);
-			}
-		else
-			{
-			out = point;
-			}
-		}
+	SpinflakeSpan(&h, v, 1, refcon, &out);
 	return out;
 	}
 
-static float chopsin(float theta, floret* glb)
+void SpinflakeSpan(const float* h, float v, int count, void* refcon, float* out)
 	{
-	float out = 0;
-	out = sin(theta);
-	switch(glb->sineposmethod)
+	/*
+	Spinflake for a whole row of points. Whether and how much to blend in
+	the flake from a tile up is the same all along the row, so we work it
+	out once; only the horizontal blend changes from point to point. The
+	row goes through in pieces small enough to keep on the stack.
+	*/
+	SpinflakeGlobals* glb = (SpinflakeGlobals*)refcon;
+	float vweight, vfarweight;
+	int ctr, vfar, piece;
+	if(!glb)
 		{
-		case sineCompressMethod:
-			out = (out + 1.0) / 2.0;
-			break;
-		case sineAbsoluteMethod:
-			out = fabs(out);
-			break;
-		case sineTruncateMethod:
-			if(out < 0) out += 1.0;
-			break;
-		case sineSawbladeMethod:
-			theta = fmod(theta / 4.0, pi / 2.0);
-			if(theta < 0) theta += (pi / 2.0);
-			out = sin(theta);
-			break;
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0.0;
+		return;
 		}
-	if(glb->backward)
+	vfar = (v > 0.5);
+	vfarweight = vfar ? (v - 0.5) * 2.0 : 0.0;
+	vweight = 1.0 - vfarweight;
+	while(count > 0)
 		{
-		out = 1.0 - out;
+		piece = (count < SPINFLAKE_SPAN_PIECE) ? count : SPINFLAKE_SPAN_PIECE;
+		spanpiece(h, v, piece, vfar, vweight, vfarweight, &glb->flake[0], out);
+		h += piece;
+		out += piece;
+		count -= piece;
 		}
-	return out;
 	}
 
-static float vtiledpoint(float h, float v, SpinflakeGlobals* glb)
+static void spanpiece(const float* h, float v, int count, int vfar, float vweight, float vfarweight, spinflake* glb, float* out)
 	{
 	/*
-	Return one data point, seamlessly-fused vertically.
+	Up to SPINFLAKE_SPAN_PIECE points of SpinflakeSpan. Past the middle of
+	the tile each point is blended with its copy a tile to the left. We
+	gather up just those copies and work them out as one more row, rather
+	than one at a time.
 	*/
-	float out;
-	float point, farpoint, weight, farweight, totalweight;
-	point = rawpoint(h, v, &glb->flake[0]);
-	if(v > 0.5)
+	float farh[SPINFLAKE_SPAN_PIECE], farpoint[SPINFLAKE_SPAN_PIECE];
+	int index[SPINFLAKE_SPAN_PIECE];
+	float weight, farweight;
+	int ctr, wrapped;
+	vblendedrow(h, v, count, vfar, vweight, vfarweight, glb, out);
+	wrapped = 0;
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		if(h[ctr] > 0.5)
+			{
+			index[wrapped] = ctr;
+			farh[wrapped] = h[ctr] - 1.0;
+			wrapped++;
+			}
+		}
+	if(!wrapped) return;
+	vblendedrow(farh, v, wrapped, vfar, vweight, vfarweight, glb, farpoint);
+	for(ctr = 0; ctr < wrapped; ctr++)
 		{
-		farpoint = rawpoint(h, v - 1.0, &glb->flake[0]);
-		farweight = (v - 0.5) * 2.0;
+		farweight = (h[index[ctr]] - 0.5) * 2.0;
 		weight = 1.0 - farweight;
-		out = (point * weight) + (farpoint * farweight);
+		out[index[ctr]] = (out[index[ctr]] * weight) + (farpoint[ctr] * farweight);
 		}
-	else
+	}
+
+static void vblendedrow(const float* h, float v, int count, int vfar, float weight, float farweight, spinflake* glb, float* out)
+	{
+	/*
+	Raw points along a row, seamlessly fused vertically, with the vertical
+	blend worked out ahead of time.
+	*/
+	float farpoint[SPINFLAKE_SPAN_PIECE];
+	int ctr;
+	rawrow(h, v, count, glb, out);
+	if(!vfar) return;
+	rawrow(h, v - 1.0, count, glb, farpoint);
+	for(ctr = 0; ctr < count; ctr++)
 		{
-		out = point;
+		out[ctr] = (out[ctr] * weight) + (farpoint[ctr] * farweight);
 		}
-	return out;
 	}
 
-static float rawpoint(float h, float v, spinflake* glb)
+static void rawrow(const float* h, float v, int count, spinflake* glb, float* out)
 	{
 	/*
-	Calculate one raw data point.
+	Calculate a row of raw data points.
 	This does the calculations without worrying about seamless-tile wrapping.
+	Each point's distance and angle from the origin are worked out once, and
+	then every floret goes over the whole row in turn, so a floret's
+	settings stay put while its sines are done all together.
 	*/
-	float pointangle, origindist, edgedist, proportiondist;
-	float out;
+	float origindist[SPINFLAKE_SPAN_PIECE], pointangle[SPINFLAKE_SPAN_PIECE];
+	float edgedist[SPINFLAKE_SPAN_PIECE], param[SPINFLAKE_SPAN_PIECE], wave[SPINFLAKE_SPAN_PIECE];
+	float edge, proportiondist;
+	int ctr, flctr;
+	floret* it;
+	polarrow(h, v, count, glb, origindist, pointangle);
+	//The edge is (currently) a circle some radius units away.
+	for(ctr = 0; ctr < count; ctr++) edgedist[ctr] = glb->radius;
+	for(flctr = 0; flctr < glb->florets; flctr++)
+		{
+		it = &glb->layer[flctr];
+		for(ctr = 0; ctr < count; ctr++)
+			{
+			param[ctr] = twirlangle(pointangle[ctr], origindist[ctr], it);
+			}
+		chopsinrow(param, count, it, wave);
+		for(ctr = 0; ctr < count; ctr++)
+			{
+			edgedist[ctr] += wave[ctr] * it->spineradius;
+			}
+		}
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		//If we are at the origin, the florets don't count.
+		if(origindist[ctr])
+			{
+			edge = edgedist[ctr];
+			if(glb->averageflorets) edge /= glb->florets;
+			//Our return value is the distance from the edge, proportionate
+			//to the distance from the origin to the edge.
+			proportiondist = ((edge - origindist[ctr]) / edge);
+			out[ctr] = pointfromproportion(proportiondist);
+			}
+		else out[ctr] = 1.0;
+		}
+	}
+
+static void polarrow(const float* h, float v, int count, spinflake* glb, float* origindist, float* pointangle)
+	{
 	/*
-	Rotate the point around our origin. This lets the squashed bulge-points on
+	Rotate each point around our origin. This lets the squashed bulge-points on
 	the sides of the squished spinflake point in random directions - not just aligned
-	with the cartesian axes.
+	with the cartesian axes. Then work out the point's squished distance from
+	the origin and the angle it presents to the origin.
+	The rotation has always gone the long way round: the point's angle and
+	distance, the twist added to the angle, and back again. Turning the
+	point through the twist with its sine and cosine comes to the same thing,
+	give or take rounding, and the only odd one out is a point left of the
+	origin, which lands on the wrong side - but its distance and angle come
+	out the same either way. So with fast math we take the short cut, and
+	do the distances and angles for the row all at once.
 	*/
-	float hypangle;
-	h -= glb->originH;
-	v -= glb->originV;
-	hypangle = atan(v / h) + glb->twist;
-	origindist = hypotf(h, v);
-	h = (cos(hypangle) * origindist);
-	v = (sin(hypangle) * origindist);
-	//Calculate the distance from the origin to this point. Again.
-	origindist = hypotf(h * glb->squish, v / glb->squish);
-	//If we are at the origin, there is no need to do the computations.
-	if(origindist)
+	float sqh[SPINFLAKE_SPAN_PIECE], sqv[SPINFLAKE_SPAN_PIECE], slope[SPINFLAKE_SPAN_PIECE];
+	float pointh, pointv, twistedh, twistedv, hypangle, dist;
+	int ctr;
+	if(UsingFastMath())
 		{
-		int ctr;
-		//The edge is (currently) a circle some radius units away.
-		//Compute the angle this point represents to the origin.
-		pointangle = calctheta(h, v, glb);
-		edgedist = glb->radius;
-		for(ctr = 0; ctr < glb->florets; ctr++)
+		for(ctr = 0; ctr < count; ctr++)
 			{
-			edgedist += calcwave(pointangle, origindist, &glb->layer[ctr]);
+			pointh = h[ctr] - glb->originH;
+			pointv = v - glb->originV;
+			twistedh = pointh * glb->twistcos - pointv * glb->twistsin;
+			twistedv = pointh * glb->twistsin + pointv * glb->twistcos;
+			sqh[ctr] = twistedh * glb->squish;
+			sqv[ctr] = twistedv / glb->squish;
+			slope[ctr] = twistedv / twistedh;
 			}
-		if(glb->averageflorets) edgedist /= glb->florets;
-		//Our return value is the distance from the edge, proportionate
-		//to the distance from the origin to the edge.
-		proportiondist = ((edgedist - origindist) / edgedist);
-		//If the value is >=0, we are inside the shape. Otherwise, we're outside it.
-		if(proportiondist >= 0) out = sqrt(proportiondist);
-			else out = 1.0 - (1.0 / (1 - proportiondist));
+		FastHypotArray(sqh, sqv, count, origindist);
+		FastAtanArray(slope, count, pointangle);
+		return;
+		}
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		pointh = h[ctr] - glb->originH;
+		pointv = v - glb->originV;
+		hypangle = genatan(pointv / pointh) + glb->twist;
+		dist = genhypotf(pointh, pointv);
+		pointh = (gencos(hypangle) * dist);
+		pointv = (gensin(hypangle) * dist);
+		//Calculate the distance from the origin to this point. Again.
+		origindist[ctr] = genhypotf(pointh * glb->squish, pointv / glb->squish);
+		//Compute the angle this point represents to the origin.
+		pointangle[ctr] = calctheta(pointh, pointv, glb);
 		}
-	else out = 1.0;
-	return out;
 	}
 
-static float calcwave(float theta, float dist, floret* it)
+static float twirlangle(float theta, float dist, floret* it)
 	{
 	/*
-	Calculate the distance from centre this floret adds to the mix
-	at the particular angle supplied.
+	Calculate the angle at which this floret takes its sine, at the
+	particular point angle and distance supplied.
 	This is where we incorporate the floret's spines and twirling.
 	Oddly, a spinflake's florets don't have to twirl in unison. This
 	can get really interesting. If it doesn't work, migrate the twirl back
@@ -337,7 +409,7 @@ static float calcwave(float theta, float dist, floret* it)
 			break;
 		case twirlSineMethod:
 			cosparam = (theta * it->spines + it->twirlbase)
-						+ (sin(dist * it->twirlspeed) * (it->twirlamp + (dist * it->twirlamp)));
+						+ (gensin(dist * it->twirlspeed) * (it->twirlamp + (dist * it->twirlamp)));
 			break;
 		case twirlNoneMethod:
 		default:
@@ -345,7 +417,50 @@ static float calcwave(float theta, float dist, floret* it)
 			cosparam = theta * it->spines + it->twirlbase;
 			break;
 		}
-	return chopsin(cosparam, it) * it->spineradius;
+	return cosparam;
+	}
+
+static void chopsinrow(const float* theta, int count, floret* it, float* out)
+	{
+	/*
+	The floret's sine at each angle, squeezed into 0..1 by its packing
+	method. The sawblade folds its angles first and takes the sine of
+	those instead.
+	*/
+	float folded[SPINFLAKE_SPAN_PIECE];
+	float angle;
+	int ctr;
+	if(it->sineposmethod == sineSawbladeMethod)
+		{
+		for(ctr = 0; ctr < count; ctr++)
+			{
+			angle = genfmod(theta[ctr] / 4.0, pi / 2.0);
+			if(angle < 0) angle += (pi / 2.0);
+			folded[ctr] = angle;
+			}
+		theta = folded;
+		}
+	if(UsingFastMath()) FastSinArray(theta, count, out);
+	else for(ctr = 0; ctr < count; ctr++) out[ctr] = gensin(theta[ctr]);
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		switch(it->sineposmethod)
+			{
+			case sineCompressMethod:
+				out[ctr] = (out[ctr] + 1.0) / 2.0;
+				break;
+			case sineAbsoluteMethod:
+				out[ctr] = fabs(out[ctr]);
+				break;
+			case sineTruncateMethod:
+				if(out[ctr] < 0) out[ctr] += 1.0;
+				break;
+			}
+		if(it->backward)
+			{
+			out[ctr] = 1.0 - out[ctr];
+			}
+		}
 	}
 
 static float calctheta(float h, float v, spinflake* it)
@@ -353,8 +468,100 @@ static float calctheta(float h, float v, spinflake* it)
 	/*
 	Calculate the angle this point presents to the origin of the spinflake.
 	We assume that the point is relative to the origin of the spinflake.
-	We do this, because that's how rawpoint is coded. :-) 
+	We do this, because that's how polarrow is coded. :-)
 	*/
-	return atan(v / h);
+	return genatan(v / h);
 	}
-
\ No newline at end of file
+
+void SpinflakeBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi)
+	{
+	/*
+	Spinflake blends each point with its neighbours a tile to the left and
+	a tile up, once it passes the middle of the tile. Blends can't leave
+	the range of the values they blend, so the bounds are the union of the
+	raw bounds over every copy of the rectangle that can be involved.
+	*/
+	SpinflakeGlobals* glb = (SpinflakeGlobals*)refcon;
+	float copylo, copyhi;
+	int hcopies, vcopies, hctr, vctr;
+	*lo = 0.0;
+	*hi = 1.0;
+	if(!glb) return;
+	//Outside the tile, the blend weights go negative; don't try to be clever there.
+	if(left < 0.0 || top < 0.0 || right > 1.0 || bottom > 1.0) return;
+	hcopies = (right > 0.5) ? 2 : 1;
+	vcopies = (bottom > 0.5) ? 2 : 1;
+	*lo = 1.0;
+	*hi = 0.0;
+	for(hctr = 0; hctr < hcopies; hctr++)
+		{
+		for(vctr = 0; vctr < vcopies; vctr++)
+			{
+			rawbounds(left - hctr, top - vctr, right - hctr, bottom - vctr, &glb->flake[0], &copylo, &copyhi);
+			if(copylo < *lo) *lo = copylo;
+			if(copyhi > *hi) *hi = copyhi;
+			}
+		}
+	}
+
+static void rawbounds(float left, float top, float right, float bottom, spinflake* glb, float* lo, float* hi)
+	{
+	/*
+	Bounds on rawpoint over a rectangle.
+	The value depends on how far the point is from the edge, in proportion
+	to the edge's distance from the origin. That proportion only goes up as
+	the edge gets farther out, and down as the point gets farther from the
+	origin. The edge is the radius plus some share of each floret's spines,
+	and the squished distance is within the squish factor of the real
+	distance, so plugging in the extremes of each bounds the proportion.
+	The value is zero right on the edge and climbs towards 1 both inside
+	and outside it.
+	*/
+	float nearest, farthest, squish, edgelo, edgehi, proportionlo, proportionhi;
+	int ctr;
+	RectDistanceBounds(left, top, right, bottom, glb->originH, glb->originV, &nearest, &farthest);
+	squish = glb->squish;
+	if(squish < 1.0) squish = 1.0 / squish;
+	nearest /= squish;
+	farthest *= squish;
+	edgelo = edgehi = glb->radius;
+	for(ctr = 0; ctr < glb->florets; ctr++) edgehi += glb->layer[ctr].spineradius;
+	if(glb->averageflorets)
+		{
+		edgelo /= glb->florets;
+		edgehi /= glb->florets;
+		}
+	//A vanishing edge could send the proportion anywhere.
+	if(edgelo <= 0)
+		{
+		*lo = 0.0;
+		*hi = 1.0;
+		return;
+		}
+	proportionhi = 1.0 - nearest / edgehi;
+	proportionlo = 1.0 - farthest / edgelo;
+	if(proportionlo >= 0)
+		{
+		*lo = pointfromproportion(proportionlo);
+		*hi = pointfromproportion(proportionhi);
+		}
+	else if(proportionhi <= 0)
+		{
+		*lo = pointfromproportion(proportionhi);
+		*hi = pointfromproportion(proportionlo);
+		}
+	else
+		{
+		*lo = 0.0;
+		*hi = pointfromproportion(proportionlo);
+		if(pointfromproportion(proportionhi) > *hi) *hi = pointfromproportion(proportionhi);
+		}
+	}
+
+static float pointfromproportion(float proportiondist)
+	{
+	//This is the last step of rawpoint.
+	if(proportiondist >= 0) return sqrt(proportiondist);
+	return 1.0 - (1.0 / (1 - proportiondist));
+	}
+
@@ -43,6 +43,10 @@ slowly to infinity.
 
 */
 
-void* SpinflakeInit(void);
+#include "genutils.h"
+
+void* SpinflakeInit(int width, int height, RandRef rng, GenOptionsRef options);
 void SpinflakeExit(void* refcon);
-float Spinflake(float h, float v, void* refcon);
\ No newline at end of file
+float Spinflake(float h, float v, void* refcon);
+void SpinflakeSpan(const float* h, float v, int count, void* refcon, float* out);
+void SpinflakeBounds(float left, float top, float right, float bottom, void* refcon, float* lo, float* hi);
\ No newline at end of file
@@ -0,0 +1,352 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Worley Generator
+
+The tile is cut into a square grid of cells, with one feature point
+somewhere in each, and the grid repeats forever in every direction. The
+value of a point is the distance to the nearest feature point (F1), to
+the second nearest (F2), or the difference between them (F2 - F1), which
+is zero along the borders between cells and so draws cracks. Distances
+are measured straight, along the axes (Manhattan), or by the longer of the
+two axes (Chebyshev), which gives round, diamond or square cells.
+
+Every feature point stays inside its own cell, so the nearest two are
+nearly always among the nine cells around the point, and we look there
+first. Anything farther off is at least as far away as the edge of those
+nine cells; if the second nearest is nearer than that, we are done, and if
+not, we look another ring of cells out, and so on. So a point costs about
+nine distances however many cells there are, and the answer is exact.
+
+*/
+
+#include "worley-gen.h"
+#include "genutils.h"
+#include <stdlib.h>
+#include <math.h>
+
+/*
+The tile is this many cells across, give or take. The count comes from the
+seed alone, never from the size of the tile, so a thumbnail shows the same
+cells as the full-size picture.
+*/
+#define MIN_WORLEY_CELLS 3
+#define MAX_WORLEY_CELLS 24
+//Cracks are never narrower than this many pixels, so they don't need supersampling.
+#define WORLEY_PIXELS_PER_CRACK 2
+/*
+Distances are in cells. With one feature point in each cell, F1 and F2
+rarely get much farther than these; anything beyond is clipped to white.
+*/
+#define WORLEY_F1_REACH 0.9
+#define WORLEY_F2_REACH 1.3
+#define WORLEY_CRACK_REACH 0.8
+//Distances along the axes run about 4 / pi times as far as straight ones.
+#define WORLEY_MANHATTAN_STRETCH 1.27
+
+enum worleystyles
+	{
+	worleyNearestStyle,		//F1
+	worleySecondStyle,		//F2
+	worleyCrackStyle,		//F2 - F1
+	MAX_WORLEY_STYLES
+	};
+
+enum worleymetrics
+	{
+	worleyEuclidMetric,
+	worleyManhattanMetric,
+	worleyChebyshevMetric,
+	MAX_WORLEY_METRICS
+	};
+
+//Where a cell's feature point is, from its top left corner, in cells.
+typedef struct WorleyFeature
+	{
+	float h, v;
+	}
+WorleyFeature;
+
+typedef struct WorleyGlobals
+	{
+	int cells;					//cells across and down the tile
+	int style;
+	int metric;
+	int invert;
+	float scale;				//turns distances in cells into 0..1
+	WorleyFeature* feature;		//cells * cells of them, a row at a time
+	}
+WorleyGlobals;
+typedef WorleyGlobals* WorleyRef;
+
+static void WorleyRow(const float* h, float v, int count, WorleyRef it, float* out);
+static void GatherCells(int col, int row, float fracv, WorleyRef it, float* candh, float* candv);
+static void SearchRings(float frach, float fracv, int col, int row, WorleyRef it, float* nearest, float* second);
+static void KeepNearest(float measure, float* nearest, float* second);
+static float Measure(float dh, float dv, int metric);
+static float Distance(float measure, int metric);
+static int WrapCell(int cell, int cells);
+
+void* WorleyInit(int width, int height, RandRef rng, GenOptionsRef options)
+	{
+	/*
+	Pick the size of the grid, how far the feature points may wander from
+	the middles of their cells, how to measure, and what to draw. A jitter
+	of 1 lets a point go anywhere in its cell; less keeps the cells more
+	regular, nearly a chequerboard at the bottom end.
+	*/
+	WorleyRef out = (WorleyRef)malloc(sizeof(WorleyGlobals));
+	if(out)
+		{
+		int ctr, widest;
+		float jitter, reach, narrowest;
+		widest = (width > height) ? width : height;
+		out->cells = irandge(rng, MIN_WORLEY_CELLS, MAX_WORLEY_CELLS + 1);
+		out->style = irand(rng, MAX_WORLEY_STYLES);
+		//Round cells are the classic look, so they get half the layers.
+		out->metric = maybe(rng) ? worleyEuclidMetric : irandge(rng, worleyManhattanMetric, MAX_WORLEY_METRICS);
+		out->invert = maybe(rng);
+		jitter = frandge(rng, 0.5, 1.0);
+		switch(out->style)
+			{
+			case worleyNearestStyle:
+				reach = WORLEY_F1_REACH;
+				break;
+			case worleySecondStyle:
+				reach = WORLEY_F2_REACH;
+				break;
+			case worleyCrackStyle:
+			default:
+				/*
+				Cracks can be anything from a hairline to the whole cell wide.
+				A hairline narrower than a couple of pixels would break up
+				into dots without supersampling, so a small tile gets wider
+				cracks. That is the only thing its size changes, and it
+				changes no later draw.
+				*/
+				narrowest = (float)WORLEY_PIXELS_PER_CRACK * out->cells / widest;
+				reach = frandge(rng, 0.05, WORLEY_CRACK_REACH);
+				if(reach < narrowest) reach = narrowest;
+				break;
+			}
+		if(out->metric == worleyManhattanMetric) reach *= WORLEY_MANHATTAN_STRETCH;
+		out->scale = 1.0 / reach;
+		out->feature = (WorleyFeature*)malloc(out->cells * out->cells * sizeof(WorleyFeature));
+		if(!out->feature)
+			{
+			free(out);
+			return NULL;
+			}
+		for(ctr = 0; ctr < out->cells * out->cells; ctr++)
+			{
+			out->feature[ctr].h = (1.0 - jitter) / 2.0 + frand(rng, jitter);
+			out->feature[ctr].v = (1.0 - jitter) / 2.0 + frand(rng, jitter);
+			}
+		}
+	return out;
+	}
+
+void WorleyExit(void* refcon)
+	{
+	WorleyRef it = (WorleyRef)refcon;
+	if(it)
+		{
+		free(it->feature);
+		free(it);
+		}
+	}
+
+float Worley(float h, float v, void* refcon)
+	{
+	//One point is just a very short row.
+	float out;
+	WorleySpan(&h, v, 1, refcon, &out);
+	return out;
+	}
+
+void WorleySpan(const float* h, float v, int count, void* refcon, float* out)
+	{
+	int ctr;
+	if(!refcon)
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = 0;
+		return;
+		}
+	WorleyRow(h, v, count, (WorleyRef)refcon, out);
+	}
+
+static void WorleyRow(const float* h, float v, int count, WorleyRef it, float* out)
+	{
+	/*
+	Worley for a whole row of points. The row of cells is the same all the
+	way along, so each point only has to find its column. Points in the same
+	column share the same nine feature points, and how far each of those is
+	above or below the row, so we gather them up whenever the column
+	changes. Positions are kept relative to the point's own cell, so a point
+	on one edge of the tile and its twin on the other come out exactly the
+	same.
+	*/
+	float candh[9], candv[9];
+	float pos, frach, fracv, edge, nearest, second, value;
+	int ctr, cand, col, row, lastcol;
+	if(count <= 0) return;
+	pos = v * it->cells;
+	row = (int)floor(pos);
+	fracv = pos - row;
+	lastcol = (int)floor(h[0] * it->cells);
+	GatherCells(lastcol, row, fracv, it, candh, candv);
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		pos = h[ctr] * it->cells;
+		col = (int)floor(pos);
+		frach = pos - col;
+		if(col != lastcol)
+			{
+			GatherCells(col, row, fracv, it, candh, candv);
+			lastcol = col;
+			}
+		nearest = second = HUGE_VAL;
+		for(cand = 0; cand < 9; cand++)
+			{
+			KeepNearest(Measure(candh[cand] - frach, candv[cand], it->metric), &nearest, &second);
+			}
+		//Every feature point outside the nine cells is at least this far away, by any of our measures.
+		edge = frach;
+		if(1.0 - frach < edge) edge = 1.0 - frach;
+		if(fracv < edge) edge = fracv;
+		if(1.0 - fracv < edge) edge = 1.0 - fracv;
+		if(second > Measure(1.0 + edge, 0.0, it->metric))
+			{
+			SearchRings(frach, fracv, col, row, it, &nearest, &second);
+			}
+		switch(it->style)
+			{
+			case worleyNearestStyle:
+				value = Distance(nearest, it->metric);
+				break;
+			case worleySecondStyle:
+				value = Distance(second, it->metric);
+				break;
+			case worleyCrackStyle:
+			default:
+				value = Distance(second, it->metric) - Distance(nearest, it->metric);
+				break;
+			}
+		value *= it->scale;
+		if(value > 1.0) value = 1.0;
+		out[ctr] = it->invert ? 1.0 - value : value;
+		}
+	}
+
+static void GatherCells(int col, int row, float fracv, WorleyRef it, float* candh, float* candv)
+	{
+	/*
+	The feature points of the nine cells around a column of the row, left
+	to right and top to bottom: across from the left edge of the column,
+	and down from the row.
+	*/
+	WorleyFeature* feature;
+	int cand, dh, dv;
+	cand = 0;
+	for(dv = -1; dv <= 1; dv++)
+		{
+		for(dh = -1; dh <= 1; dh++)
+			{
+			feature = &it->feature[WrapCell(row + dv, it->cells) * it->cells + WrapCell(col + dh, it->cells)];
+			candh[cand] = dh + feature->h;
+			candv[cand] = (dv + feature->v) - fracv;
+			cand++;
+			}
+		}
+	}
+
+static void SearchRings(float frach, float fracv, int col, int row, WorleyRef it, float* nearest, float* second)
+	{
+	/*
+	The nearest two among the nine cells around the point weren't near
+	enough to be sure of. Look at the ring of cells around those, and the
+	ring around that, until the second nearest is nearer than anything
+	beyond the rings we've looked at could be. It never takes many: the
+	point's own feature point is well within two cells of it.
+	*/
+	WorleyFeature* feature;
+	float edge;
+	int reach, dh, dv;
+	edge = frach;
+	if(1.0 - frach < edge) edge = 1.0 - frach;
+	if(fracv < edge) edge = fracv;
+	if(1.0 - fracv < edge) edge = 1.0 - fracv;
+	for(reach = 2; *second > Measure(reach - 1 + edge, 0.0, it->metric); reach++)
+		{
+		for(dv = -reach; dv <= reach; dv++)
+			{
+			//The top and bottom rows of the ring go all the way across; the rest are just the two ends.
+			for(dh = -reach; dh <= reach; dh += (dv == -reach || dv == reach) ? 1 : 2 * reach)
+				{
+				feature = &it->feature[WrapCell(row + dv, it->cells) * it->cells + WrapCell(col + dh, it->cells)];
+				KeepNearest(Measure((dh + feature->h) - frach, (dv + feature->v) - fracv, it->metric), nearest, second);
+				}
+			}
+		}
+	}
+
+static void KeepNearest(float measure, float* nearest, float* second)
+	{
+	if(measure < *nearest)
+		{
+		*second = *nearest;
+		*nearest = measure;
+		}
+	else if(measure < *second) *second = measure;
+	}
+
+static float Measure(float dh, float dv, int metric)
+	{
+	/*
+	Something which grows with the distance, and is quick to work out: for
+	straight line distances, that's the square, which saves a square root
+	for every feature point we look at.
+	*/
+	dh = fabs(dh);
+	dv = fabs(dv);
+	switch(metric)
+		{
+		case worleyManhattanMetric:
+			return dh + dv;
+		case worleyChebyshevMetric:
+			return (dh > dv) ? dh : dv;
+		case worleyEuclidMetric:
+		default:
+			return dh * dh + dv * dv;
+		}
+	}
+
+static float Distance(float measure, int metric)
+	{
+	//Turn a measure back into a distance.
+	return (metric == worleyEuclidMetric) ? sqrt(measure) : measure;
+	}
+
+static int WrapCell(int cell, int cells)
+	{
+	//Which of the tile's cells is this one a copy of?
+	cell %= cells;
+	return (cell < 0) ? cell + cells : cell;
+	}
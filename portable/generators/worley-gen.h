@@ -0,0 +1,37 @@
+/*
+
+Copyright 1999 Mars Saxman
+All Rights Reserved
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Worley Generator
+
+Cells, like a honeycomb, crazy paving or dried mud: Steven Worley's
+cellular noise. Feature points are scattered over the tile, one to each
+square of a grid, and a point's value comes from how far it is to the
+nearest of them, the next nearest, or the difference between the two,
+which draws cracks along the borders between cells. The grid wraps around
+the tile, so it tiles by itself.
+
+*/
+
+#include "genutils.h"
+
+void* WorleyInit(int width, int height, RandRef rng, GenOptionsRef options);
+void WorleyExit(void* refcon);
+float Worley(float h, float v, void* refcon);
+void WorleySpan(const float* h, float v, int count, void* refcon, float* out);
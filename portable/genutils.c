@@ -25,47 +25,94 @@ I wrote these once and don't want to have to write them again.
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include "genutils.h"
 
-float frand(float range)
+/*
+The golden ratio increment from splitmix64. Each draw adds this much to
+the counter and scrambles the result.
+*/
+#define RANDOM_GAMMA 0x9E3779B97F4A7C15ULL
+
+static uint64_t MixRandom(uint64_t z)
+	{
+	//The splitmix64 finalizer: a cheap, thorough 64-bit scramble.
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+	}
+
+void SeedRandom(RandRef rng, uint64_t seed)
+	{
+	//Start a fresh stream. The same seed always produces the same stream.
+	rng->seed = seed;
+	rng->counter = 0;
+	}
+
+void DefaultGenOptions(GenOptions* out)
+	{
+	//Leave every choice to the generators.
+	out->fastmath = 0;
+	out->bubbles = 0;
+	out->octaves = 0;
+	out->threads = 1;
+	out->lazy = 0;
+	}
+
+uint64_t RandomSeed(RandRef rng)
+	{
+	/*
+	Draw a full 64-bit value, suitable for seeding another stream.
+	*/
+	rng->counter++;
+	return MixRandom(rng->seed + rng->counter * RANDOM_GAMMA);
+	}
+
+uint32_t NextRandom(RandRef rng)
 	{
-	float denom, max;
-	denom = rand();
-	max = RAND_MAX;
-	denom /= max;
+	//The high half of the mix is the best-scrambled part.
+	return RandomSeed(rng) >> 32;
+	}
+
+float frand(RandRef rng, float range)
+	{
+	/*
+	Return a value from 0 up to (but not including) range.
+	We use the top 24 bits, which is all a float can hold exactly.
+	*/
+	float denom;
+	denom = (NextRandom(rng) >> 8) * (1.0f / 16777216.0f);
 	return range * denom;
 	}
 
-float frandge(float min, float max)
+float frandge(RandRef rng, float min, float max)
 	{
-	return frand(max - min) + min;
+	return frand(rng, max - min) + min;
 	}
 
-int irand(int range)
+int irand(RandRef rng, int range)
 	{
-	return frand(range);
+	return frand(rng, range);
 	}
 
-int irandge(int min, int max)
+int irandge(RandRef rng, int min, int max)
 	{
-	return irand(max - min) + min;
+	return irand(rng, max - min) + min;
 	}
 
-static int maybeshifter = 0;
-int maybe(void)
+int maybe(RandRef rng)
 	{
 	//Flip a coin. Returns a zero/nonzero answer with equal probability.
-	if(maybeshifter > 31) maybeshifter = 0;
-	return (rand() >> maybeshifter++) & 1;
+	return NextRandom(rng) >> 31;
 	}
 
-int RandomPackMethod(void)
+int RandomPackMethod(RandRef rng)
 	{
 	/*
 	Pick a pack method at random
 	and return it to the caller. Presumably, they will save it somewhere.
 	*/
-	return (rand() * PACK_METHOD_COUNT) / RAND_MAX;
+	return irand(rng, PACK_METHOD_COUNT);
 	}
 
 float PackedCos(float distance, float scale, int packmethod)
@@ -80,7 +127,7 @@ float PackedCos(float distance, float scale, int packmethod)
 	entire Starfish generator set simply by placing them in here.
 	*/
 	float rawcos, out;
-	rawcos = cos(distance * scale);
+	rawcos = gencos(distance * scale);
 	switch(packmethod)
 		{
 		case flipSignToFit:
@@ -97,7 +144,7 @@ float PackedCos(float distance, float scale, int packmethod)
 			break;
 		case slopeToFit:
 			//use only the first half of the cycle. A saw-edge effect.
-			out = (cos(fmod(distance * scale, pi)) + 1.0) / 2.0;
+			out = (gencos(genfmod(distance * scale, pi)) + 1.0) / 2.0;
 			break;
 		default:
 			//just to show me something's wrong
@@ -105,3 +152,727 @@ float PackedCos(float distance, float scale, int packmethod)
 		}
 	return out;
 	}
+
+/*
+The packed cosine kernels take their distances in pieces this long,
+so their scratch space can live on the stack.
+*/
+#define PACKED_COS_PIECE 64
+
+static void PackedCosRaw(const float* distance, float scale, int count, int sawtooth, float* out)
+	{
+	/*
+	The cosines PackedCos starts from, for a run of distances. With fast
+	math, each piece goes through the array kernel; for the sawtooth
+	(slopeToFit) we first fold the arguments back into one half cycle.
+	Without fast math we call libm, just as PackedCos does. The sawtooth
+	never comes here then, since PackedCos keeps its cosine in double.
+	*/
+	float arg[PACKED_COS_PIECE];
+	int ctr, piece;
+	if(!UsingFastMath())
+		{
+		for(ctr = 0; ctr < count; ctr++) out[ctr] = cos(distance[ctr] * scale);
+		return;
+		}
+	while(count > 0)
+		{
+		piece = (count < PACKED_COS_PIECE) ? count : PACKED_COS_PIECE;
+		for(ctr = 0; ctr < piece; ctr++) arg[ctr] = distance[ctr] * scale;
+		if(sawtooth)
+			{
+			for(ctr = 0; ctr < piece; ctr++) arg[ctr] = FastFmod(arg[ctr], pi);
+			}
+		FastCosArray(arg, piece, out);
+		distance += piece;
+		out += piece;
+		count -= piece;
+		}
+	}
+
+static void PackScaleToFit(const float* distance, float scale, int count, float* out)
+	{
+	int ctr;
+	PackedCosRaw(distance, scale, count, 0, out);
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = (out[ctr] + 1.0) / 2.0;
+	}
+
+static void PackFlipSignToFit(const float* distance, float scale, int count, float* out)
+	{
+	int ctr;
+	PackedCosRaw(distance, scale, count, 0, out);
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = (out[ctr] >= 0) ? out[ctr] : -out[ctr];
+	}
+
+static void PackTruncateToFit(const float* distance, float scale, int count, float* out)
+	{
+	int ctr;
+	PackedCosRaw(distance, scale, count, 0, out);
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = (out[ctr] >= 0) ? out[ctr] : out[ctr] + 1;
+	}
+
+static void PackSlopeToFit(const float* distance, float scale, int count, float* out)
+	{
+	//Without fast math, PackedCos keeps the sawtooth's cosine in double until it is packed.
+	int ctr;
+	if(!UsingFastMath())
+		{
+		for(ctr = 0; ctr < count; ctr++)
+			out[ctr] = (cos(fmod(distance[ctr] * scale, pi)) + 1.0) / 2.0;
+		return;
+		}
+	PackedCosRaw(distance, scale, count, 1, out);
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = (out[ctr] + 1.0) / 2.0;
+	}
+
+static void PackUnknown(const float* distance, float scale, int count, float* out)
+	{
+	//The same complaint PackedCos makes about a method it doesn't know.
+	int ctr;
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = 0.5;
+	}
+
+PackedCosProc PackedCosKernel(int packmethod)
+	{
+	switch(packmethod)
+		{
+		case scaleToFit: return &PackScaleToFit;
+		case flipSignToFit: return &PackFlipSignToFit;
+		case truncateToFit: return &PackTruncateToFit;
+		case slopeToFit: return &PackSlopeToFit;
+		default: return &PackUnknown;
+		}
+	}
+
+void PackedCosRun(double start, double step, float scale, int count, int packmethod, float* out)
+	{
+	/*
+	Turning the point (cosine, sine) through the angle step * scale is the
+	same as adding that angle to the argument, so the cosines come from
+	two multiplications and two additions each. Rounding makes the pair
+	creep off the unit circle, a little every step; one step of Newton's
+	method for 1 / length puts it back on. The sawtooth (slopeToFit) wants
+	the cosine of the argument folded into the half cycle by fmod, which
+	is the cosine itself, with its sign flipped on every other half cycle.
+	*/
+	double angle, turn, cosine, sine, turncos, turnsin, next, norm;
+	int ctr, halfcycles;
+	angle = (double)start * scale;
+	turn = (double)step * scale;
+	cosine = cos(angle);
+	sine = sin(angle);
+	turncos = cos(turn);
+	turnsin = sin(turn);
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		switch(packmethod)
+			{
+			case flipSignToFit:
+				out[ctr] = (cosine >= 0) ? cosine : -cosine;
+				break;
+			case truncateToFit:
+				out[ctr] = (cosine >= 0) ? cosine : cosine + 1;
+				break;
+			case scaleToFit:
+				out[ctr] = (cosine + 1.0) / 2.0;
+				break;
+			case slopeToFit:
+				//fmod rounds towards zero, so count half cycles the same way.
+				halfcycles = (angle + ctr * turn) / pi;
+				out[ctr] = (((halfcycles & 1) ? -cosine : cosine) + 1.0) / 2.0;
+				break;
+			default:
+				out[ctr] = 0.5;
+			}
+		next = cosine * turncos - sine * turnsin;
+		sine = sine * turncos + cosine * turnsin;
+		cosine = next;
+		if((ctr + 1) % PACKED_COS_RENORM == 0)
+			{
+			norm = (3.0 - (cosine * cosine + sine * sine)) / 2.0;
+			cosine *= norm;
+			sine *= norm;
+			}
+		}
+	}
+
+/*
+PackedCos works in single precision, so a value computed right at the edge
+of an interval can land a hair outside it. We widen every interval of cosine
+arguments by this much (plus the same proportion of its size) before
+working out its bounds. That matters most for the packing methods which
+jump: a truncated wave which is really a hair below zero comes back near 1.
+*/
+#define BOUNDS_ARGUMENT_SLOP 1e-5
+//Past this size, single precision arguments are too coarse to reason about.
+#define BOUNDS_ARGUMENT_LIMIT 1e4
+
+static void CosBounds(double lo, double hi, double* outlo, double* outhi)
+	{
+	/*
+	Find the range of cos over the interval lo..hi.
+	The extremes are at the ends, or at a peak (a multiple of 2pi) or a
+	trough (an odd multiple of pi) inside the interval.
+	*/
+	double k;
+	if(hi - lo >= 2.0 * pi)
+		{
+		*outlo = -1.0;
+		*outhi = 1.0;
+		return;
+		}
+	*outlo = (cos(lo) < cos(hi)) ? cos(lo) : cos(hi);
+	*outhi = (cos(lo) > cos(hi)) ? cos(lo) : cos(hi);
+	k = ceil(lo / (2.0 * pi));
+	if(k * 2.0 * pi <= hi) *outhi = 1.0;
+	k = ceil((lo - pi) / (2.0 * pi));
+	if(k * 2.0 * pi + pi <= hi) *outlo = -1.0;
+	}
+
+void PackedCosBounds(float lo, float hi, float scale, int packmethod, float* outlo, float* outhi)
+	{
+	/*
+	Find the least and greatest values PackedCos can return for any
+	distance from lo to hi. This follows PackedCos case for case.
+	*/
+	double argA, argB, arglo, arghi, slop, rawlo, rawhi;
+	double resultlo = 0.0, resulthi = 1.0;
+	argA = (double)lo * scale;
+	argB = (double)hi * scale;
+	arglo = (argA < argB) ? argA : argB;
+	arghi = (argA > argB) ? argA : argB;
+	slop = BOUNDS_ARGUMENT_SLOP * (1.0 + fabs(arglo) + fabs(arghi));
+	arglo -= slop;
+	arghi += slop;
+	if(fabs(arglo) < BOUNDS_ARGUMENT_LIMIT && fabs(arghi) < BOUNDS_ARGUMENT_LIMIT)
+		{
+		CosBounds(arglo, arghi, &rawlo, &rawhi);
+		switch(packmethod)
+			{
+			case flipSignToFit:
+				if(rawlo >= 0)
+					{
+					resultlo = rawlo;
+					resulthi = rawhi;
+					}
+				else if(rawhi <= 0)
+					{
+					resultlo = -rawhi;
+					resulthi = -rawlo;
+					}
+				else
+					{
+					resultlo = 0.0;
+					resulthi = (-rawlo > rawhi) ? -rawlo : rawhi;
+					}
+				break;
+			case truncateToFit:
+				//Negative values jump up by one, so a wave crossing zero can hit anything.
+				if(rawlo >= 0)
+					{
+					resultlo = rawlo;
+					resulthi = rawhi;
+					}
+				else if(rawhi < 0)
+					{
+					resultlo = rawlo + 1.0;
+					resulthi = rawhi + 1.0;
+					}
+				break;
+			case scaleToFit:
+				resultlo = (rawlo + 1.0) / 2.0;
+				resulthi = (rawhi + 1.0) / 2.0;
+				break;
+			case slopeToFit:
+				/*
+				The sawtooth runs down each half cycle, then jumps back up.
+				Unless we stay inside one half cycle, anything can happen.
+				fmod keeps the sign, and cos doesn't care about it.
+				*/
+				if(arglo >= 0 || arghi <= 0)
+					{
+					double alo = fabs(arglo), ahi = fabs(arghi), k, swap;
+					if(alo > ahi)
+						{
+						swap = alo;
+						alo = ahi;
+						ahi = swap;
+						}
+					k = floor(alo / pi);
+					if(ahi < (k + 1.0) * pi)
+						{
+						resultlo = (cos(ahi - k * pi) + 1.0) / 2.0;
+						resulthi = (cos(alo - k * pi) + 1.0) / 2.0;
+						}
+					}
+				break;
+			default:
+				resultlo = resulthi = 0.5;
+			}
+		}
+	*outlo = resultlo;
+	*outhi = resulthi;
+	}
+
+void RectDistanceBounds
+		(
+		float left, float top, float right, float bottom,
+		float h, float v,
+		float* nearest, float* farthest
+		)
+	{
+	/*
+	The nearest point of the rectangle is the point clamped into it.
+	The farthest is whichever corner is farthest away on each axis.
+	*/
+	float nearh, nearv, farh, farv;
+	nearh = (h < left) ? left - h : (h > right) ? h - right : 0;
+	nearv = (v < top) ? top - v : (v > bottom) ? v - bottom : 0;
+	farh = (fabs(h - left) > fabs(h - right)) ? fabs(h - left) : fabs(h - right);
+	farv = (fabs(v - top) > fabs(v - bottom)) ? fabs(v - top) : fabs(v - bottom);
+	*nearest = hypotf(nearh, nearv);
+	*farthest = hypotf(farh, farv);
+	}
+
+/*
+Constants for the fast functions, most of them after Cephes. Pi/4 is split
+into three parts, each short enough that a multiple of it comes off an
+argument without losing any bits.
+*/
+#define FOUR_OVER_PI 1.27323954473516f
+#define PIO4_A 0.78515625f
+#define PIO4_B 2.4187564849853515625e-4f
+#define PIO4_C 3.77489497744594108e-8f
+#define COS_C0 2.443315711809948e-5f
+#define COS_C1 -1.388731625493765e-3f
+#define COS_C2 4.166664568298827e-2f
+#define SIN_S0 -1.9515295891e-4f
+#define SIN_S1 8.3321608736e-3f
+#define SIN_S2 -1.6666654611e-1f
+#define PIO2_F 1.5707963267948966f
+#define PIO4_F 0.7853981633974483f
+#define TAN3PIO8 2.414213562373095f
+#define TANPIO8 0.4142135623730950f
+#define ATAN_A0 8.05374449538e-2f
+#define ATAN_A1 -1.38776856032e-1f
+#define ATAN_A2 1.99777106478e-1f
+#define ATAN_A3 -3.33329491539e-1f
+//2/ln 2 divided by 1, 3, 5, 7, 9: the series for log2 in terms of atanh.
+#define LOG2_L0 2.8853900817779268f
+#define LOG2_L1 0.9617966939259756f
+#define LOG2_L2 0.5770780163555854f
+#define LOG2_L3 0.4121985831111324f
+#define LOG2_L4 0.3205988979753252f
+//(ln 2)^n / n!: the series for 2^f.
+#define EXP2_E1 0.6931471805599453f
+#define EXP2_E2 0.2402265069591007f
+#define EXP2_E3 0.05550410866482158f
+#define EXP2_E4 0.009618129107628477f
+#define EXP2_E5 0.0013333558146428443f
+#define EXP2_E6 0.00015403530393381606f
+#define EXP2_E7 1.525273380405984e-05f
+#define SQRT2_F 1.4142135623730951f
+//Past this, squaring a hypot argument could overflow or underflow.
+#define FAST_HYPOT_LIMIT 1e18f
+#define FAST_HYPOT_FLOOR 1e-18f
+
+static void FastTrigReduce(float ax, int* quadrant, float* c, float* s)
+	{
+	/*
+	Take the nearest multiple of pi/2 off ax, and work out the cosine and
+	sine of what's left, which lies within pi/4 of zero. The quadrant says
+	which multiple of pi/2 it was, modulo 4.
+	*/
+	int j;
+	float y, r, z;
+	j = ax * FOUR_OVER_PI;
+	j = (j + 1) & ~1;
+	y = j;
+	r = ((ax - y * PIO4_A) - y * PIO4_B) - y * PIO4_C;
+	z = r * r;
+	*c = ((COS_C0 * z + COS_C1) * z + COS_C2) * z * z - 0.5f * z + 1.0f;
+	*s = ((SIN_S0 * z + SIN_S1) * z + SIN_S2) * z * r + r;
+	*quadrant = (j >> 1) & 3;
+	}
+
+float FastCos(float x)
+	{
+	float ax, c, s;
+	int quadrant;
+	ax = fabsf(x);
+	if(!(ax <= FAST_TRIG_LIMIT)) return cos(x);
+	FastTrigReduce(ax, &quadrant, &c, &s);
+	switch(quadrant)
+		{
+		case 0: return c;
+		case 1: return -s;
+		case 2: return -c;
+		default: return s;
+		}
+	}
+
+float FastSin(float x)
+	{
+	float ax, c, s, out;
+	int quadrant;
+	ax = fabsf(x);
+	if(!(ax <= FAST_TRIG_LIMIT)) return sin(x);
+	FastTrigReduce(ax, &quadrant, &c, &s);
+	switch(quadrant)
+		{
+		case 0: out = s; break;
+		case 1: out = c; break;
+		case 2: out = -s; break;
+		default: out = -c;
+		}
+	return (x < 0) ? -out : out;
+	}
+
+float FastAtan(float x)
+	{
+	/*
+	Bring the argument within tan(pi/8) of zero, using
+	atan(x) = pi/2 - atan(1/x) and atan(x) = pi/4 + atan((x-1)/(x+1)),
+	then sum a short polynomial.
+	*/
+	float ax, xr, y0, z, out;
+	ax = fabsf(x);
+	if(ax > TAN3PIO8)
+		{
+		y0 = PIO2_F;
+		xr = -1.0f / ax;
+		}
+	else if(ax > TANPIO8)
+		{
+		y0 = PIO4_F;
+		xr = (ax - 1.0f) / (ax + 1.0f);
+		}
+	else
+		{
+		y0 = 0.0f;
+		xr = ax;
+		}
+	z = xr * xr;
+	out = (((ATAN_A0 * z + ATAN_A1) * z + ATAN_A2) * z + ATAN_A3) * z * xr + xr + y0;
+	return (x < 0) ? -out : out;
+	}
+
+float FastHypot(float x, float y)
+	{
+	//libm's hypot takes care over huge and tiny values; in between, the textbook sum will do.
+	float ax = fabsf(x), ay = fabsf(y);
+	if(!(ax < FAST_HYPOT_LIMIT && ay < FAST_HYPOT_LIMIT)) return hypotf(x, y);
+	if(ax < FAST_HYPOT_FLOOR && ay < FAST_HYPOT_FLOOR) return hypotf(x, y);
+	return sqrtf(x * x + y * y);
+	}
+
+float FastPow(float x, float y)
+	{
+	/*
+	x to the y is 2 to the (y log2 x). We split x into its exponent and
+	a mantissa between sqrt(1/2) and sqrt(2), whose log comes from a short
+	series. Then we split y log2 x into a whole power of two, which goes
+	straight into the exponent bits, and a fraction, for another series.
+	Anything we can't do that way - negative x, denormals, results which
+	would overflow - goes to libm.
+	*/
+	union
+		{
+		float f;
+		uint32_t u;
+		}
+	bits;
+	float m, t, t2, p, f, out;
+	int e, i;
+	if(!(x >= 1.17549435e-38f && x <= 3.40282347e+38f)) return powf(x, y);
+	bits.f = x;
+	e = (int)(bits.u >> 23) - 127;
+	bits.u = (bits.u & 0x007FFFFF) | 0x3F800000;
+	m = bits.f;
+	if(m > SQRT2_F)
+		{
+		m *= 0.5f;
+		e++;
+		}
+	t = (m - 1.0f) / (m + 1.0f);
+	t2 = t * t;
+	p = y * (((((LOG2_L4 * t2 + LOG2_L3) * t2 + LOG2_L2) * t2 + LOG2_L1) * t2 + LOG2_L0) * t + e);
+	if(!(p > -126.0f && p < 126.0f)) return powf(x, y);
+	i = (p >= 0) ? (int)(p + 0.5f) : -(int)(0.5f - p);
+	f = p - i;
+	out = ((((((EXP2_E7 * f + EXP2_E6) * f + EXP2_E5) * f + EXP2_E4) * f + EXP2_E3) * f + EXP2_E2) * f + EXP2_E1) * f + 1.0f;
+	bits.u = (uint32_t)(i + 127) << 23;
+	return out * bits.f;
+	}
+
+float FastFmod(float x, float y)
+	{
+	//Take off the whole number of ys, then nudge the rest back into range if rounding pushed it out.
+	float ax, ay, r;
+	ax = fabsf(x);
+	ay = fabsf(y);
+	if(!(ay > 0 && ax / ay < 8388608.0f)) return fmod(x, y);
+	r = ax - (float)(int)(ax / ay) * ay;
+	if(r < 0) r += ay;
+	else if(r >= ay) r -= ay;
+	return (x < 0) ? -r : r;
+	}
+
+#if STARFISH_SIMD
+/*
+The array kernels work on blocks of FAST_BLOCK values in GCC vector types.
+The compiler splits a block into as many registers as its target needs,
+so the same kernel becomes 4, 8 or 16 lane code depending on the target
+attribute of the function it is inlined into. Each step matches a step of
+the scalar function, in the same order, so the answers are identical.
+*/
+#define FAST_BLOCK 16
+typedef float fastvec __attribute__((vector_size(FAST_BLOCK * sizeof(float))));
+typedef int32_t fastivec __attribute__((vector_size(FAST_BLOCK * sizeof(float))));
+typedef uint32_t fastuvec __attribute__((vector_size(FAST_BLOCK * sizeof(float))));
+#define FAST_KERNEL static inline __attribute__((always_inline))
+//Lanewise mask ? a : b, where mask lanes are all ones or all zeros.
+#define FAST_SELECT(mask, a, b) ((fastvec)(((fastuvec)(a) & (mask)) | ((fastuvec)(b) & ~(mask))))
+#define SIGN_BIT 0x80000000u
+
+enum fastkernels
+	{
+	fastCosKernel,
+	fastSinKernel,
+	fastAtanKernel
+	};
+
+FAST_KERNEL void FastTrigBlock(const fastvec* vx, fastvec* c, fastvec* s, fastuvec* quadrant)
+	{
+	/*
+	FastTrigReduce for a block. Lanes which are out of range (or NaN) are
+	reduced as if they were zero; the caller sends those to libm.
+	*/
+	fastvec ax, y, r, z;
+	fastivec j;
+	ax = (fastvec)((fastuvec)*vx & ~SIGN_BIT);
+	ax = (fastvec)((fastuvec)ax & (fastuvec)(ax <= (float)FAST_TRIG_LIMIT));
+	j = __builtin_convertvector(ax * FOUR_OVER_PI, fastivec);
+	j = (j + 1) & ~1;
+	y = __builtin_convertvector(j, fastvec);
+	r = ((ax - y * PIO4_A) - y * PIO4_B) - y * PIO4_C;
+	z = r * r;
+	*c = ((COS_C0 * z + COS_C1) * z + COS_C2) * z * z - 0.5f * z + 1.0f;
+	*s = ((SIN_S0 * z + SIN_S1) * z + SIN_S2) * z * r + r;
+	*quadrant = (fastuvec)(j >> 1) & 3;
+	}
+
+FAST_KERNEL void FastCosBlock(const float* x, float* out)
+	{
+	fastvec vx, c, s;
+	fastuvec quadrant, usecos, bits;
+	memcpy(&vx, x, sizeof(vx));
+	FastTrigBlock(&vx, &c, &s, &quadrant);
+	//Quadrants 0 and 2 use the cosine, 1 and 2 are negative.
+	usecos = (fastuvec)((quadrant & 1) == 0);
+	bits = (fastuvec)FAST_SELECT(usecos, c, s) ^ (((quadrant + 1) & 2) << 30);
+	memcpy(out, &bits, sizeof(bits));
+	}
+
+FAST_KERNEL void FastSinBlock(const float* x, float* out)
+	{
+	fastvec vx, c, s;
+	fastuvec quadrant, usesin, bits;
+	memcpy(&vx, x, sizeof(vx));
+	FastTrigBlock(&vx, &c, &s, &quadrant);
+	//Quadrants 0 and 2 use the sine, 2 and 3 are negative, and so is a negative x.
+	usesin = (fastuvec)((quadrant & 1) == 0);
+	bits = (fastuvec)FAST_SELECT(usesin, s, c) ^ ((quadrant & 2) << 30);
+	bits ^= (fastuvec)(vx < 0) & SIGN_BIT;
+	memcpy(out, &bits, sizeof(bits));
+	}
+
+FAST_KERNEL void FastAtanBlock(const float* x, float* out)
+	{
+	fastvec vx, ax, xr, y0, z, result, zero = {0};
+	fastuvec big, mid, bits;
+	memcpy(&vx, x, sizeof(vx));
+	ax = (fastvec)((fastuvec)vx & ~SIGN_BIT);
+	big = (fastuvec)(ax > TAN3PIO8);
+	mid = (fastuvec)(ax > TANPIO8) & ~big;
+	xr = FAST_SELECT(big, -1.0f / ax, FAST_SELECT(mid, (ax - 1.0f) / (ax + 1.0f), ax));
+	y0 = FAST_SELECT(big, zero + PIO2_F, FAST_SELECT(mid, zero + PIO4_F, zero));
+	z = xr * xr;
+	result = (((ATAN_A0 * z + ATAN_A1) * z + ATAN_A2) * z + ATAN_A3) * z * xr + xr + y0;
+	bits = (fastuvec)result ^ ((fastuvec)(vx < 0) & SIGN_BIT);
+	memcpy(out, &bits, sizeof(bits));
+	}
+
+/*
+One copy of the block loop for each instruction set. They differ only in
+their target attributes, which decide how wide the kernels inlined into
+them come out. AVX-512 brings FMA along with it, so that copy turns off
+contraction: a multiply and add fused into one step would round differently.
+*/
+#define FAST_BLOCK_LOOP \
+	for(ctr = 0; ctr < blocks; ctr++, x += FAST_BLOCK, out += FAST_BLOCK) \
+		switch(kernel) \
+			{ \
+			case fastCosKernel: FastCosBlock(x, out); break; \
+			case fastSinKernel: FastSinBlock(x, out); break; \
+			case fastAtanKernel: FastAtanBlock(x, out); break; \
+			}
+
+__attribute__((target("sse2")))
+static void FastBlocksSSE2(int kernel, const float* x, int blocks, float* out)
+	{
+	int ctr;
+	FAST_BLOCK_LOOP
+	}
+
+__attribute__((target("avx2")))
+static void FastBlocksAVX2(int kernel, const float* x, int blocks, float* out)
+	{
+	int ctr;
+	FAST_BLOCK_LOOP
+	}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void FastBlocksAVX512(int kernel, const float* x, int blocks, float* out)
+	{
+	int ctr;
+	FAST_BLOCK_LOOP
+	}
+
+static int FastBlocks(int kernel, const float* x, int blocks, float* out)
+	{
+	//Run whole blocks on the widest kernel the CPU has. Returns 0 if it has none.
+	if(__builtin_cpu_supports("avx512f")) FastBlocksAVX512(kernel, x, blocks, out);
+	else if(__builtin_cpu_supports("avx2")) FastBlocksAVX2(kernel, x, blocks, out);
+	else if(__builtin_cpu_supports("sse2")) FastBlocksSSE2(kernel, x, blocks, out);
+	else return 0;
+	return 1;
+	}
+
+static int FastArray(int kernel, const float* x, int count, float* out)
+	{
+	/*
+	Run the kernel over an array of any length. Whole blocks work straight
+	from the caller's arrays; the last few values get a padded block of
+	their own. Returns 0 if the CPU has no kernels, and the caller must do
+	the work itself.
+	*/
+	float padin[FAST_BLOCK] = {0}, padout[FAST_BLOCK];
+	int blocks, rest;
+	blocks = count / FAST_BLOCK;
+	rest = count - blocks * FAST_BLOCK;
+	if(!FastBlocks(kernel, x, blocks, out)) return 0;
+	if(rest > 0)
+		{
+		memcpy(padin, x + blocks * FAST_BLOCK, rest * sizeof(float));
+		FastBlocks(kernel, padin, 1, padout);
+		memcpy(out + blocks * FAST_BLOCK, padout, rest * sizeof(float));
+		}
+	return 1;
+	}
+#endif //STARFISH_SIMD
+
+void FastCosArray(const float* x, int count, float* out)
+	{
+	int ctr;
+	#if STARFISH_SIMD
+	if(FastArray(fastCosKernel, x, count, out))
+		{
+		//The kernel can't reduce huge arguments; libm gets those, just as in FastCos.
+		for(ctr = 0; ctr < count; ctr++)
+			if(!(fabsf(x[ctr]) <= FAST_TRIG_LIMIT)) out[ctr] = cos(x[ctr]);
+		return;
+		}
+	#endif
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = FastCos(x[ctr]);
+	}
+
+void FastSinArray(const float* x, int count, float* out)
+	{
+	int ctr;
+	#if STARFISH_SIMD
+	if(FastArray(fastSinKernel, x, count, out))
+		{
+		for(ctr = 0; ctr < count; ctr++)
+			if(!(fabsf(x[ctr]) <= FAST_TRIG_LIMIT)) out[ctr] = sin(x[ctr]);
+		return;
+		}
+	#endif
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = FastSin(x[ctr]);
+	}
+
+void FastAtanArray(const float* x, int count, float* out)
+	{
+	int ctr;
+	#if STARFISH_SIMD
+	if(FastArray(fastAtanKernel, x, count, out)) return;
+	#endif
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = FastAtan(x[ctr]);
+	}
+
+void FastHypotArray(const float* x, const float* y, int count, float* out)
+	{
+	//The square root is a single instruction already, so there's no kernel for this.
+	int ctr;
+	for(ctr = 0; ctr < count; ctr++) out[ctr] = FastHypot(x[ctr], y[ctr]);
+	}
+
+/*
+The fast math switch. Each thread has its own, set for whichever layer
+the thread is working on, so nothing one texture does can reach another.
+*/
+#ifndef STARFISH_THREADS
+#define STARFISH_THREADS 0
+#endif
+#if STARFISH_THREADS
+static __thread int fastmath = 0;
+#else
+static int fastmath = 0;
+#endif
+
+int SwapFastMath(int enable)
+	{
+	int old = fastmath;
+	fastmath = (enable != 0);
+	return old;
+	}
+
+int UsingFastMath(void)
+	{
+	return fastmath;
+	}
+
+double gencos(double x)
+	{
+	return fastmath ? FastCos(x) : cos(x);
+	}
+
+double gensin(double x)
+	{
+	return fastmath ? FastSin(x) : sin(x);
+	}
+
+double genatan(double x)
+	{
+	return fastmath ? FastAtan(x) : atan(x);
+	}
+
+double genhypot(double x, double y)
+	{
+	return fastmath ? FastHypot(x, y) : hypot(x, y);
+	}
+
+float genhypotf(float x, float y)
+	{
+	return fastmath ? FastHypot(x, y) : hypotf(x, y);
+	}
+
+float genpowf(float x, float y)
+	{
+	return fastmath ? FastPow(x, y) : powf(x, y);
+	}
+
+double genfmod(double x, double y)
+	{
+	return fastmath ? FastFmod(x, y) : fmod(x, y);
+	}
@@ -27,13 +27,54 @@ A few small gadgets of use to the generator libraries.
 #ifndef __GENUTILS__
 #define __GENUTILS__ 0
 
+#include <stdint.h>
+
 #define pi 3.141592653589
 
-float frand(float range);
-float frandge(float min, float max);
-int irand(int range);
-int irandge(int min, int max);
-int maybe(void);
+/*
+Every texture carries its own random number stream, so textures can be
+built on several threads at once and any texture can be rebuilt exactly
+from its seed. The stream is counter-based: the nth number is a hash of
+the seed and n, so there is no hidden state anywhere but in this record.
+*/
+typedef struct RandomRec
+	{
+	uint64_t seed;
+	uint64_t counter;
+	}
+RandomRec;
+typedef RandomRec* RandRef;
+
+void SeedRandom(RandRef rng, uint64_t seed);
+uint64_t RandomSeed(RandRef rng);
+uint32_t NextRandom(RandRef rng);
+
+float frand(RandRef rng, float range);
+float frandge(RandRef rng, float min, float max);
+int irand(RandRef rng, int range);
+int irandge(RandRef rng, int min, int max);
+int maybe(RandRef rng);
+
+/*
+Settings a layer is built with, besides its random stream. Like the
+stream, they are handed to each generator as it is set up rather than
+kept in globals, so textures with different settings can be built on
+different threads at once. A count of zero means the generator's own
+choice. Only the first three change the pattern; the rest only change how
+quickly it gets built.
+*/
+typedef struct GenOptions
+	{
+	int fastmath;			//use the Fast functions in place of libm; see SwapFastMath
+	int bubbles;			//bubbles in each bubble field, or 0 for a random count
+	int octaves;			//octaves in each Perlin layer, or 0 for a random count
+	int threads;			//big layers may share their set-up among this many threads
+	int lazy;				//build fine detail only where it gets looked at
+	}
+GenOptions;
+typedef const GenOptions* GenOptionsRef;
+
+void DefaultGenOptions(GenOptions* out);
 
 enum packmethods
 	{
@@ -43,7 +84,113 @@ enum packmethods
 	slopeToFit,
 	PACK_METHOD_COUNT
 	};
-int RandomPackMethod(void);
+int RandomPackMethod(RandRef rng);
 float PackedCos(float distance, float scale, int packmethod);
+/*
+PackedCos for a run of distances, all at the same scale. A generator picks
+its pack method once, when it is set up, so rather than switching on the
+method at every point it can look up the kernel for that method with
+PackedCosKernel and keep it. The kernels give exactly what PackedCos gives
+point by point, with fast math or without it; with it, they work out their
+cosines with the array kernels. out may be the same array as distance.
+*/
+typedef void (*PackedCosProc)(const float* distance, float scale, int count, float* out);
+PackedCosProc PackedCosKernel(int packmethod);
+/*
+PackedCos at count evenly spaced distances: start, start + step, and so
+on. Rather than a cosine for every point, it starts from one cosine and
+sine and turns them through the same angle at each step, in double
+precision, pulling the pair back to unit length every PACKED_COS_RENORM
+steps. Over a run of a few hundred the drift stays below 1e-13, far under
+the rounding of the float results, so they are closer to the truth than
+PackedCos, which rounds each distance times scale to single precision
+first; the two differ by about scale * |distance| * 6e-8. Like the fast
+math functions, the values can land on the other side of a jump in the
+packing.
+*/
+void PackedCosRun(double start, double step, float scale, int count, int packmethod, float* out);
+#define PACKED_COS_RENORM 16
+
+/*
+Helpers for generators that report bounds on their values.
+PackedCosBounds gives the least and greatest values PackedCos can return
+for any distance from lo to hi. RectDistanceBounds gives the nearest and
+farthest distance from the point h, v to any point in a rectangle.
+Both err on the wide side, never the narrow one.
+*/
+void PackedCosBounds(float lo, float hi, float scale, int packmethod, float* outlo, float* outhi);
+void RectDistanceBounds
+		(
+		float left, float top, float right, float bottom,
+		float h, float v,
+		float* nearest, float* farthest
+		);
+
+/*
+Fast math. Generators spend most of their time in libm, working out
+cosines and arctangents in double precision for values which end up as
+one of 256 grey levels. The Fast functions are single precision polynomial
+approximations. Measured against double precision libm, the worst errors are:
+
+	FastCos, FastSin	8e-8 absolute, for |x| up to FAST_TRIG_LIMIT
+	FastAtan			2.1e-7 relative
+	FastHypot			1.2e-7 relative, for |x| and |y| from 1e-18 to 1e18
+	FastPow				1.1e-6 relative for |y log2 x| below 16, growing in step past that
+	FastFmod			|x| * 6e-8 absolute
+
+Outside those ranges they hand the work back to libm. FastPow only does
+that when the result would be out of range for a float. And FastFmod's
+result can land on the other side of a jump where x is almost an exact
+multiple of y.
+
+The Array forms do count values at a time. Where the compiler supports it
+they work in blocks of 16 lanes, which the CPU runs 4 (SSE2), 8 (AVX2) or
+16 (AVX-512) at a time, picked at run time. Every form gives exactly the
+same results as the scalar function.
+*/
+float FastCos(float x);
+float FastSin(float x);
+float FastAtan(float x);
+float FastHypot(float x, float y);
+float FastPow(float x, float y);
+float FastFmod(float x, float y);
+void FastCosArray(const float* x, int count, float* out);
+void FastSinArray(const float* x, int count, float* out);
+void FastAtanArray(const float* x, int count, float* out);
+void FastHypotArray(const float* x, const float* y, int count, float* out);
+//Cosine and sine arguments past this go to libm.
+#define FAST_TRIG_LIMIT 8192.0
+
+/*
+Generators call these in place of their libm namesakes. They are exactly
+libm unless fast math is switched on, in which case they use the Fast
+functions above. Fast math is off by default, so reference renders come
+out the same as always. The switch belongs to the calling thread, not the
+process: a layer built with fast math in its options has it switched on
+by the layer manager while its generator works, and back again after.
+So textures with and without it can be built and rendered side by side.
+SwapFastMath sets the calling thread's switch and returns the old setting.
+*/
+int SwapFastMath(int enable);
+int UsingFastMath(void);
+double gencos(double x);
+double gensin(double x);
+double genatan(double x);
+double genhypot(double x, double y);
+float genhypotf(float x, float y);
+float genpowf(float x, float y);
+double genfmod(double x, double y);
+
+/*
+The array kernels need GCC-style vector extensions and target attributes.
+Build with STARFISH_SIMD set to 0 to use only the scalar ones.
+*/
+#ifndef STARFISH_SIMD
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STARFISH_SIMD 1
+#else
+#define STARFISH_SIMD 0
+#endif
+#endif
 
-#endif		//__GENUTILS__
\ No newline at end of file
+#endif		//__GENUTILS__
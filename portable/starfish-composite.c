@@ -0,0 +1,302 @@
+/*
+
+This file is part of xstarfish
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Starfish compositor
+
+See starfish-composite.h for what this does. Merging a layer happens in
+two steps. First a piece of the layer's image and mask values is turned into
+colours with the same layout as the buffer; that is just a table lookup per
+pixel. Then the piece is blended in behind the buffer. Working in pieces
+keeps the scratch space small, however big the buffer is. There are three
+versions of the blend: a portable one which handles a pixel at a time, and
+SSE2 and AVX2 ones which handle 8 and 16 pixels at a time. They all do the
+same integer arithmetic, so they all produce the same pixels; the vector
+kernels hand any leftover pixels at the end of the run to the portable one.
+
+*/
+
+#include "starfish-composite.h"
+
+#if STARFISH_SIMD
+#include <immintrin.h>
+#endif
+
+//How many pixels of a layer we colour at a time.
+#define LAYER_PIECE 256
+
+/*
+One piece of a layer, coloured. The blend kernels get pointers to the
+buffer's channels, already offset to the start of the piece.
+*/
+typedef struct LayerPiece
+	{
+	unsigned short red[LAYER_PIECE];
+	unsigned short green[LAYER_PIECE];
+	unsigned short blue[LAYER_PIECE];
+	unsigned short alpha[LAYER_PIECE];
+	}
+LayerPiece;
+
+typedef struct BlendTarget
+	{
+	unsigned short* red;
+	unsigned short* green;
+	unsigned short* blue;
+	unsigned short* alpha;
+	}
+BlendTarget;
+
+static int BlendLayerScalar
+		(
+		const BlendTarget* buf,
+		const LayerPiece* layer,
+		int first,
+		int count,
+		int cutoff_threshold
+		);
+#if STARFISH_SIMD
+static int BlendKernel(void);
+static int BlendLayerSSE2(const BlendTarget* buf, const LayerPiece* layer, int count, int cutoff_threshold);
+static int BlendLayerAVX2(const BlendTarget* buf, const LayerPiece* layer, int count, int cutoff_threshold);
+#endif
+
+void ClearCompositeBuf(CompositeBuf* buf, int count)
+	{
+	int ctr;
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		buf->red[ctr] = buf->green[ctr] = buf->blue[ctr] = buf->alpha[ctr] = 0;
+		}
+	}
+
+void UnpackCompositeBuf(const CompositeBuf* buf, int first, int count, pixel* out)
+	{
+	int ctr;
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		out[ctr].red = buf->red[first + ctr];
+		out[ctr].green = buf->green[first + ctr];
+		out[ctr].blue = buf->blue[first + ctr];
+		out[ctr].alpha = buf->alpha[first + ctr];
+		}
+	}
+
+int CompositeLayerSpan
+		(
+		CompositeBuf* buf,
+		int count,
+		const channelval* image,
+		const channelval* mask,
+		int invertmask,
+		const pixel* ramp,
+		int cutoff_threshold
+		)
+	{
+	LayerPiece layer;
+	BlendTarget target;
+	int first, ctr, opaque = 0;
+	#if STARFISH_SIMD
+	int kernel = BlendKernel();
+	#endif
+	if(!buf || !image || !ramp || count <= 0) return 0;
+	if(count > COMPOSITE_SPAN) count = COMPOSITE_SPAN;
+	if(!mask) mask = image;
+	/*
+	The vector kernels compare opacity in signed 16-bit lanes. Any threshold
+	at or above MAX_CHANVAL already makes every pixel opaque, so clamping it
+	here changes nothing but keeps those sums from overflowing.
+	*/
+	if(cutoff_threshold > CHANNEL_RANGE) cutoff_threshold = CHANNEL_RANGE;
+	if(cutoff_threshold < -CHANNEL_RANGE) cutoff_threshold = -CHANNEL_RANGE;
+	for(first = 0; first < count; first += LAYER_PIECE)
+		{
+		int piece = (count - first < LAYER_PIECE) ? count - first : LAYER_PIECE;
+		/*
+		Colour this piece of the layer. The alpha channel is the mask value,
+		inverted if the layer asks for it. Pixels which are already opaque
+		get coloured too, but the blend never uses them.
+		*/
+		for(ctr = 0; ctr < piece; ctr++)
+			{
+			const pixel* colour = &ramp[image[first + ctr]];
+			channelval maskval = mask[first + ctr];
+			layer.red[ctr] = colour->red;
+			layer.green[ctr] = colour->green;
+			layer.blue[ctr] = colour->blue;
+			layer.alpha[ctr] = invertmask ? MAX_CHANVAL - maskval : maskval;
+			}
+		target.red = &buf->red[first];
+		target.green = &buf->green[first];
+		target.blue = &buf->blue[first];
+		target.alpha = &buf->alpha[first];
+		#if STARFISH_SIMD
+		if(kernel == 2)
+			{
+			opaque += BlendLayerAVX2(&target, &layer, piece, cutoff_threshold);
+			continue;
+			}
+		if(kernel == 1)
+			{
+			opaque += BlendLayerSSE2(&target, &layer, piece, cutoff_threshold);
+			continue;
+			}
+		#endif
+		opaque += BlendLayerScalar(&target, &layer, 0, piece, cutoff_threshold);
+		}
+	return opaque;
+	}
+
+static int BlendLayerScalar
+		(
+		const BlendTarget* buf,
+		const LayerPiece* layer,
+		int first,
+		int count,
+		int cutoff_threshold
+		)
+	{
+	/*
+	Blend pixels first through count-1 of the layer in behind the buffer.
+	This is the arithmetic every other kernel has to match.
+	*/
+	int ctr, opaque = 0;
+	for(ctr = first; ctr < count; ctr++)
+		{
+		unsigned int a, ia, layeralpha;
+		a = buf->alpha[ctr];
+		if(a == MAX_CHANVAL)
+			{
+			opaque++;
+			continue;
+			}
+		//The layer shows through in the proportion the existing alpha leaves uncovered.
+		ia = CHANNEL_RANGE - a;
+		buf->red[ctr] = (buf->red[ctr] * a + layer->red[ctr] * ia) >> 8;
+		buf->green[ctr] = (buf->green[ctr] * a + layer->green[ctr] * ia) >> 8;
+		buf->blue[ctr] = (buf->blue[ctr] * a + layer->blue[ctr] * ia) >> 8;
+		//Add the opacity this layer contributes; close enough to opaque counts as opaque.
+		layeralpha = (layer->alpha[ctr] * (MAX_CHANVAL - a)) >> 8;
+		if((int)(layeralpha + a) + cutoff_threshold >= MAX_CHANVAL)
+			{
+			buf->alpha[ctr] = MAX_CHANVAL;
+			opaque++;
+			}
+		else buf->alpha[ctr] = a + layeralpha;
+		}
+	return opaque;
+	}
+
+#if STARFISH_SIMD
+
+/*
+The vector kernels follow the scalar one step for step. Every product and
+sum fits in 16 unsigned bits, so the low half of each 16-bit multiply is the
+whole answer. Pixels which were already opaque are computed along with the
+rest, then the old values are selected back in over the results.
+*/
+
+static int BlendKernel(void)
+	{
+	/*
+	Which blend the CPU can run: 2 for AVX2, 1 for SSE2, 0 for neither.
+	We only ask the CPU once. Threads which get here together all work out
+	the same answer, so it doesn't matter which of them stores it.
+	*/
+	static volatile int kernel = -1;
+	if(kernel < 0)
+		{
+		if(__builtin_cpu_supports("avx2")) kernel = 2;
+		else if(__builtin_cpu_supports("sse2")) kernel = 1;
+		else kernel = 0;
+		}
+	return kernel;
+	}
+
+__attribute__((target("sse2")))
+static int BlendLayerSSE2(const BlendTarget* buf, const LayerPiece* layer, int count, int cutoff_threshold)
+	{
+	const __m128i range = _mm_set1_epi16(CHANNEL_RANGE);
+	const __m128i maxval = _mm_set1_epi16(MAX_CHANVAL);
+	const __m128i limit = _mm_set1_epi16(MAX_CHANVAL - 1 - cutoff_threshold);
+	int ctr, opaque = 0;
+	for(ctr = 0; ctr + 8 <= count; ctr += 8)
+		{
+		__m128i a, ia, m, done, out, blend, nowopaque;
+		a = _mm_loadu_si128((const __m128i*)&buf->alpha[ctr]);
+		done = _mm_cmpeq_epi16(a, maxval);
+		ia = _mm_sub_epi16(range, a);
+		#define SSE2_CHANNEL(chan) \
+			out = _mm_loadu_si128((const __m128i*)&buf->chan[ctr]); \
+			blend = _mm_loadu_si128((const __m128i*)&layer->chan[ctr]); \
+			blend = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(out, a), _mm_mullo_epi16(blend, ia)), 8); \
+			out = _mm_or_si128(_mm_and_si128(done, out), _mm_andnot_si128(done, blend)); \
+			_mm_storeu_si128((__m128i*)&buf->chan[ctr], out);
+		SSE2_CHANNEL(red)
+		SSE2_CHANNEL(green)
+		SSE2_CHANNEL(blue)
+		#undef SSE2_CHANNEL
+		m = _mm_loadu_si128((const __m128i*)&layer->alpha[ctr]);
+		blend = _mm_add_epi16(a, _mm_srli_epi16(_mm_mullo_epi16(m, _mm_sub_epi16(maxval, a)), 8));
+		nowopaque = _mm_or_si128(done, _mm_cmpgt_epi16(blend, limit));
+		out = _mm_or_si128(_mm_and_si128(nowopaque, maxval), _mm_andnot_si128(nowopaque, blend));
+		_mm_storeu_si128((__m128i*)&buf->alpha[ctr], out);
+		//Each 16-bit lane contributes two bits to the byte mask.
+		opaque += __builtin_popcount(_mm_movemask_epi8(nowopaque)) / 2;
+		}
+	return opaque + BlendLayerScalar(buf, layer, ctr, count, cutoff_threshold);
+	}
+
+__attribute__((target("avx2")))
+static int BlendLayerAVX2(const BlendTarget* buf, const LayerPiece* layer, int count, int cutoff_threshold)
+	{
+	const __m256i range = _mm256_set1_epi16(CHANNEL_RANGE);
+	const __m256i maxval = _mm256_set1_epi16(MAX_CHANVAL);
+	const __m256i limit = _mm256_set1_epi16(MAX_CHANVAL - 1 - cutoff_threshold);
+	int ctr, opaque = 0;
+	for(ctr = 0; ctr + 16 <= count; ctr += 16)
+		{
+		__m256i a, ia, m, done, out, blend, nowopaque;
+		a = _mm256_loadu_si256((const __m256i*)&buf->alpha[ctr]);
+		done = _mm256_cmpeq_epi16(a, maxval);
+		ia = _mm256_sub_epi16(range, a);
+		#define AVX2_CHANNEL(chan) \
+			out = _mm256_loadu_si256((const __m256i*)&buf->chan[ctr]); \
+			blend = _mm256_loadu_si256((const __m256i*)&layer->chan[ctr]); \
+			blend = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(out, a), _mm256_mullo_epi16(blend, ia)), 8); \
+			_mm256_storeu_si256((__m256i*)&buf->chan[ctr], _mm256_blendv_epi8(blend, out, done));
+		AVX2_CHANNEL(red)
+		AVX2_CHANNEL(green)
+		AVX2_CHANNEL(blue)
+		#undef AVX2_CHANNEL
+		m = _mm256_loadu_si256((const __m256i*)&layer->alpha[ctr]);
+		blend = _mm256_add_epi16(a, _mm256_srli_epi16(_mm256_mullo_epi16(m, _mm256_sub_epi16(maxval, a)), 8));
+		nowopaque = _mm256_or_si256(done, _mm256_cmpgt_epi16(blend, limit));
+		_mm256_storeu_si256((__m256i*)&buf->alpha[ctr], _mm256_blendv_epi8(blend, maxval, nowopaque));
+		opaque += __builtin_popcount(_mm256_movemask_epi8(nowopaque)) / 2;
+		}
+	/*
+	Clear the upper halves of the registers before going back to code
+	without AVX; otherwise every SSE instruction after us, here and in the
+	generators, pays for switching between the two.
+	*/
+	_mm256_zeroupper();
+	return opaque + BlendLayerScalar(buf, layer, ctr, count, cutoff_threshold);
+	}
+
+#endif //STARFISH_SIMD
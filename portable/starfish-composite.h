@@ -0,0 +1,93 @@
+/*
+
+This file is part of xstarfish
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Starfish compositor
+
+The engine builds each pixel by merging layers one behind another. This
+module does that merging for a whole run of pixels at once, in integer
+arithmetic. Each channel of the run lives in its own array of 16-bit
+values, so that SIMD kernels can blend 8 (SSE2) or 16 (AVX2) pixels per
+instruction. The kernel is picked at run time from what the CPU supports.
+
+Layers are coloured by looking their image values up in a gradient ramp,
+a table of CHANNEL_RANGE colours which the engine builds once per layer.
+Every kernel produces exactly the same pixels, and every intermediate value
+in the blend fits in 16 unsigned bits.
+
+*/
+
+#ifndef __starfish_composite__
+#define __starfish_composite__ 0
+
+#include "starfish-rasterlib.h"
+
+/*
+The SIMD kernels need GCC-style target attributes and x86 intrinsics.
+Build with STARFISH_SIMD set to 0 to use only the portable kernel.
+*/
+#ifndef STARFISH_SIMD
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STARFISH_SIMD 1
+#else
+#define STARFISH_SIMD 0
+#endif
+#endif
+
+/*
+The most pixels a CompositeBuf can hold: enough for a 64 by 64 tile.
+The buffer takes eight bytes per pixel.
+*/
+#define COMPOSITE_SPAN 4096
+
+//A run of pixels under construction, one array per channel.
+typedef struct CompositeBuf
+	{
+	unsigned short red[COMPOSITE_SPAN];
+	unsigned short green[COMPOSITE_SPAN];
+	unsigned short blue[COMPOSITE_SPAN];
+	unsigned short alpha[COMPOSITE_SPAN];
+	}
+CompositeBuf;
+
+//Set the first count pixels of the buffer to transparent black.
+void ClearCompositeBuf(CompositeBuf* buf, int count);
+//Copy count pixels, starting at pixel first of the buffer, out into ordinary pixels.
+void UnpackCompositeBuf(const CompositeBuf* buf, int first, int count, pixel* out);
+
+/*
+Merge one layer in behind the first count pixels of the buffer.
+image holds the layer's image values. mask holds its mask values; pass
+the image again if the layer is its own mask. Each image value picks its
+colour out of the layer's ramp. Pixels which are already opaque
+(alpha of MAX_CHANVAL) are left alone. Any pixel whose opacity comes
+within cutoff_threshold of MAX_CHANVAL becomes fully opaque.
+Returns the number of pixels in the run which are now opaque.
+*/
+int CompositeLayerSpan
+		(
+		CompositeBuf* buf,
+		int count,
+		const channelval* image,
+		const channelval* mask,
+		int invertmask,
+		const pixel* ramp,
+		int cutoff_threshold
+		);
+
+#endif //__starfish_composite__
@@ -65,16 +65,20 @@ in terms of point-by-point image grabbing internally.
 #include "starfish-engine.h"
 #include "generators.h"
 #include "starfish-rasterlib.h"
+#include "starfish-composite.h"
 #include "genutils.h"
 #include <stdlib.h>
 #include <time.h>
 #include <stdio.h>
+#if STARFISH_THREADS
+#include <pthread.h>
+#endif
 
 #if TEST_MODE
 #define MAX_LAYERS 1
 #define MIN_LAYERS 1
 #else
-#define MAX_LAYERS 6
+#define MAX_LAYERS STARFISH_MAX_LAYERS
 #define MIN_LAYERS 2
 #endif
 
@@ -83,10 +87,8 @@ typedef struct ColourLayerRec
 	{
 	//The image layer, a reference to a layer generator:
 	LayerRef image;
-	//The foreground colour, used for high image values.
-	pixel fore;
-	//The background colour, used for low image values.
-	pixel back;
+	//The colour for each image value, baked from the layer's gradient.
+	pixel ramp[CHANNEL_RANGE];
 	//The mask image. If NULL, we use the image layer as its own mask.
 	LayerRef mask;
 	//If the flag is true, we invert the mask.
@@ -98,125 +100,308 @@ typedef struct StarfishTexRec
 	{
 	/*
 	A starfish texture is an array of colour layers.
-	Count must be greater than 0 and less than or equal to MAX_LAYERS.
+	Count must be greater than 0 and less than or equal to STARFISH_MAX_LAYERS.
 	tex[count] and above are undefined.
 	*/
 	int count;
 	int width, height;
 	int cutoff_threshold;
+	//The recipe we built the layers from.
+	StarfishRecipe recipe;
+	//The shared, read-only list of generators our layers come from.
 	GenListRef list;
-	StarfishPalette colours;
-	ColourLayerRec tex[MAX_LAYERS];
+	ColourLayerRec tex[STARFISH_MAX_LAYERS];
 	}
 StarfishTexRec;
 
-static void RandomPalettePixel(const StarfishPalette* colours, pixel* out);
+/*
+GetStarfishSpan works through long rows in chunks of this many pixels,
+so that its scratch space can live on the stack. A chunk has to fit in
+one compositor buffer.
+*/
+#define SPAN_CHUNK COMPOSITE_SPAN
+
+/*
+RenderStarfish cuts the image into square tiles of this many pixels on a side.
+Worker threads take the next unrendered tile until there are none left.
+A whole tile has to fit in one compositor buffer.
+*/
+#define RENDER_TILE_SIZE 64
+#if RENDER_TILE_SIZE * RENDER_TILE_SIZE > COMPOSITE_SPAN
+#error "RENDER_TILE_SIZE is too big for the compositor"
+#endif
+
+typedef struct RenderJobRec
+	{
+	StarfishRef texture;
+	pixbuf dest;
+	int tilesacross;
+	int tilecount;
+	int nexttile;
+	#if STARFISH_THREADS
+	//Only true while extra workers are running; otherwise the lock is unused.
+	int threaded;
+	pthread_mutex_t lock;
+	#endif
+	}
+RenderJobRec;
+
+static int NextRenderTile(RenderJobRec* job);
+static void RenderTile(RenderJobRec* job, int tile);
+static void* RenderWorker(void* job);
+static void ComposeStarfishBlock
+		(
+		StarfishRef texture,
+		int h,
+		int v,
+		int width,
+		int height,
+		CompositeBuf* buf
+		);
+static void FillBlockLayer
+		(
+		int h,
+		int v,
+		int width,
+		int height,
+		const CompositeBuf* buf,
+		LayerRef layer,
+		channelval lo,
+		channelval hi,
+		channelval* out
+		);
+static int RandomPalettePixel(const StarfishPalette* colours, pixel* out, RandRef rng);
+static void RollStarfishRecipe(uint64_t seed, const StarfishPalette* colours, int ramps, StarfishRecipe* out);
+static void ReverseGradient(StarfishGradient* gradient);
+static int MergeLayerPixel
+		(
+		pixel* outval,
+		channelval imageval,
+		channelval maskval,
+		const ColourLayerRec* layer,
+		int cutoff_threshold
+		);
 
 StarfishRef MakeStarfish(int hsize, int vsize, const StarfishPalette* colours)
+	{
+	/*
+	Make a texture from a seed picked with rand(). RAND_MAX may be as
+	small as 32767, so all we can count on from each call is 15 bits;
+	five calls fill the 64.
+	*/
+	uint64_t seed = 0;
+	int ctr;
+	for(ctr = 0; ctr < 5; ctr++) seed = (seed << 15) ^ (uint64_t)rand();
+	return MakeSeededStarfish(hsize, vsize, colours, seed);
+	}
+
+StarfishRef MakeSeededStarfish(int hsize, int vsize, const StarfishPalette* colours, uint64_t seed)
+	{
+	/*
+	Roll up a recipe from this seed, then build the texture it describes.
+	*/
+	StarfishRecipe recipe;
+	RandomStarfishRecipe(seed, colours, &recipe);
+	return MakeStarfishFromRecipe(&recipe, hsize, vsize);
+	}
+
+void RandomStarfishRecipe(uint64_t seed, const StarfishPalette* colours, StarfishRecipe* out)
+	{
+	//Each layer fades between two colours.
+	RollStarfishRecipe(seed, colours, 0, out);
+	}
+
+void RandomStarfishRampRecipe(uint64_t seed, const StarfishPalette* colours, StarfishRecipe* out)
+	{
+	//Each layer runs through the whole palette.
+	RollStarfishRecipe(seed, colours, !0, out);
+	}
+
+static void RollStarfishRecipe(uint64_t seed, const StarfishPalette* colours, int ramps, StarfishRecipe* out)
+	{
+	/*
+	Make all of the random decisions that go into a texture.
+	Each layer's generator gets a seed of its own, which it will use to
+	pick all of its settings when the texture is built. None of this
+	depends on the size of the texture, so the recipe can be built at any
+	resolution later on.
+	Every random decision comes from our own stream, so nothing here
+	touches any global state.
+	With ramps set, each layer's gradient is the whole palette, from
+	PaletteGradient. We still pick the two colours a plain recipe would,
+	so the layers and their seeds stay the same, and the ramp runs from
+	the back colour's end of the palette towards the fore colour's.
+	*/
+	RandomRec rng;
+	StarfishPalette palette;
+	pixel fore, back;
+	GenListRef list = SharedGenerators();
+	int ctr, backindex, foreindex;
+	if(!out) return;
+	SeedRandom(&rng, seed);
+	out->seed = seed;
+	//How many layers are we going to use?
+	out->count = irandge(&rng, MIN_LAYERS, MAX_LAYERS);
+	out->cutoff_threshold = irand(&rng, MAX_CHANVAL / 16);
+	//Fast math is off, and the generators' own settings are left to them.
+	out->fastmath = 0;
+	out->bubbles = 0;
+	out->octaves = 0;
+	//Copy in the colour palette, if we were given one.
+	palette.colourcount = 0;
+	if(colours && colours->colourcount > 1)
+		{
+		palette = *colours;
+		if(palette.colourcount >= MAX_PALETTE_ENTRIES)
+			{
+			palette.colourcount = MAX_PALETTE_ENTRIES - 1;
+			}
+		}
+	/*
+	Now pick the generators to use for the image and mask of each layer.
+	Half the time, we use the image as its own mask.
+	Half the time, we invert the mask.
+	*/
+	for(ctr = 0; ctr < out->count; ctr++)
+		{
+		StarfishLayerRecipe* layer = &out->layer[ctr];
+		#if TEST_MODE
+		layer->image = TEST_GENERATOR;
+		#else
+		layer->image = irand(&rng, CountGenerators(list));
+		#endif
+		layer->imageseed = RandomSeed(&rng);
+		//Flip a coin. If it lands heads-up, use another generator as a mask.
+		if(maybe(&rng))
+			{
+			layer->mask = irand(&rng, CountGenerators(list));
+			layer->maskseed = RandomSeed(&rng);
+			}
+		else
+			{
+			layer->mask = NO_MASK_GENERATOR;
+			layer->maskseed = 0;
+			}
+		//Flip another coin. If it lands heads-up, set the flag so we invert this layer.
+		layer->invertmask = (maybe(&rng));
+		//Now pick some random colours to use as fore and back of gradients.
+		#if TEST_MODE
+		back.red = back.green = back.blue = MIN_CHANVAL;
+		fore.red = fore.green = fore.blue = MAX_CHANVAL;
+		backindex = foreindex = 0;
+		#else
+		backindex = RandomPalettePixel(&palette, &back, &rng);
+		//The fore and back colours should NEVER be equal. 
+		//Keep picking random colours until they don't match.
+		do
+			{
+			foreindex = RandomPalettePixel(&palette, &fore, &rng);
+			
+			}
+		while
+			(
+			fore.red == back.red &&
+			fore.green == back.green &&
+			fore.blue == back.blue
+			);
+		#endif
+		//Palettes of one colour are ignored, so there is nothing to ramp through.
+		if(ramps && palette.colourcount > 1)
+			{
+			PaletteGradient(&palette, &layer->gradient);
+			if(backindex > foreindex) ReverseGradient(&layer->gradient);
+			}
+		else TwoColourGradient(&back, &fore, &layer->gradient);
+		}
+	}
+
+StarfishRef MakeStarfishFromRecipe(const StarfishRecipe* recipe, int hsize, int vsize)
+	{
+	//Build everything now, on this thread.
+	return BuildStarfishFromRecipe(recipe, hsize, vsize, 1, 0);
+	}
+
+StarfishRef BuildStarfishFromRecipe(const StarfishRecipe* recipe, int hsize, int vsize, int threads, int lazy)
 	{
 	/*
 	Create a series of layers which we will later use to generate
 	pixel data. These will contain the complete package of settings
 	used to calculate image values.
+	The recipe tells us which generators to use and how to seed them,
+	so the same recipe always gives us the same texture, scaled to
+	whatever size we are asked for.
 	*/
 	StarfishRef out = NULL;
 	int dead = 0;		//error flag we set if allocations failed
+	GenOptions options;
+	//Is this a recipe we can actually cook?
+	if(!recipe || recipe->count < 1 || recipe->count > STARFISH_MAX_LAYERS) return NULL;
 	out = (StarfishRef)malloc(sizeof(StarfishTexRec));
 	if(out)
 		{
 		int ctr;
-		//How many layers are we going to use?
-		out->count = irandge(MIN_LAYERS, MAX_LAYERS);
+		out->recipe = *recipe;
+		out->count = recipe->count;
 		out->width = hsize;
 		out->height = vsize;
-		out->cutoff_threshold = irand(MAX_CHANVAL / 16);
-		//Copy in the colour palette, if we were given one.
-		if(colours)
+		out->cutoff_threshold = recipe->cutoff_threshold;
+		//Hand the generators the settings the recipe asks for.
+		DefaultGenOptions(&options);
+		options.fastmath = recipe->fastmath;
+		options.bubbles = recipe->bubbles;
+		options.octaves = recipe->octaves;
+		//And how the caller wants them built, which only changes how long it takes.
+		options.threads = threads;
+		options.lazy = lazy;
+		//Look up the generators we can use. Everybody shares the same list.
+		out->list = SharedGenerators();
+		/*
+		Clear out the values in the array before we begin allocating things.
+		This makes recovery a lot easier if we fail midway through the allocation.
+		*/
+		for(ctr = 0; ctr < out->count; ctr++)
 			{
-			if(colours->colourcount > 1)
-				{
-				out->colours = *colours;
-				if(out->colours.colourcount >= MAX_PALETTE_ENTRIES)
-					{
-					out->colours.colourcount = MAX_PALETTE_ENTRIES - 1;
-					}
-				}
-			else out->colours.colourcount = 0;
+			out->tex[ctr].image = NULL;
+			out->tex[ctr].mask = NULL;
 			}
-		else out->colours.colourcount = 0;
-		//Load up all of the generators we can use.
-		out->list = LoadGenerators();
-		//Make some texture layers to generate from.
-		if(out->list)
+		//Now make the layers the recipe calls for.
+		for(ctr = 0; ctr < out->count; ctr++)
 			{
-			/*
-			Clear out the values in the array before we begin allocating things.
-			This makes recovery a lot easier if we fail midway through the allocation.
-			*/
-			for(ctr = 0; ctr < out->count; ctr++)
+			const StarfishLayerRecipe* layer = &recipe->layer[ctr];
+			RandomRec rng;
+			//Bake the gradient first; there is no point building generators for a bogus one.
+			if(!BuildGradientRamp(&layer->gradient, out->tex[ctr].ramp))
+				{
+				dead = !0;
+				break;
+				}
+			SeedRandom(&rng, layer->imageseed);
+			out->tex[ctr].image = MakeLayer(layer->image, hsize, vsize, out->list, &rng, &options);
+			//If we successfully created the image layer, see about creating a mask.
+			//Otherwise, die now.
+			if(!out->tex[ctr].image)
 				{
-				out->tex[ctr].image = NULL;
-				out->tex[ctr].mask = NULL;
+				dead = !0;
+				break;
 				}
-			/*
-			Now allocate random layers to use for the image and mask of this layer.
-			Half the time, we use the image as its own mask.
-			Half the time, we invert the mask.
-			*/
-			for(ctr = 0; ctr < out->count; ctr++)
+			if(layer->mask != NO_MASK_GENERATOR)
 				{
-				int genid;
-				#if TEST_MODE
-				genid = TEST_GENERATOR;
-				#else
-				genid = irand(CountGenerators(out->list));
-				#endif
-				out->tex[ctr].image = MakeLayer(genid, hsize, vsize, out->list);
-				//If we successfully created the image layer, see about creating a mask.
-				//Otherwise, die now.
-				if(!out->tex[ctr].image)
+				SeedRandom(&rng, layer->maskseed);
+				out->tex[ctr].mask = MakeLayer(layer->mask, hsize, vsize, out->list, &rng, &options);
+				if(!out->tex[ctr].mask)
 					{
 					dead = !0;
 					break;
 					}
-				//Flip a coin. If it lands heads-up, create another layer for use as a mask.
-				if(maybe())
-					{
-					out->tex[ctr].mask = MakeLayer((rand() * CountGenerators(out->list)) / RAND_MAX, hsize, vsize, out->list);
-					}
-				//Flip another coin. If it lands heads-up, set the flag so we invert this layer.
-				out->tex[ctr].invertmask = (maybe());
-				//Now pick some random colours to use as fore and back of gradients.
-				#if TEST_MODE
-				out->tex[ctr].back.red = out->tex[ctr].back.green = out->tex[ctr].back.blue = MIN_CHANVAL;
-				out->tex[ctr].fore.red = out->tex[ctr].fore.green = out->tex[ctr].fore.blue = MAX_CHANVAL;
-				#else
-				RandomPalettePixel(&out->colours, &out->tex[ctr].back);
-				//The fore and back colours should NEVER be equal. 
-				//Keep picking random colours until they don't match.
-				do
-					{
-					RandomPalettePixel(&out->colours, &out->tex[ctr].fore);
-					
-					}
-				while
-					(
-					out->tex[ctr].fore.red == out->tex[ctr].back.red &&
-					out->tex[ctr].fore.green == out->tex[ctr].back.green &&
-					out->tex[ctr].fore.blue == out->tex[ctr].back.blue
-					);
-				#endif
 				}
+			out->tex[ctr].invertmask = layer->invertmask;
 			}
-		else dead = (!0);	//we failed to load the list of generators
 		/*
 		Did we fail while setting up the layers? If so, throw away
 		any layers we did successfully create.
 		*/
 		if(dead)
 			{
-			//If we have a generator list, unload it.
-			if(out->list) UnloadGenerators(out->list);
 			//Run through the list of colourtexlayers and throw away any grey layers
 			//we managed to allocate.
 			for(ctr = 0; ctr < out->count; ctr++)
@@ -232,6 +417,119 @@ StarfishRef MakeStarfish(int hsize, int vsize, const StarfishPalette* colours)
 	return out;
 	}
 
+int GetStarfishRecipe(StarfishRef texture, StarfishRecipe* out)
+	{
+	//Hand back a copy of the recipe this texture was built from.
+	if(!texture || !out) return 0;
+	*out = texture->recipe;
+	return !0;
+	}
+
+void TwoColourGradient(const pixel* back, const pixel* fore, StarfishGradient* out)
+	{
+	/*
+	The classic starfish gradient: back at the bottom, fore at the top.
+	The top stop sits at CHANNEL_RANGE, just past the highest image value,
+	so the brightest pixels fall a hair short of the fore colour.
+	*/
+	if(!back || !fore || !out) return;
+	out->count = 2;
+	out->stop[0].position = 0;
+	out->stop[0].colour = *back;
+	out->stop[0].colour.alpha = MAX_CHANVAL;
+	out->stop[1].position = CHANNEL_RANGE;
+	out->stop[1].colour = *fore;
+	out->stop[1].colour.alpha = MAX_CHANVAL;
+	}
+
+int PaletteGradient(const StarfishPalette* colours, StarfishGradient* out)
+	{
+	/*
+	Spread the palette's colours evenly along the gradient. If there are
+	too many to use them all, we take an even sample, always including
+	the first and last.
+	*/
+	int colourcount, ctr;
+	if(!colours || !out || colours->colourcount < 1) return 0;
+	colourcount = colours->colourcount;
+	if(colourcount > MAX_PALETTE_ENTRIES) colourcount = MAX_PALETTE_ENTRIES;
+	out->count = (colourcount < STARFISH_MAX_STOPS) ? colourcount : STARFISH_MAX_STOPS;
+	if(out->count == 1)
+		{
+		out->stop[0].position = 0;
+		out->stop[0].colour = colours->colour[0];
+		out->stop[0].colour.alpha = MAX_CHANVAL;
+		return !0;
+		}
+	for(ctr = 0; ctr < out->count; ctr++)
+		{
+		out->stop[ctr].position = ctr * CHANNEL_RANGE / (out->count - 1);
+		out->stop[ctr].colour = colours->colour[ctr * (colourcount - 1) / (out->count - 1)];
+		out->stop[ctr].colour.alpha = MAX_CHANVAL;
+		}
+	return !0;
+	}
+
+static void ReverseGradient(StarfishGradient* gradient)
+	{
+	//Turn the gradient end for end, so its last colour goes with the lowest values.
+	int lo, hi;
+	for(lo = 0, hi = gradient->count - 1; lo <= hi; lo++, hi--)
+		{
+		StarfishGradientStop swap = gradient->stop[lo];
+		gradient->stop[lo] = gradient->stop[hi];
+		gradient->stop[hi] = swap;
+		gradient->stop[lo].position = CHANNEL_RANGE - gradient->stop[lo].position;
+		if(lo != hi) gradient->stop[hi].position = CHANNEL_RANGE - gradient->stop[hi].position;
+		}
+	}
+
+int BuildGradientRamp(const StarfishGradient* gradient, pixel* ramp)
+	{
+	/*
+	Work out the colour for every image value once, so that colouring a
+	pixel is just a table lookup no matter how fancy the gradient is.
+	Between two stops we blend in fixed point. With stops at 0 and
+	CHANNEL_RANGE, this is exactly the blend the engine has always used.
+	*/
+	int ctr, stop;
+	if(!gradient || !ramp) return 0;
+	if(gradient->count < 1 || gradient->count > STARFISH_MAX_STOPS) return 0;
+	for(stop = 0; stop < gradient->count; stop++)
+		{
+		int position = gradient->stop[stop].position;
+		if(position < 0 || position > CHANNEL_RANGE) return 0;
+		if(stop && position < gradient->stop[stop - 1].position) return 0;
+		}
+	stop = -1;
+	for(ctr = 0; ctr < CHANNEL_RANGE; ctr++)
+		{
+		const StarfishGradientStop *low, *high;
+		int span;
+		//Find the last stop at or below this value. Stops sharing a position make a hard edge.
+		while(stop + 1 < gradient->count && gradient->stop[stop + 1].position <= ctr) stop++;
+		if(stop < 0)
+			{
+			ramp[ctr] = gradient->stop[0].colour;
+			}
+		else if(stop + 1 >= gradient->count)
+			{
+			ramp[ctr] = gradient->stop[stop].colour;
+			}
+		else
+			{
+			low = &gradient->stop[stop];
+			high = &gradient->stop[stop + 1];
+			span = high->position - low->position;
+			ramp[ctr].red = (low->colour.red * (high->position - ctr) + high->colour.red * (ctr - low->position)) / span;
+			ramp[ctr].green = (low->colour.green * (high->position - ctr) + high->colour.green * (ctr - low->position)) / span;
+			ramp[ctr].blue = (low->colour.blue * (high->position - ctr) + high->colour.blue * (ctr - low->position)) / span;
+			}
+		ramp[ctr].alpha = MAX_CHANVAL;
+		}
+	return !0;
+	}
+
 void GetStarfishPixel(int h, int v, StarfishRef texture, pixel* out)
 	{
 	/*
@@ -254,8 +552,6 @@ void GetStarfishPixel(int h, int v, StarfishRef texture, pixel* out)
 		int ctr;
 		for(ctr = 0; ctr < texture->count; ctr++)
 			{
-			pixel layerpixel;
-			float interval;
 			ColourLayerRec* layer = &texture->tex[ctr];
 			//Get the image value for this pixel, for this layer.
 			imageval = GetLayerPixel(h, v, layer->image);
@@ -269,77 +565,241 @@ void GetStarfishPixel(int h, int v, StarfishRef texture, pixel* out)
 			if(layer->invertmask) maskval = MAX_CHANVAL - maskval;
 			#endif
 			/*
-			Now we are ready. Calculate the image value for this layer.
-			We use the image value as the proportion of the distance between
-			two colours. We calculate this one channel at a time. This results
-			in a smooth gradient of colour from min to max.
+			Merge this layer in behind the ones we have already done.
+			If the pixel has become opaque, calculating pixels from any of the
+			deeper layers would just be a waste of time.
 			*/
-			//Calculate the red channel of the pixel.
-			interval = imageval;
-			interval /= CHANNEL_RANGE;
-			interval *= layer->fore.red - layer->back.red;
-			layerpixel.red = interval + layer->back.red;
-			//Next calculate the green channel.
-			interval = imageval;
-			interval /= CHANNEL_RANGE;
-			interval *= layer->fore.green - layer->back.green;
-			layerpixel.green = interval + layer->back.green;
-			//Calculate the blue channel in the same fashion
-			interval = imageval;
-			interval /= CHANNEL_RANGE;
-			interval *= layer->fore.blue - layer->back.blue;
-			layerpixel.blue = interval + layer->back.blue;
-			//The alpha channel is merely the mask value.
-			layerpixel.alpha = maskval;
-			/*
-			The image value for this layer is calculated.
-			But the image is more than just this layer: it is the merged
-			results of all the layers. So now we merge this value with
-			the existing value calculated from the previous layers.
-			We use the alpha channel to determine the proportion of blending.
-			The new layer goes behind the existing layers; we use the existing
-			alpha channel to determine what proportion of the new value shows
-			through.
-			*/
-			//Calculate the red channel of the pixel.
-			outval.red =
-					(
-					(outval.red * outval.alpha) + 
-					(layerpixel.red * (CHANNEL_RANGE - outval.alpha))
-					) / (CHANNEL_RANGE);
-			//Next calculate the green channel.
-			outval.green =
-					(
-					(outval.green * outval.alpha) + 
-					(layerpixel.green * (CHANNEL_RANGE - outval.alpha))
-					) / (CHANNEL_RANGE);
-			//Calculate the blue channel in the same fashion
-			outval.blue =
-					(
-					(outval.blue * outval.alpha) + 
-					(layerpixel.blue * (CHANNEL_RANGE - outval.alpha))
-					) / (CHANNEL_RANGE);
+			if(MergeLayerPixel(&outval, imageval, maskval, layer, texture->cutoff_threshold)) break;
+			}
+		}
+	//Return our modified pixel to the caller.
+	if(out) *out = outval;
+	}
+
+void GetStarfishSpan(StarfishRef texture, int v, int h, int count, pixel* out)
+	{
+	/*
+	Calculate a run of pixels along one row.
+	This does the same work as GetStarfishPixel, but it hands the row to
+	the layer-major pipeline in ComposeStarfishBlock a chunk at a time.
+	*/
+	CompositeBuf buf;
+	int ctr, first, last;
+	if(!out || count <= 0) return;
+	//Start out with every pixel black, including any we cannot calculate.
+	for(ctr = 0; ctr < count; ctr++)
+		{
+		out[ctr].red = out[ctr].green = out[ctr].blue = out[ctr].alpha = 0;
+		}
+	if(!texture || v < 0 || v >= texture->height) return;
+	//Clip the span to the part which actually lies on the texture.
+	first = (h < 0) ? -h : 0;
+	last = (h + count > texture->width) ? texture->width - h : count;
+	while(first < last)
+		{
+		//Work through the row one chunk at a time, so our scratch space stays on the stack.
+		int chunklen = (last - first < SPAN_CHUNK) ? last - first : SPAN_CHUNK;
+		ComposeStarfishBlock(texture, h + first, v, chunklen, 1, &buf);
+		UnpackCompositeBuf(&buf, 0, chunklen, &out[first]);
+		first += chunklen;
+		}
+	}
+
+static void ComposeStarfishBlock
+		(
+		StarfishRef texture,
+		int h,
+		int v,
+		int width,
+		int height,
+		CompositeBuf* buf
+		)
+	{
+	/*
+	Calculate a block of pixels, width across and height down, into buf.
+	The block must lie entirely on the texture, and it must fit in the buffer.
+	Pixels are stored a row at a time, one channel per array.
+	
+	Instead of working a pixel at a time, walking down through the layers,
+	we work a layer at a time across the whole block. Each layer is asked for
+	its values a run at a time, so the generator manager only sets up once
+	per run instead of once per pixel, and the compositor merges the whole
+	block in one call. We still honour the cutoff threshold. A pixel whose
+	alpha has reached MAX_CHANVAL is opaque; the merge never lets alpha get
+	there any other way, so the alpha channel doubles as our mask of pixels
+	which are already covered. Those pixels split each row into shorter runs,
+	and the deeper layers are never calculated for them. Once every pixel in
+	the block is covered, we stop.
+	
+	Before calculating a layer, we ask its generators for bounds on their
+	values over the whole block. If an image or mask can only have one
+	value, we fill it in without calculating anything. And we keep a floor
+	under the alpha of every pixel in the block: the merge only ever raises
+	alpha, and raises it more for higher mask values, so feeding it the
+	lowest possible mask value gives the least alpha any pixel could have.
+	Once that floor proves the whole block goes opaque on this layer, the
+	exact mask values no longer matter, so a separate mask generator doesn't
+	need to be calculated at all, and no deeper layer ever will be.
+	*/
+	channelval imageval[COMPOSITE_SPAN], maskval[COMPOSITE_SPAN];
+	int count = width * height;
+	int layerctr, opaque, alphafloor, covered, invertmask;
+	channelval imagelo, imagehi, masklo, maskhi, leastmask;
+	ClearCompositeBuf(buf, count);
+	opaque = 0;
+	alphafloor = 0;
+	covered = 0;
+	for(layerctr = 0; layerctr < texture->count && opaque < count && !covered; layerctr++)
+		{
+		ColourLayerRec* layer = &texture->tex[layerctr];
+		const channelval* mask = imageval;
+		invertmask = layer->invertmask;
+		GetLayerBounds(h, v, width, height, layer->image, &imagelo, &imagehi);
+		#if TEST_MODE
+		masklo = maskhi = MAX_CHANVAL;
+		invertmask = 0;
+		#else
+		if(layer->mask) GetLayerBounds(h, v, width, height, layer->mask, &masklo, &maskhi);
+		else
+			{
+			masklo = imagelo;
+			maskhi = imagehi;
+			}
+		#endif
+		//Raise the alpha floor, exactly as the compositor would.
+		leastmask = invertmask ? MAX_CHANVAL - maskhi : masklo;
+		alphafloor += (leastmask * (MAX_CHANVAL - alphafloor)) >> 8;
+		covered = (alphafloor + texture->cutoff_threshold >= MAX_CHANVAL);
+		FillBlockLayer(h, v, width, height, buf, layer->image, imagelo, imagehi, imageval);
+		#if TEST_MODE
+		FillBlockLayer(h, v, width, height, buf, NULL, MAX_CHANVAL, MAX_CHANVAL, maskval);
+		mask = maskval;
+		#else
+		if(layer->mask)
+			{
 			/*
-			Add the alpha channels (representing opacity); if the result is greater
-			than 100% opacity, we just stop calculating (since no further layers
-			will produce visible data).
+			If the floor proves this layer covers everything, any mask value at
+			least as high as the least one will do. Use the least one.
 			*/
-			layerpixel.alpha = layerpixel.alpha * (MAX_CHANVAL - outval.alpha) / CHANNEL_RANGE;
-			if(layerpixel.alpha + outval.alpha + texture->cutoff_threshold >= MAX_CHANVAL)
+			if(covered)
 				{
-				outval.alpha = MAX_CHANVAL;
-				/*
-				And now end the loop, because we've collected all the data we need.
-				Calculating pixels from any of the deeper layers would just be a waste of time.
-				*/
-				break;
+				FillBlockLayer(h, v, width, height, buf, NULL, leastmask, leastmask, maskval);
+				invertmask = 0;
 				}
-			else outval.alpha += layerpixel.alpha;
-			//And that, my friends, is that.
+			else FillBlockLayer(h, v, width, height, buf, layer->mask, masklo, maskhi, maskval);
+			mask = maskval;
 			}
+		#endif
+		//Now merge this layer in behind the layers we have already done.
+		opaque = CompositeLayerSpan
+				(
+				buf,
+				count,
+				imageval,
+				mask,
+				invertmask,
+				layer->ramp,
+				texture->cutoff_threshold
+				);
 		}
-	//Return our modified pixel to the caller.
-	*out = outval;
+	}
+
+static void FillBlockLayer
+		(
+		int h,
+		int v,
+		int width,
+		int height,
+		const CompositeBuf* buf,
+		LayerRef layer,
+		channelval lo,
+		channelval hi,
+		channelval* out
+		)
+	{
+	/*
+	Fill in a layer's values for a block, in the same layout as the buffer.
+	If the bounds pin the value down, there is nothing to calculate.
+	Otherwise, find each run of pixels that is still translucent, and ask
+	the layer for all of its values along that run in one call. Pixels
+	which are already opaque are left alone.
+	*/
+	int count = width * height;
+	int row, pixctr, runstart;
+	if(lo == hi || !layer)
+		{
+		for(pixctr = 0; pixctr < count; pixctr++) out[pixctr] = lo;
+		return;
+		}
+	for(row = 0; row < height; row++)
+		{
+		const unsigned short* alpha = &buf->alpha[row * width];
+		channelval* rowout = &out[row * width];
+		for(pixctr = 0; pixctr < width; )
+			{
+			if(alpha[pixctr] == MAX_CHANVAL)
+				{
+				pixctr++;
+				continue;
+				}
+			runstart = pixctr;
+			while(pixctr < width && alpha[pixctr] != MAX_CHANVAL) pixctr++;
+			GetLayerSpan(h + runstart, v + row, pixctr - runstart, layer, &rowout[runstart]);
+			}
+		}
+	}
+
+static int MergeLayerPixel
+		(
+		pixel* outval,
+		channelval imageval,
+		channelval maskval,
+		const ColourLayerRec* layer,
+		int cutoff_threshold
+		)
+	{
+	/*
+	Colour one layer's image value and merge it in behind the pixel we
+	have built up so far. Returns nonzero if the pixel is now opaque, in
+	which case its alpha has been set to MAX_CHANVAL.
+	*/
+	/*
+	Calculate the image value for this layer.
+	The layer's gradient was baked into a table when the texture was built,
+	so the colour is just a lookup. The blend below is fixed point
+	arithmetic, and it has to stay exactly the same as the compositor's,
+	since GetStarfishSpan uses that instead of this.
+	*/
+	pixel layerpixel = layer->ramp[imageval];
+	//The alpha channel is merely the mask value.
+	layerpixel.alpha = maskval;
+	/*
+	The image value for this layer is calculated.
+	But the image is more than just this layer: it is the merged
+	results of all the layers. So now we merge this value with
+	the existing value calculated from the previous layers.
+	We use the alpha channel to determine the proportion of blending.
+	The new layer goes behind the existing layers; we use the existing
+	alpha channel to determine what proportion of the new value shows
+	through.
+	*/
+	outval->red = (outval->red * outval->alpha + layerpixel.red * (CHANNEL_RANGE - outval->alpha)) >> 8;
+	outval->green = (outval->green * outval->alpha + layerpixel.green * (CHANNEL_RANGE - outval->alpha)) >> 8;
+	outval->blue = (outval->blue * outval->alpha + layerpixel.blue * (CHANNEL_RANGE - outval->alpha)) >> 8;
+	/*
+	Add the alpha channels (representing opacity); if the result is greater
+	than 100% opacity, we just stop calculating (since no further layers
+	will produce visible data).
+	*/
+	layerpixel.alpha = (layerpixel.alpha * (MAX_CHANVAL - outval->alpha)) >> 8;
+	if(layerpixel.alpha + outval->alpha + cutoff_threshold >= MAX_CHANVAL)
+		{
+		outval->alpha = MAX_CHANVAL;
+		return !0;
+		}
+	outval->alpha += layerpixel.alpha;
+	//And that, my friends, is that.
+	return 0;
 	}
 
 void DumpStarfish(StarfishRef it)
@@ -358,13 +818,39 @@ void DumpStarfish(StarfishRef it)
 			if(it->tex[ctr].image) DumpLayer(it->tex[ctr].image);
 			if(it->tex[ctr].mask) DumpLayer(it->tex[ctr].mask);
 			}
-		//Unload the list of generators.
-		if(it->list) UnloadGenerators(it->list);
 		//Throw away our data structure, now we're done with it.
 		free(it);
 		}
 	}
 
+void SetStarfishAntiAliasing(StarfishRef texture, int contrast)
+	{
+	//Every layer, image and mask alike, gets the same contrast.
+	if(texture)
+		{
+		int ctr;
+		for(ctr = 0; ctr < texture->count; ctr++)
+			{
+			SetLayerAntiAliasing(texture->tex[ctr].image, contrast);
+			SetLayerAntiAliasing(texture->tex[ctr].mask, contrast);
+			}
+		}
+	}
+
+void SetStarfishSeamWidth(StarfishRef texture, float width)
+	{
+	//Only generators which don't tile by themselves pay any attention.
+	if(texture)
+		{
+		int ctr;
+		for(ctr = 0; ctr < texture->count; ctr++)
+			{
+			SetLayerSeamWidth(texture->tex[ctr].image, width);
+			SetLayerSeamWidth(texture->tex[ctr].mask, width);
+			}
+		}
+	}
+
 /*
 The Starfish function by itself rolls the above three functions
 into one step. Use this when you are in an environment with preemptive
@@ -373,6 +859,11 @@ Starfish to create the pixel buffer for you.
 */
 
 pixbuf Starfish(int horz, int vert, const StarfishPalette* colours)
+	{
+	return StarfishThreaded(horz, vert, colours, 1);
+	}
+
+pixbuf StarfishThreaded(int horz, int vert, const StarfishPalette* colours, int threads)
 	{
 	/*
 	Create a pixel buffer and fill it, using layers of
@@ -393,17 +884,8 @@ pixbuf Starfish(int horz, int vert, const StarfishPalette* colours)
 		it = MakeStarfish(horz, vert, colours);
 		if(it)
 			{
-			//Now loop through all of the pixels of the scratchbox, filling in each one.
-			int h, v;
-			for(v = 0; v < vert; v++)
-				{
-				for(h = 0; h < horz; h++)
-					{
-					pixel temppixel;
-					GetStarfishPixel(h, v, it, &temppixel);
-					SetPixBufPixel(out, h, v, &temppixel);
-					}
-				}
+			//Now fill in all of the pixels of the scratchbox.
+			RenderStarfish(it, out, threads);
 			//Now we're done with the starfish texture, so throw it away.
 			DumpStarfish(it);
 			}
@@ -421,8 +903,108 @@ pixbuf Starfish(int horz, int vert, const StarfishPalette* colours)
 	return out;
 	}
 
+srl_result RenderStarfish(StarfishRef texture, pixbuf dest, int threads)
+	{
+	/*
+	Fill the whole destination buffer from this texture.
+	We cut the image into tiles and let a pool of workers pick them off one
+	at a time until they are all done. The calling thread is one of the
+	workers, so if we can't start any extra threads the job still finishes.
+	Each tile is rendered a row-span at a time straight into the buffer.
+	*/
+	RenderJobRec job;
+	int tilesdown;
+	if(!texture) return srl_bogusParamPtr;
+	if(!dest) return srl_bogusBuffer;
+	if(GetPixBufWidth(dest) != texture->width || GetPixBufHeight(dest) != texture->height)
+		{
+		return srl_mismatchedSizes;
+		}
+	job.texture = texture;
+	job.dest = dest;
+	job.tilesacross = (texture->width + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	tilesdown = (texture->height + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+	job.tilecount = job.tilesacross * tilesdown;
+	job.nexttile = 0;
+	#if STARFISH_THREADS
+	job.threaded = 0;
+	//There's no point in having more workers than there are tiles.
+	if(threads > job.tilecount) threads = job.tilecount;
+	if(threads > 1 && !pthread_mutex_init(&job.lock, NULL))
+		{
+		pthread_t* workers;
+		int started = 0;
+		job.threaded = !0;
+		workers = (pthread_t*)malloc((threads - 1) * sizeof(pthread_t));
+		if(workers)
+			{
+			//Start up the extra workers. If some fail to start, we just use fewer.
+			while(started < threads - 1 && !pthread_create(&workers[started], NULL, RenderWorker, &job))
+				{
+				started++;
+				}
+			}
+		RenderWorker(&job);
+		while(started > 0) pthread_join(workers[--started], NULL);
+		if(workers) free(workers);
+		pthread_mutex_destroy(&job.lock);
+		}
+	else RenderWorker(&job);
+	#else
+	RenderWorker(&job);
+	#endif
+	return srl_noErr;
+	}
+
+static int NextRenderTile(RenderJobRec* job)
+	{
+	/*
+	Hand out the next tile nobody has rendered yet.
+	Returns -1 once all of the tiles have been taken.
+	*/
+	int out = -1;
+	#if STARFISH_THREADS
+	if(job->threaded) pthread_mutex_lock(&job->lock);
+	#endif
+	if(job->nexttile < job->tilecount) out = job->nexttile++;
+	#if STARFISH_THREADS
+	if(job->threaded) pthread_mutex_unlock(&job->lock);
+	#endif
+	return out;
+	}
+
+static void RenderTile(RenderJobRec* job, int tile)
+	{
+	/*
+	Calculate the whole tile in one pass through the layers, then copy it
+	into the destination buffer a row at a time.
+	*/
+	CompositeBuf buf;
+	int h, v, width, height, row;
+	h = (tile % job->tilesacross) * RENDER_TILE_SIZE;
+	v = (tile / job->tilesacross) * RENDER_TILE_SIZE;
+	width = job->texture->width - h;
+	if(width > RENDER_TILE_SIZE) width = RENDER_TILE_SIZE;
+	height = job->texture->height - v;
+	if(height > RENDER_TILE_SIZE) height = RENDER_TILE_SIZE;
+	ComposeStarfishBlock(job->texture, h, v, width, height, &buf);
+	for(row = 0; row < height; row++)
+		{
+		UnpackCompositeBuf(&buf, row * width, width, PeekRasterLine(job->dest, v + row) + h);
+		}
+	}
+
+static void* RenderWorker(void* param)
+	{
+	//Keep picking off tiles until there are none left to render.
+	RenderJobRec* job = (RenderJobRec*)param;
+	int tile;
+	while((tile = NextRenderTile(job)) >= 0) RenderTile(job, tile);
+	return NULL;
+	}
+
 /*
-A pair of trivial accessor functions
+A few trivial accessor functions
 */
 int StarfishWidth(StarfishRef texture)
 	{
@@ -434,25 +1016,31 @@ int StarfishHeight(StarfishRef texture)
 	return texture ? texture->height : 0;
 	}
 
-static void RandomPalettePixel(const StarfishPalette* colours, pixel* out)
+uint64_t StarfishSeed(StarfishRef texture)
+	{
+	return texture ? texture->recipe.seed : 0;
+	}
+
+static int RandomPalettePixel(const StarfishPalette* colours, pixel* out, RandRef rng)
 	{
 	/*
-	Pick a random pixel from this palette.
-	If the palette is empty, create it from random values.
+	Pick a random pixel from this palette, and return where it was.
+	If the palette is empty, create it from random values, and return -1.
 	*/
+	int index = -1;
 	if(out)
 		{
 		if(colours && colours->colourcount > 1)
 			{
-			int index;
-			index = (rand() * colours->colourcount) / RAND_MAX;
+			index = irand(rng, colours->colourcount);
 			*out = colours->colour[index];
 			}
 		else
 			{
-			out->red = irand(MAX_CHANVAL);
-			out->green = irand(MAX_CHANVAL);
-			out->blue = irand(MAX_CHANVAL);
+			out->red = irand(rng, MAX_CHANVAL);
+			out->green = irand(rng, MAX_CHANVAL);
+			out->blue = irand(rng, MAX_CHANVAL);
 			}
 		}
+	return index;
 	}
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef __starfish_engine__
 #define __starfish_engine__ 0
 
+#include <stdint.h>
 #include "starfish-rasterlib.h"
 
 /*
@@ -46,6 +47,11 @@ pixel buffer with a seamless, 24-bit texture inside. Yours to keep.
 h is the horizontal size, v is the vertical size, both in pixels.
 */
 pixbuf Starfish(int hsize, int vsize, const StarfishPalette* colours);
+/*
+StarfishThreaded is the same thing, but it renders the texture on a pool of
+threads worker threads. The pixels come out exactly the same either way.
+*/
+pixbuf StarfishThreaded(int hsize, int vsize, const StarfishPalette* colours, int threads);
 
 /*
 Create a starfish texture. Then ask for its pixels, using whatever pace
@@ -55,14 +61,180 @@ off extra threads, and requires far less memory.
 The StarfishPalette is read-only, and you needn't maintain it after calling
 MakeStarfish. The engine keeps its own internal copy of the palette.
 If you pass NULL, the engine uses the full colour spectrum.
+
+Every random choice that goes into a texture comes from the texture's own
+random stream, which starts from a 64-bit seed. MakeSeededStarfish lets you
+pick the seed; the same seed, size and palette always rebuild the same
+texture, and any number of textures can be made on different threads at
+once. MakeStarfish takes its seed from rand(), so srand() still controls
+it, but that also means it is not safe to call from several threads.
+StarfishSeed tells you which seed a texture was built from.
 */
 typedef struct StarfishTexRec* StarfishRef;
 
 StarfishRef MakeStarfish(int hsize, int vsize, const StarfishPalette* colours);
+StarfishRef MakeSeededStarfish(int hsize, int vsize, const StarfishPalette* colours, uint64_t seed);
 void GetStarfishPixel(int h, int v, StarfishRef texture, pixel* out);
+/*
+GetStarfishSpan calculates count pixels of row v, starting at column h, into
+the out array, which must have room for count pixels. The results are exactly
+what GetStarfishPixel would give you, but the per-pixel overhead is paid once
+per span. Pixels outside the texture come back black, as with GetStarfishPixel.
+*/
+void GetStarfishSpan(StarfishRef texture, int v, int h, int count, pixel* out);
 void DumpStarfish(StarfishRef it);
 int StarfishWidth(StarfishRef texture);
 int StarfishHeight(StarfishRef texture);
+uint64_t StarfishSeed(StarfishRef texture);
+
+/*
+Everything that goes into a texture can be written down as a recipe:
+how many layers there are, which generator each layer's image and mask
+come from, the seed each generator uses to pick its settings, and the
+gradient each layer's image values are coloured with. The generators all work
+in resolution-independent space, so one recipe can be cooked at any size:
+roll up lots of recipes, preview them as thumbnails, then build only the
+ones you like at full size.
+A recipe can also ask for fast math, which changes the odd pixel, and fix
+the number of bubbles in its bubble fields and of octaves in its Perlin
+layers. These go to the generators with the rest of the recipe as its
+layers are built, and stay with those layers alone; zero, as in random
+recipes, means no fast math and leaves the counts to each layer's seed.
+Generator numbers are indexes into the generator list. New generators are
+always added to the end of the list, so old recipes keep working.
+Recipes can be read from and written to files; see starfish-recipe.h.
+*/
+#define STARFISH_MAX_LAYERS 6
+//A layer whose mask is NO_MASK_GENERATOR uses its image as its own mask.
+#define NO_MASK_GENERATOR -1
+
+/*
+Each layer turns its grey image values into colours with a gradient.
+A gradient is a list of colour stops. Each stop sits at a position from
+0 to CHANNEL_RANGE, in increasing order, and image values between two stops
+blend smoothly from one colour to the next. Values below the first stop get
+its colour, and likewise above the last. Random textures use two stops, at
+0 and CHANNEL_RANGE, unless they ramp through a palette, and a layer can
+have up to STARFISH_MAX_STOPS.
+When a texture is built, each gradient is baked into a table with one colour
+for every image value, so a gradient with many stops costs no more per
+pixel than one with two.
+*/
+#define STARFISH_MAX_STOPS 16
+
+typedef struct StarfishGradientStop
+	{
+	int position;			//0 through CHANNEL_RANGE
+	pixel colour;
+	}
+StarfishGradientStop;
+
+typedef struct StarfishGradient
+	{
+	int count;				//1 through STARFISH_MAX_STOPS
+	StarfishGradientStop stop[STARFISH_MAX_STOPS];
+	}
+StarfishGradient;
+
+//Make the plain gradient from back, for low image values, to fore for high ones.
+void TwoColourGradient(const pixel* back, const pixel* fore, StarfishGradient* out);
+/*
+Make a gradient which runs through the colours of a palette in order, evenly
+spaced. Palettes with more than STARFISH_MAX_STOPS colours are sampled evenly.
+Returns zero if the palette is empty.
+*/
+int PaletteGradient(const StarfishPalette* colours, StarfishGradient* out);
+/*
+Bake a gradient into a table with one colour for each of the CHANNEL_RANGE
+image values. Returns zero, leaving the table alone, if the gradient is bogus.
+*/
+int BuildGradientRamp(const StarfishGradient* gradient, pixel* ramp);
+
+typedef struct StarfishLayerRecipe
+	{
+	int image;				//which generator makes the image?
+	uint64_t imageseed;		//and what seed does it start from?
+	int mask;				//which generator makes the mask, if any?
+	uint64_t maskseed;
+	int invertmask;			//if true, the mask is inverted
+	StarfishGradient gradient;	//colours for the image values
+	}
+StarfishLayerRecipe;
+
+typedef struct StarfishRecipe
+	{
+	uint64_t seed;			//the seed this recipe was rolled from, if any
+	int count;				//1 through STARFISH_MAX_LAYERS
+	int cutoff_threshold;
+	int fastmath;			//were the generators using fast math?
+	int bubbles;			//bubbles in each bubble field, or 0 for random counts
+	int octaves;			//octaves in each Perlin layer, or 0 for random counts
+	StarfishLayerRecipe layer[STARFISH_MAX_LAYERS];
+	}
+StarfishRecipe;
+
+//Roll a random recipe, exactly as MakeSeededStarfish would.
+void RandomStarfishRecipe(uint64_t seed, const StarfishPalette* colours, StarfishRecipe* out);
+/*
+RandomStarfishRampRecipe rolls the same layers, but colours each one with
+a ramp through the whole palette, from PaletteGradient, instead of two of
+its colours. Some ramps run backwards. Without a palette of at least two
+colours, it is the same as RandomStarfishRecipe.
+*/
+void RandomStarfishRampRecipe(uint64_t seed, const StarfishPalette* colours, StarfishRecipe* out);
+//Build a texture of any size from a recipe. Returns NULL if the recipe is bogus.
+StarfishRef MakeStarfishFromRecipe(const StarfishRecipe* recipe, int hsize, int vsize);
+/*
+MakeStarfishFromRecipe builds everything up front on the calling thread.
+BuildStarfishFromRecipe lets you say how: layers which take a while to set
+up share the work among up to threads threads, if we were built with
+STARFISH_THREADS, and with lazy set, range fractals build their fine detail
+only where it gets looked at. The texture comes out the same either way.
+*/
+StarfishRef BuildStarfishFromRecipe(const StarfishRecipe* recipe, int hsize, int vsize, int threads, int lazy);
+//Copy out the recipe a texture was built from. Returns zero on failure.
+int GetStarfishRecipe(StarfishRef texture, StarfishRecipe* out);
+
+/*
+If you want the whole texture at once, RenderStarfish will fill a pixel
+buffer for you. The buffer must be the same size as the texture.
+The image is cut into tiles, which are handed out to threads worker
+threads; pass 1 to do all of the work in the calling thread. Every pixel
+is calculated independently, so the result does not depend on the number
+of threads. If the engine was built without STARFISH_THREADS, the tiles
+are all rendered in the calling thread.
+*/
+srl_result RenderStarfish(StarfishRef texture, pixbuf dest, int threads);
+
+/*
+Most generators are anti-aliased by averaging four samples for every pixel.
+SetStarfishAntiAliasing lets a texture take just one wherever a layer is
+smooth, meaning a pixel's sample differs from those of its neighbours to
+the right and below by no more than contrast channel values. Those samples
+are shared with the neighbours, so a smooth pixel costs one sample instead
+of four. A contrast of 2 or 3 makes no
+visible difference; 0, the default, always takes every sample. Set it
+before rendering.
+*/
+void SetStarfishAntiAliasing(StarfishRef texture, int contrast);
+/*
+Coswave and Flatwave patterns don't tile by themselves, so the engine blends
+each point with copies from the next tile over, at four times the cost.
+SetStarfishSeamWidth narrows that blend to a band covering width of the
+tile along its top and left edges; outside the band, points cost one
+generator call. The texture still tiles seamlessly, but the pattern shifts
+a little. 1, the default, blends across the whole tile; 0.25 renders those
+layers about twice as fast. Set it before rendering.
+*/
+void SetStarfishSeamWidth(StarfishRef texture, float width);
+
+/*
+Multithreaded rendering needs POSIX threads. Build with STARFISH_THREADS
+set to 1 (and link with the thread library) to turn it on.
+*/
+#ifndef STARFISH_THREADS
+#define STARFISH_THREADS 0
+#endif
 
 /*
 The starfish engine can be run in test mode.
@@ -0,0 +1,217 @@
+/*
+
+This file is part of xstarfish
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Starfish recipes, on disk
+Reads and writes the text format described in starfish-recipe.h.
+
+*/
+
+#include "starfish-recipe.h"
+#include <inttypes.h>
+#include <string.h>
+
+#define RECIPE_VERSION 1
+
+static void WriteRecipeColour(FILE* file, const pixel* colour);
+static int ReadRecipeColour(const char* text, pixel* colour);
+static void WriteRecipeGradient(FILE* file, const StarfishGradient* gradient);
+static int ReadRecipeGradient(FILE* file, StarfishGradient* gradient);
+
+int WriteStarfishRecipe(FILE* file, const StarfishRecipe* recipe)
+	{
+	/*
+	Write the recipe out, one line per setting and one line per layer.
+	Seeds go out in hex, since that is the most compact way to write a
+	64-bit number that every C library can read back in.
+	*/
+	int ctr;
+	if(!file || !recipe) return 0;
+	fprintf(file, "starfish-recipe %d\n", RECIPE_VERSION);
+	fprintf(file, "seed %" PRIu64 "\n", recipe->seed);
+	fprintf(file, "cutoff %d\n", recipe->cutoff_threshold);
+	//Settings which are off are left out, so older readers can still cope.
+	if(recipe->fastmath) fprintf(file, "fastmath 1\n");
+	if(recipe->bubbles) fprintf(file, "bubbles %d\n", recipe->bubbles);
+	if(recipe->octaves) fprintf(file, "octaves %d\n", recipe->octaves);
+	fprintf(file, "layers %d\n", recipe->count);
+	for(ctr = 0; ctr < recipe->count && ctr < STARFISH_MAX_LAYERS; ctr++)
+		{
+		const StarfishLayerRecipe* layer = &recipe->layer[ctr];
+		fprintf(file, "layer %d %016" PRIx64 " ", layer->image, layer->imageseed);
+		if(layer->mask == NO_MASK_GENERATOR) fprintf(file, "- - ");
+			else fprintf(file, "%d %016" PRIx64 " ", layer->mask, layer->maskseed);
+		fprintf(file, "%d ", layer->invertmask ? 1 : 0);
+		WriteRecipeGradient(file, &layer->gradient);
+		fputc('\n', file);
+		}
+	return !ferror(file);
+	}
+
+int ReadStarfishRecipe(FILE* file, StarfishRecipe* out)
+	{
+	/*
+	Read a recipe back in. We are strict about the layout: anything we
+	don't understand means the whole recipe is rejected, rather than
+	quietly producing some texture the user didn't ask for.
+	*/
+	StarfishRecipe recipe;
+	int version, ctr;
+	if(!file || !out) return 0;
+	if(fscanf(file, " starfish-recipe %d", &version) != 1 || version != RECIPE_VERSION) return 0;
+	if(fscanf(file, " seed %" SCNu64, &recipe.seed) != 1) return 0;
+	if(fscanf(file, " cutoff %d", &recipe.cutoff_threshold) != 1) return 0;
+	/*
+	Any settings come next, each a word and a number, up to the layer
+	count. Recipes written before a setting existed simply leave it out.
+	*/
+	recipe.fastmath = 0;
+	recipe.bubbles = 0;
+	recipe.octaves = 0;
+	for(;;)
+		{
+		char word[16];
+		int value;
+		if(fscanf(file, " %15s %d", word, &value) != 2) return 0;
+		if(!strcmp(word, "layers"))
+			{
+			recipe.count = value;
+			break;
+			}
+		else if(!strcmp(word, "fastmath")) recipe.fastmath = (value != 0);
+		else if(!strcmp(word, "bubbles") && value >= 0) recipe.bubbles = value;
+		else if(!strcmp(word, "octaves") && value >= 0) recipe.octaves = value;
+		else return 0;
+		}
+	if(recipe.count < 1 || recipe.count > STARFISH_MAX_LAYERS) return 0;
+	for(ctr = 0; ctr < recipe.count; ctr++)
+		{
+		StarfishLayerRecipe* layer = &recipe.layer[ctr];
+		char maskgen[16], maskseed[24];
+		if(fscanf(file, " layer %d %" SCNx64 " %15s %23s %d",
+				&layer->image, &layer->imageseed, maskgen, maskseed,
+				&layer->invertmask) != 5)
+			{
+			return 0;
+			}
+		if(!strcmp(maskgen, "-"))
+			{
+			layer->mask = NO_MASK_GENERATOR;
+			layer->maskseed = 0;
+			}
+		else if(sscanf(maskgen, "%d", &layer->mask) != 1 ||
+				sscanf(maskseed, "%" SCNx64, &layer->maskseed) != 1)
+			{
+			return 0;
+			}
+		if(!ReadRecipeGradient(file, &layer->gradient)) return 0;
+		}
+	*out = recipe;
+	return !0;
+	}
+
+int ReadStarfishPalette(const char* text, StarfishPalette* out)
+	{
+	//Each colour is six hex digits, and a comma comes between each pair.
+	StarfishPalette palette;
+	char word[8];
+	if(!text || !out) return 0;
+	palette.colourcount = 0;
+	for(;;)
+		{
+		size_t length = strcspn(text, ",");
+		if(length != 6 || palette.colourcount >= MAX_PALETTE_ENTRIES) return 0;
+		memcpy(word, text, length);
+		word[length] = 0;
+		if(!ReadRecipeColour(word, &palette.colour[palette.colourcount++])) return 0;
+		text += length;
+		if(!*text) break;
+		text++;
+		}
+	*out = palette;
+	return !0;
+	}
+
+static void WriteRecipeColour(FILE* file, const pixel* colour)
+	{
+	fprintf(file, "%02x%02x%02x", colour->red, colour->green, colour->blue);
+	}
+
+static void WriteRecipeGradient(FILE* file, const StarfishGradient* gradient)
+	{
+	/*
+	Plain two-colour gradients are written the way they always have been,
+	fore then back. Anything fancier gets its stops spelled out.
+	*/
+	int ctr;
+	if
+		(
+		gradient->count == 2 &&
+		gradient->stop[0].position == 0 &&
+		gradient->stop[1].position == CHANNEL_RANGE
+		)
+		{
+		WriteRecipeColour(file, &gradient->stop[1].colour);
+		fputc(' ', file);
+		WriteRecipeColour(file, &gradient->stop[0].colour);
+		return;
+		}
+	fprintf(file, "gradient %d", gradient->count);
+	for(ctr = 0; ctr < gradient->count && ctr < STARFISH_MAX_STOPS; ctr++)
+		{
+		fprintf(file, " %d ", gradient->stop[ctr].position);
+		WriteRecipeColour(file, &gradient->stop[ctr].colour);
+		}
+	}
+
+static int ReadRecipeGradient(FILE* file, StarfishGradient* gradient)
+	{
+	//Either "gradient" and a list of stops, or a fore and a back colour.
+	char word[16], back[8];
+	int ctr;
+	if(fscanf(file, " %15s", word) != 1) return 0;
+	if(strcmp(word, "gradient"))
+		{
+		if(fscanf(file, " %7s", back) != 1) return 0;
+		gradient->count = 2;
+		gradient->stop[0].position = 0;
+		gradient->stop[1].position = CHANNEL_RANGE;
+		return ReadRecipeColour(word, &gradient->stop[1].colour) &&
+				ReadRecipeColour(back, &gradient->stop[0].colour);
+		}
+	if(fscanf(file, " %d", &gradient->count) != 1) return 0;
+	if(gradient->count < 1 || gradient->count > STARFISH_MAX_STOPS) return 0;
+	for(ctr = 0; ctr < gradient->count; ctr++)
+		{
+		if(fscanf(file, " %d %7s", &gradient->stop[ctr].position, word) != 2) return 0;
+		if(!ReadRecipeColour(word, &gradient->stop[ctr].colour)) return 0;
+		}
+	return !0;
+	}
+
+static int ReadRecipeColour(const char* text, pixel* colour)
+	{
+	//Colours are always exactly six hex digits, rrggbb.
+	unsigned int red, green, blue;
+	if(strlen(text) != 6 || sscanf(text, "%2x%2x%2x", &red, &green, &blue) != 3) return 0;
+	colour->red = red;
+	colour->green = green;
+	colour->blue = blue;
+	colour->alpha = MAX_CHANVAL;
+	return !0;
+	}
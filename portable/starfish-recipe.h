@@ -0,0 +1,68 @@
+/*
+
+This file is part of xstarfish
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+Starfish recipes, on disk
+
+A recipe is a small text file describing a texture. It looks like this:
+
+	starfish-recipe 1
+	seed 1234
+	cutoff 7
+	layers 2
+	layer 3 9e3779b97f4a7c15 - - 0 ff8000 102040
+	layer 0 0123456789abcdef 4 fedcba9876543210 1 00ff00 400000
+
+A few settings may sit between the cutoff and the layer count, each a word
+and a number. They are only written when they are not the default:
+
+	fastmath 1		the generators used their fast approximations
+	bubbles 3000	every bubble field has this many bubbles
+	octaves 10		every Perlin layer adds up this many octaves, or as many fit
+
+Each layer line lists the image generator and its seed (in hex), the mask
+generator and its seed (or "-" for both if the image is its own mask), the
+invert-mask flag, and the fore and back colours as rrggbb.
+A layer with any other gradient lists its stops instead, each as a position
+from 0 to 256 and a colour:
+
+	layer 1 00000000000000ff - - 0 gradient 3 0 000000 128 ff0000 256 ffff00
+
+The file is plain text so you can edit a recipe by hand: change a colour,
+drop a layer, swap a generator.
+
+*/
+
+#ifndef __starfish_recipe__
+#define __starfish_recipe__ 0
+
+#include <stdio.h>
+#include "starfish-engine.h"
+
+//Write this recipe to a text file. Returns zero if the write failed.
+int WriteStarfishRecipe(FILE* file, const StarfishRecipe* recipe);
+//Read a recipe from a text file. Returns zero if the file is not a valid recipe.
+int ReadStarfishRecipe(FILE* file, StarfishRecipe* out);
+/*
+Read a palette written as colours separated by commas, rrggbb,rrggbb and so
+on, like the colours in a recipe. Returns zero if the text is not a valid
+palette or has more than MAX_PALETTE_ENTRIES colours.
+*/
+int ReadStarfishPalette(const char* text, StarfishPalette* out);
+
+#endif //__starfish_recipe__
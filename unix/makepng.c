@@ -26,12 +26,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "starfish-engine.h"
 
 /* takes a StarfishRef and returns a ptr to a 24-bit RGBA pixmap */
-png_byte** PixFromStarfishTex(StarfishRef tex);
+png_byte** PixFromStarfishTex(StarfishRef tex, int threads);
 
 /* frees a pixmap created by the above function */
 void DestroyPix(png_byte** pixmap, int height);
 
-void MakePNGFile(StarfishRef tex, const char* filename)
+void MakePNGFile(StarfishRef tex, const char* filename, int threads)
 {
 	FILE* theFile;
 	int width, height, x, y;
@@ -50,7 +50,7 @@ void MakePNGFile(StarfishRef tex, const char* filename)
 	/* turn the StarfishRef into something useable */
 	width = StarfishWidth(tex);
 	height = StarfishHeight(tex);
-	pixmap = PixFromStarfishTex(tex);
+	pixmap = PixFromStarfishTex(tex, threads);
 	
 	/* set up libpng */
 	if(pixmap)
@@ -117,28 +117,36 @@ void MakePNGFile(StarfishRef tex, const char* filename)
 	return;
 }
 
-png_byte** PixFromStarfishTex(StarfishRef tex)
+png_byte** PixFromStarfishTex(StarfishRef tex, int threads)
 {
 	png_byte** pixmap;
 	int height = StarfishHeight(tex), width = StarfishWidth(tex);
 	int curRow, curPixel;
-	pixel thePixel;
+	pixbuf rendered;
+	rasterline theRow;
 	
+	/* render the whole texture first, so the work can be spread over threads */
+	rendered = MakePixBuf(width, height);
+	if(!rendered)
+		return NULL;
+	RenderStarfish(tex, rendered, threads);
+
 	pixmap = malloc(height * sizeof(png_byte*));
 	if( pixmap )
 	{
 		for(curRow = 0; curRow < height; curRow++)
 		{
 			pixmap[curRow] = malloc(width * sizeof(png_byte) * 3);
+			theRow = PeekRasterLine(rendered, curRow);
 			for(curPixel = 0; curPixel < width; curPixel++)
 			{
-				GetStarfishPixel(curPixel, curRow, tex, &thePixel);
-				pixmap[curRow][curPixel * 3] = thePixel.red;
-				pixmap[curRow][curPixel * 3 + 1] = thePixel.green;
-				pixmap[curRow][curPixel * 3 + 2] = thePixel.blue;
+				pixmap[curRow][curPixel * 3] = theRow[curPixel].red;
+				pixmap[curRow][curPixel * 3 + 1] = theRow[curPixel].green;
+				pixmap[curRow][curPixel * 3 + 2] = theRow[curPixel].blue;
 			}
 		}
 	}
+	DumpPixBuf(rendered);
 	return pixmap;
 }
 
@@ -21,4 +21,4 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
-void MakePNGFile(StarfishRef tex, const char* filename);
+void MakePNGFile(StarfishRef tex, const char* filename, int threads);
@@ -51,13 +51,13 @@ int compose(int i, int shift)
   return (shift<0) ? (i>>(-shift)) : (i<<shift);
 }
 
-void fillimage(StarfishRef tex, display_info *di, int xzoom, int yzoom)
+void fillimage(pixbuf tex, display_info *di, int xzoom, int yzoom)
 {
   int x,y;
   int dx,dy,i;
   unsigned long value;
   int redshift,greenshift,blueshift;
-  pixel pixel, oldpix;
+  pixel pixel, oldpix, *row;
   float xstep,ystep,pixr,pixg,pixb,dr,dg,db;
 
   x=di->image->red_mask; redshift=-8;
@@ -73,9 +73,10 @@ void fillimage(StarfishRef tex, display_info *di, int xzoom, int yzoom)
   for (y=0; y<di->height; y++)
   {
     dx=0;
+    row = PeekRasterLine(tex, y);
     for (x=0; x<di->width; x++)
     {
-      GetStarfishPixel(x, y, tex, &pixel);
+      pixel = row[x];
       value  = compose(pixel.red,redshift) & di->image->red_mask;
       value += compose(pixel.green,greenshift) & di->image->green_mask;
       value += compose(pixel.blue,blueshift) & di->image->blue_mask;
@@ -83,7 +84,7 @@ void fillimage(StarfishRef tex, display_info *di, int xzoom, int yzoom)
       XPutPixel(di->image,dx+xzoom-1,dy,value);
       // so that we can generate the interpolated pixels to it's left.
       if(xzoom>1) {
-        if(x==0) GetStarfishPixel(di->width-1, y, tex, &oldpix);
+        if(x==0) oldpix = row[di->width-1];
         dr=(pixel.red-oldpix.red)*xstep;
         dg=(pixel.green-oldpix.green)*xstep;
         db=(pixel.blue-oldpix.blue)*xstep;
@@ -150,7 +151,7 @@ void XSetWindowBackgroundImage(display_info *di)
   }
 }
 
-void mainloop(StarfishRef tex, display_info *displays, int xzoom, int yzoom)
+void mainloop(pixbuf tex, display_info *displays, int xzoom, int yzoom)
 {
   char *buf;
   int bpl;
@@ -205,10 +206,11 @@ void mainloop(StarfishRef tex, display_info *displays, int xzoom, int yzoom)
 }
 
 void SetXDesktop(StarfishRef tex, const char* displayname,
-                 int xzoom, int yzoom)
+                 int xzoom, int yzoom, int threads)
 {
   display_info *displays;
   Display *display;
+  pixbuf rendered;
   int screen_count;
   int i;
   if (! (display = XOpenDisplay(displayname)))
@@ -216,6 +218,15 @@ void SetXDesktop(StarfishRef tex, const char* displayname,
     fprintf(stderr, "xstarfish: Failed to open display\n");
     return;
   }
+  // render the texture once, on as many threads as we were asked for,
+  // then copy it onto each screen.
+  if (! (rendered = MakePixBuf(StarfishWidth(tex), StarfishHeight(tex))))
+  {
+    fprintf(stderr, "xstarfish: Failed to allocate image\n");
+    XCloseDisplay(display);
+    return;
+  }
+  RenderStarfish(tex, rendered, threads);
   screen_count = ScreenCount(display);
   displays = malloc(sizeof(display_info) * (screen_count + 1));
 
@@ -235,7 +246,8 @@ void SetXDesktop(StarfishRef tex, const char* displayname,
       displays[i].height = StarfishHeight(tex);
   }
 
-  mainloop(tex, displays, xzoom, yzoom);
+  mainloop(rendered, displays, xzoom, yzoom);
+  DumpPixBuf(rendered);
   XCloseDisplay(displays[0].display);
   return;
 }
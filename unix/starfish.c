@@ -37,6 +37,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <ctype.h>
 #include <X11/bitmaps/gray>
 #include <unistd.h>
@@ -45,6 +47,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "setdesktop.h"
 #include "makepng.h"
 #include "genutils.h"
+#include "starfish-recipe.h"
 
 void usage(void)
 	{
@@ -79,12 +82,46 @@ void usage(void)
  		"		the zoom factor will be XxX.\n"
  		"-p/--pidfile:	Creates a $HOME/.xstarfish* file containing the pid\n"
  		"               of the daemon if xstarfish is forking into the background.\n"
-	        "-r,--random:   Specify seed for rand() call - for debugging.\n"
+	        "-r,--random:   Specify the random seed. The same seed and options\n"
+		"		always produce the same pattern.\n"
+		"-t,--threads:	Number of threads to render with. Use \"auto\" for one\n"
+		"		thread per processor. The default is 1. The pattern\n"
+		"		comes out the same no matter how many threads you use.\n"
+		"--aa-contrast:	Only supersample where neighbouring samples differ by\n"
+		"		more than this many levels (out of 255). Higher is\n"
+		"		faster but rougher; 2 or 3 is not visible. The default\n"
+		"		is 0, which always supersamples.\n"
+		"--seam-width:	How much of the tile, from 0.05 to 1, to blend over\n"
+		"		when wrapping patterns that don't tile by themselves.\n"
+		"		Narrower is faster. The default is 1, the whole tile.\n"
+		"--fast-math:	Use quick approximations in place of the maths library.\n"
+		"		Much faster, but the pattern differs by the odd level\n"
+		"		here and there from the one the same seed gives without it.\n"
+		"--bubbles:	How many bubbles to put in bubble layers, up to 100000.\n"
+		"		More than 32 make smaller bubbles, like foam. The\n"
+		"		default is a random number up to 32.\n"
+		"--octaves:	How many octaves of detail to add up in Perlin noise\n"
+		"		layers, from 1 to 12. The default is a random number\n"
+		"		from 3 to 7. Small layers leave out octaves too fine\n"
+		"		to see.\n"
+		"--lazy-fractals: Build the fine detail of range fractals only where\n"
+		"		the pattern needs it, instead of all of it before\n"
+		"		drawing starts. The pattern comes out the same.\n"
+		"--palette:	Pick colours only from this list, written as rrggbb\n"
+		"		values separated by commas, like ff8000,102040,ffffff.\n"
+		"		The default is any colour at all.\n"
+		"--ramps:	Colour each layer with a ramp through every colour of\n"
+		"		the palette, in order, instead of fading between two.\n"
+		"--recipe:	Build the pattern from a recipe file saved earlier, at\n"
+		"		whatever size you ask for, instead of a random one.\n"
+		"--save-recipe:	Write the recipe for the pattern to a file, so it can\n"
+		"		be built again later at any size with --recipe.\n"
 		"--display:	Name of the desired target display.\n"
 	    );
 	}
 
-void CalcRandomSize(int* width, int* height, const char* sizename, const char* displayname)
+void CalcRandomSize(int* width, int* height, const char* sizename, const char* displayname,
+		RandRef rng)
 	{
 	/*
 	Figure out how big the default monitor is.
@@ -134,11 +171,47 @@ void CalcRandomSize(int* width, int* height, const char* sizename, const char* d
 		maxH /= 2;
 		maxV /= 2;
 		}
-	*width = irandge(minH, maxH);
-	*height = irandge(minV, maxV);
+	*width = irandge(rng, minH, maxH);
+	*height = irandge(rng, minV, maxV);
 	if(display) XCloseDisplay(display);
 	}
 
+int LoadRecipeFile(const char* filename, StarfishRecipe* recipe)
+	{
+	/*
+	Read a recipe from the named file.
+	Complain and return zero if we can't.
+	*/
+	int out = 0;
+	FILE* file = fopen(filename, "r");
+	if(file)
+		{
+		out = ReadStarfishRecipe(file, recipe);
+		fclose(file);
+		if(!out) fprintf(stderr, "xstarfish: \"%s\" is not a valid recipe.\n", filename);
+		}
+	else fprintf(stderr, "xstarfish: could not open recipe file \"%s\".\n", filename);
+	return out;
+	}
+
+void SaveRecipeFile(StarfishRef texture, const char* filename)
+	{
+	//Write out the recipe this texture was built from.
+	StarfishRecipe recipe;
+	FILE* file;
+	if(!GetStarfishRecipe(texture, &recipe)) return;
+	file = fopen(filename, "w");
+	if(file)
+		{
+		if(!WriteStarfishRecipe(file, &recipe))
+			{
+			fprintf(stderr, "xstarfish: could not write recipe file \"%s\".\n", filename);
+			}
+		fclose(file);
+		}
+	else fprintf(stderr, "xstarfish: could not open recipe file \"%s\".\n", filename);
+	}
+
 void ExtractGeometry(const char* geostr, int* width, int* height)
 	{
 	/*
@@ -185,8 +258,7 @@ int main(int argc, char** argv)
 	Default behaviour is non-daemon. Starfish simply starts up, does its thing, and quits. 
 	If daemon is specified but no time is given, Starfish uses 20 minutes interval.
 	Default width and height are 256 pixels.
-	Though the starfish engine supports colour palettes, there is currently no way to
-	access that feature through the command line.
+	Colour palettes are given on the command line as a list of rrggbb values.
 
 	mjs 13/12/2k - the following comment appeared in the original source but I never 
 		implemented the functionality it describes. It is unlikely it ever will
@@ -218,6 +290,21 @@ int main(int argc, char** argv)
  	int xzoom, yzoom;
 	const char* filename;
 	char haveOutfile;
+	int threads;
+	int aacontrast;
+	float seamwidth;
+	int bubbles;
+	int octaves;
+	int fastmath;
+	int lazyfractals;
+	StarfishPalette palette;
+	char havePalette;
+	char ramps;
+	RandomRec rng;
+	uint64_t seed;
+	StarfishRecipe recipe;
+	char haveRecipe;
+	const char* recipeOutName;
 	/*
 	Set up our defaults. These may be overridden by command line parameters.
 	*/
@@ -229,7 +316,18 @@ int main(int argc, char** argv)
 	sizeName = NULL;
 	filename = NULL;
 	haveOutfile = 0;
-	srand(time(0));  /* we may override this when parsing the arguments */
+	threads = 1;
+	aacontrast = 0;
+	seamwidth = 1.0;
+	bubbles = 0;
+	octaves = 0;
+	fastmath = 0;
+	lazyfractals = 0;
+	havePalette = 0;
+	ramps = 0;
+	haveRecipe = 0;
+	recipeOutName = NULL;
+	seed = time(0);  /* we may override this when parsing the arguments */
         xzoom = yzoom = 1;
 	for(ctr = 1; ctr < argc; ctr++)
 		{
@@ -315,13 +413,93 @@ int main(int argc, char** argv)
 			*/ 
 			if(ctr + 1 < argc && isdigit(argv[ctr + 1][0]))
 				{
-				srand(atoi(argv[++ctr]));
+				seed = strtoull(argv[++ctr], NULL, 10);
 				}
 			else
 				{
 			        fprintf(stderr, "xstarfish: \"-r\" requires an argument.\n");
 				}			     
 			}
+		else if(!strcmp(argv[ctr], "-t") || !strcmp(argv[ctr], "--threads"))
+			{
+			/*
+			The next parameter is a thread count, or "auto" to use
+			one thread for every processor that is online.
+			*/
+			if(ctr + 1 < argc && isdigit(argv[ctr + 1][0]))
+				{
+				threads = atoi(argv[++ctr]);
+				if(threads < 1) threads = 1;
+				}
+			else if(ctr + 1 < argc && !strcmp(argv[ctr + 1], "auto"))
+				{
+				ctr++;
+				threads = sysconf(_SC_NPROCESSORS_ONLN);
+				if(threads < 1) threads = 1;
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: \"-t\" requires an argument.\n");
+				}
+			}
+		else if(!strcmp(argv[ctr], "--aa-contrast"))
+			{
+			//The next parameter is the contrast, in channel levels.
+			if(ctr + 1 < argc && isdigit(argv[ctr + 1][0]))
+				{
+				aacontrast = atoi(argv[++ctr]);
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+				}
+			}
+		else if(!strcmp(argv[ctr], "--seam-width"))
+			{
+			//The next parameter is the share of the tile to blend over.
+			if(ctr + 1 < argc && (isdigit(argv[ctr + 1][0]) || argv[ctr + 1][0] == '.'))
+				{
+				seamwidth = atof(argv[++ctr]);
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+				}
+			}
+		else if(!strcmp(argv[ctr], "--bubbles"))
+			{
+			//The next parameter is the number of bubbles, which goes into the recipe.
+			if(ctr + 1 < argc && isdigit(argv[ctr + 1][0]))
+				{
+				bubbles = atoi(argv[++ctr]);
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+				}
+			}
+		else if(!strcmp(argv[ctr], "--octaves"))
+			{
+			//The next parameter is the number of octaves in Perlin layers, for the recipe.
+			if(ctr + 1 < argc && isdigit(argv[ctr + 1][0]))
+				{
+				octaves = atoi(argv[++ctr]);
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+				}
+			}
+		else if(!strcmp(argv[ctr], "--fast-math"))
+			{
+			//This goes into the recipe too.
+			fastmath = 1;
+			}
+		else if(!strcmp(argv[ctr], "--lazy-fractals"))
+			{
+			//Range fractals only build their fine detail where it gets looked at.
+			lazyfractals = 1;
+			}
 		else if(!strcmp(argv[ctr], "-h") || !strcmp(argv[ctr], "--usage")
 				|| !strcmp(argv[ctr], "--help"))
 			{
@@ -341,6 +519,49 @@ int main(int argc, char** argv)
 				);
 			return 0;
 			}
+		else if(!strcmp(argv[ctr], "--palette"))
+			{
+			//The next parameter is the list of colours to pick from.
+			if(ctr + 1 < argc)
+				{
+				if(!ReadStarfishPalette(argv[++ctr], &palette))
+					{
+					fprintf(stderr, "xstarfish: \"%s\" is not a valid palette.\n", argv[ctr]);
+					return 1;
+					}
+				havePalette = 1;
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+				}
+			}
+		else if(!strcmp(argv[ctr], "--ramps"))
+			{
+			//Layers ramp through the whole palette instead of fading between two colours.
+			ramps = 1;
+			}
+		else if(!strcmp(argv[ctr], "--recipe"))
+			{
+			/*
+			The next parameter is a recipe file. Read it now, so we can
+			complain before forking off if it's no good.
+			*/
+			if(ctr + 1 < argc)
+				{
+				if(!LoadRecipeFile(argv[++ctr], &recipe)) return 1;
+				haveRecipe = 1;
+				}
+			else
+				{
+				fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+				}
+			}
+		else if(!strcmp(argv[ctr], "--save-recipe"))
+			{
+			if(ctr + 1 < argc) recipeOutName = argv[++ctr];
+			else fprintf(stderr, "xstarfish: %s requires an argument.\n", argv[ctr]);
+			}
 		else if(!strcmp(argv[ctr], "--display"))
 			{
 			ctr++;
@@ -396,14 +617,30 @@ int main(int argc, char** argv)
 	the image to disk; otherwise, we set it as the X11 root background.
 	*/
 	//Make a starfish texture description we can pull pixels from.
+	//Each pattern gets its own seed, drawn from a stream started at our seed.
+	SeedRandom(&rng, seed);
 	do
 		{
-		if(sizeName) CalcRandomSize(&width, &height, sizeName, displayName);
-		texture = MakeStarfish(width, height, NULL);
+		if(sizeName) CalcRandomSize(&width, &height, sizeName, displayName, &rng);
+		//Roll a fresh recipe unless we were given one.
+		if(!haveRecipe)
+			{
+			if(ramps) RandomStarfishRampRecipe(RandomSeed(&rng), havePalette ? &palette : NULL, &recipe);
+			else RandomStarfishRecipe(RandomSeed(&rng), havePalette ? &palette : NULL, &recipe);
+			}
+		//Settings from the command line fill in whatever the recipe leaves open.
+		if(!recipe.bubbles) recipe.bubbles = bubbles;
+		if(!recipe.octaves) recipe.octaves = octaves;
+		if(fastmath) recipe.fastmath = 1;
+		//Big layers are built with the same threads the pattern is rendered with.
+		texture = BuildStarfishFromRecipe(&recipe, width, height, threads, lazyfractals);
 		if(texture)
 			{
-			if(haveOutfile) MakePNGFile(texture, filename);
-			else SetXDesktop(texture, displayName, xzoom, yzoom);
+			if(recipeOutName) SaveRecipeFile(texture, recipeOutName);
+			SetStarfishAntiAliasing(texture, aacontrast);
+			SetStarfishSeamWidth(texture, seamwidth);
+			if(haveOutfile) MakePNGFile(texture, filename, threads);
+			else SetXDesktop(texture, displayName, xzoom, yzoom, threads);
 			DumpStarfish(texture);
 			}
 		else